@@ -1,9 +1,25 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstring>          // strcmp
+#include <cstdio>           // sscanf, snprintf
+#include <algorithm>        // sort
+#include <chrono>           // Headless frame timing
+#include <vector>
+#include <thread>           // hardware_concurrency
+#include <memory>           // shared_ptr, loader job state
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
+#include "texture_decoder.h"    // Image decoding on worker threads
+#include "image_kernel_bench.h" // --bench-image-kernels
+#include "texture_cooker.h"    // --cook-textures, block-compressed KTX2 textures
+#include "virtual_texture.h"    // --cook-virtual-texture, desk surface paged in by feedback
+#include "lz_image.h"           // --cook-textures lossless, --bench-image-decode
+#include "decode_buffer_pool.h" // Reusable buffers behind stb_image allocations
+#define STBI_MALLOC(size)           DecodeBufferPool::Shared().Allocate(size)
+#define STBI_REALLOC(block, size)   DecodeBufferPool::Shared().Reallocate(block, size)
+#define STBI_FREE(block)            DecodeBufferPool::Shared().Free(block)
 #define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>      // Image loading Utility functions
+#include <stb_image.h>      // Image loading Utility functions, allocating from the decode buffer pool
 
 // GLM Math Header inclusions
 #include <glm/glm.hpp>
@@ -12,12 +28,20 @@
 
 #include <learnOpengl/camera.h> // Camera class
 
-using namespace std; // Standard namespace
+#include "headless_context.h"   // Offscreen context for benchmarking without a display (not traced, see below)
+#include "gl_trace.h"           // GL call counts/timing and capture (ENABLE_GL_TRACE), capture replay
+#include "gl_state_cache.h"     // Skips redundant binds and enables in the render loop
+#include "resource_loader.h"    // Loader thread on a shared context, fenced publication of meshes and textures
+#include "texture_residency.h"  // Texture memory budget, drops levels of the least recently used textures
+#include "program_library.h"    // Shader programs shared by source hash, on-disk binary cache
+#include "program_variants.h"   // Compile-time shader permutations built on demand
+#include "clustered_lighting.h" // Clustered forward+ light assignment
+#include "ring_buffer.h"        // Persistently mapped per-frame uniform/storage ring
+#include "profiler.h"           // Scoped CPU zones (ENABLE_PROFILER), Chrome trace export
+#include "gpu_timer.h"          // GPU time per pass from delayed timestamp queries
+#include "input_recorder.h"     // Input capture and deterministic replay
 
-/*Shader program Macro*/
-#ifndef GLSL
-#define GLSL(Version, Source) "#version " #Version " core \n" #Source
-#endif
+using namespace std; // Standard namespace
 
 // Unnamed namespace
 namespace
@@ -34,10 +58,47 @@ namespace
         GLuint vao;         // Handle for the vertex array object
         GLuint vbo;         // Handle for the vertex buffer object
         GLuint nVertices;    // Number of indices of the mesh
+        glm::vec3 center;   // Bounding sphere in object space
+        float radius;
+        float uvDensity;    // Texture coordinate units per object space unit
     };
 
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
+    // Hidden window sharing objects with the main one, its context is current on the resource loader thread
+    GLFWwindow* gLoaderWindow = nullptr;
+
+    // Headless benchmark mode (--headless): offscreen framebuffer, fixed timestep, timing statistics on exit
+    bool gHeadless = false;
+    HeadlessContext gHeadlessContext;
+    int gHeadlessFrames = 600;
+    const int HEADLESS_WARMUP_FRAMES = 10;          // Not included in the statistics (shader and texture first use)
+    const float HEADLESS_TIMESTEP = 1.0f / 60.0f;
+
+    // Chrome trace JSON written on exit (--trace, needs a build with ENABLE_PROFILER)
+    const char* gTraceFile = nullptr;
+
+    // GPU pass timings, shown with the CPU render time in the window title
+    GpuTimerPool gGpuTimers;
+    const double TIMING_TITLE_INTERVAL = 0.5; // seconds
+    double gTimingTitleCpuSeconds = 0.0;
+    int gTimingTitleFrames = 0;
+    double gTimingTitleLastUpdate = 0.0;
+
+    // Shadow GL state for the render loop, redundant calls are skipped and counted per frame
+    GLStateCache gStateCache;
+    unsigned int gTimingTitleSkippedCalls = 0;
+
+    // Input recording (--record) and replay (--replay): keys are stored as one bit per entry of this table
+    const int RECORDED_KEYS[] = {
+        GLFW_KEY_ESCAPE, GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E,
+        GLFW_KEY_L, GLFW_KEY_K, GLFW_KEY_P, GLFW_KEY_O, GLFW_KEY_C, GLFW_KEY_X, GLFW_KEY_1, GLFW_KEY_2
+    };
+    InputRecorder gInputRecorder;
+    uint32_t gFrameKeys = 0; // Keys seen pressed during the current frame
+
+    // GL command stream replay (--gl-replay); the context comes from the normal window or headless setup
+    const char* gGLReplayFile = nullptr;
 
     // Plane mesh data
     GLMesh gMesh;
@@ -54,23 +115,47 @@ namespace
     // Cup mesh data
     GLMesh gCupMesh;
 
-    // Texture
-    GLuint gCylinderTextureId;
-    GLuint gSphereTextureId;
-    GLuint gPlaneTextureId;
-    GLuint gCylinderTextureId2;
-    GLuint gTorusTextureId;
-    GLuint gCubeTextureId;
-    GLuint gPrismTextureId;
-    GLuint gCupTextureId;
-
-    glm::vec2 gUVScale(1.0f, 1.0f);
-    GLint gTexWrapMode = GL_REPEAT;
+    // Sampler objects shared by the materials; both repeat and filter between mip levels, the anisotropic
+    // one is for surfaces seen at grazing angles
+    enum SamplerPreset
+    {
+        SAMPLER_TRILINEAR,
+        SAMPLER_ANISOTROPIC,
+        SAMPLER_PRESET_COUNT
+    };
+    GLuint gSamplers[SAMPLER_PRESET_COUNT];
+    const GLfloat MAX_ANISOTROPY = 8.0f;
 
-    // Shader program
-    GLuint gProgramId;
-    GLuint gKeyLightProgramId;
-    GLuint gFillLightProgramId;
+    // Texture of a shape, the sampler preset it is filtered with and the scale of its texture coordinates
+    struct Material
+    {
+        GLuint texture;
+        SamplerPreset sampler;
+        glm::vec2 uvScale;
+    };
+    Material gCylinderMaterial = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+    Material gSphereMaterial = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+    Material gPlaneMaterial = { 0, SAMPLER_ANISOTROPIC, glm::vec2(1.0f) };
+    Material gCylinderMaterial2 = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+    Material gTorusMaterial = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+    Material gCubeMaterial = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+    Material gPrismMaterial = { 0, SAMPLER_ANISOTROPIC, glm::vec2(1.0f) };
+    Material gCupMaterial = { 0, SAMPLER_TRILINEAR, glm::vec2(1.0f) };
+
+    // Shader program (the object and lamp programs are variants of the object shader, see gObjectShaders)
+    GLuint gClusteredProgramId;
+
+    // Forward lights of the object shader: the key and fill lamps. "1" shades with the key light only,
+    // "2" with both, each count is its own shader variant.
+    const int MAX_FORWARD_LIGHTS = 4;   // Array size in FrameData
+    int gForwardLightCount = 2;
+
+    // Object shader variants the render loop draws with, resolved by UResolveObjectPrograms at startup and
+    // whenever gForwardLightCount changes so a frame builds no define strings
+    GLuint gObjectProgramId = 0;
+    GLuint gLampProgramId = 0;
+    GLuint gVirtualDeskProgramId = 0;           // Without a virtual texture these two stay 0
+    GLuint gVirtualDeskFeedbackProgramId = 0;
 
     // camera
     Camera gCamera(glm::vec3(0.5f, -3.0f, 8.0f));
@@ -103,8 +188,59 @@ namespace
     // Lamp animation
     bool gIsLampOrbiting = true;
 
+    // Sector/stack count of the procedural meshes (--mesh-detail N), high values stress the vertex stage
+    int gMeshDetail = 30;
+
+    // Per-frame shader data, mirrors the std140 FrameData block (binding 0)
+    struct FrameUniforms
+    {
+        glm::vec4 viewPosition;
+        glm::vec4 viewDepthPlane;       // Negated third row of the view matrix
+        glm::vec4 objectColor;
+        glm::vec4 lightColors[MAX_FORWARD_LIGHTS];     // rgb color, w ambient strength
+        glm::vec4 lightPositions[MAX_FORWARD_LIGHTS];
+        glm::vec4 clusterParameters;    // Tile width and height, depth slice scale and bias
+        GLuint clusterDimensions[4];
+        glm::vec4 virtualTextureSize;   // Width and height in texels, page size, level count
+        glm::vec4 virtualTextureAtlas;  // Slot size, page border, atlas size in texels, feedback level bias
+    };
+
+    // Per-draw shader data, mirrors the std140 DrawData block (binding 1)
+    struct DrawUniforms
+    {
+        glm::mat4 model;
+        glm::mat4 modelViewProjection;
+        glm::vec4 normalMatrix[3];      // mat3 columns are padded to vec4 in std140
+        glm::vec4 shapeColor;
+        glm::vec4 uvScale;              // Only xy is read
+    };
+
+    const GLuint FRAME_UNIFORM_BINDING = 0;
+    const GLuint DRAW_UNIFORM_BINDING = 1;
+
+    // Room for the frame block and the per-draw blocks of one frame (a few dozen blocks aligned to up to 256 bytes)
+    const GLsizeiptr DRAW_UNIFORM_RING_BYTES = 64 << 10;
+    PersistentRingBuffer gUniformRing;
+
     // Switch Projection
     bool isPerspective = true;
+
+    // Current framebuffer size (tracks window resizes)
+    int gViewportWidth = WINDOW_WIDTH;
+    int gViewportHeight = WINDOW_HEIGHT;
+
+    // Clustered forward+ lighting: key and fill lamps plus a set of small dynamic lights
+    const int CLUSTER_DYNAMIC_LIGHT_COUNT = 254;
+    const int CLUSTER_POINT_LIGHT_COUNT = CLUSTER_DYNAMIC_LIGHT_COUNT + 2;
+    const int CLUSTER_SPOT_LIGHT_COUNT = 1;
+
+    // All dynamic uniform and light data goes through this ring: the worst case clustered light upload plus the
+    // uniform blocks, about 1 MB per frame in flight
+    const GLsizeiptr UNIFORM_RING_REGION_SIZE = ClusteredLighting::MaxRingBytes(CLUSTER_POINT_LIGHT_COUNT, CLUSTER_SPOT_LIGHT_COUNT) + DRAW_UNIFORM_RING_BYTES;
+    bool gUseClusteredLighting = false;
+    ClusteredLighting gClusteredLighting;
+    std::vector<glm::vec3> gDynamicLightBasePositions;
+    float gDynamicLightAngle = 0.0f;
 }
 
 /* User-defined Function prototypes to:
@@ -113,22 +249,161 @@ namespace
  * and render graphics on the screen
  */
 bool UInitialize(int, char* [], GLFWwindow** window);
+bool UInitializeHeadless(int width, int height);
+void URunHeadless(int frameCount);
+bool URunGLReplay(const char* path);
+void UPrintFrameTimes(const char* label, std::vector<double> frameTimes);
+void UUpdateTimingTitle(double renderSeconds);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+bool UIsKeyPressed(GLFWwindow* window, int key);
+void UMoveCamera(double xpos, double ypos);
+void UZoomCamera(double yoffset);
+bool UBeginInputFrame();
+void UEndInputFrame();
 void UCreateMesh(GLMesh& mesh, const char* type);
 void UDestroyMesh(GLMesh& mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
+void UCreateMeshVertexArray(GLMesh& mesh);
+void UDrawMesh(const GLMesh& mesh, GLenum mode);
+void UMeasureMesh(GLMesh& mesh, const float* vertices, GLenum mode);
+void UStartResourceLoader();
+void ULoadMesh(GLMesh& mesh, const char* type);
+void ULoadTextures();
+std::string UDecodedImagePath(size_t file);
+void UReloadTexture(size_t file);
+void UStreamTextureLevel(size_t file, int level);
+void UCreatePlaceholderTexture();
+GLenum UCompressedFormat(bc::Format format);
+bool UCreateTexture(const TextureDecoder::Image& image, GLuint& textureId);
+bool UCreateCompressedTexture(const CompressedTexture& texture, GLuint& textureId);
+bool UCookTextures(const char* mode);
+bool UCookVirtualTexture(const char* imagePath);
+void UOpenVirtualTexture();
+void ULoadVirtualTexturePage(int level, int x, int y);
 void UDestroyTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void UResolveObjectPrograms();
+void UCreateClusterLights();
+void UUpdateClusterLights();
+bool UPushDrawUniforms(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec4& shapeColor = glm::vec4(1.0f), const glm::vec2& uvScale = glm::vec2(1.0f));
+void UCreateSamplers();
+void UBindMaterial(const Material& material, const GLMesh& mesh, const glm::mat4& model);
+float UTextureCoordinatesPerPixel(const GLMesh& mesh, const glm::mat4& model, const glm::vec2& uvScale);
+bool UBindRingRange(GLenum target, GLuint index, const PersistentRingBuffer::Allocation& allocation);
+std::string UObjectShaderVariant(int lightCount, bool textured, bool normalMapped);
+
+namespace
+{
+    // Every shader program goes through the library so identical source pairs are linked once
+    ProgramLibrary gPrograms;
+
+    // Linked program binaries from earlier runs (disabled with --no-program-cache)
+    const char* const PROGRAM_BINARY_CACHE_DIRECTORY = "shadercache";
+    bool gUseProgramBinaryCache = true;
+    ProgramBinaryCache gProgramBinaryCache;
+
+    // Texture of each shape: name.png in the texture directory, or name.ktx2 in the cooked directory
+    // when --cook-textures has written one that is up to date and the driver has its format. An up to date
+    // name.lzi in the cooked directory (--cook-textures lossless) is decoded instead of the PNG.
+    const char* const TEXTURE_DIRECTORY = "../../resources/textures/";
+    const char* const COOKED_TEXTURE_DIRECTORY = "../../resources/textures/cooked/";
+    struct TextureFile
+    {
+        const char* name;
+        GLuint* textureId;
+    };
+    const TextureFile TEXTURE_FILES[] =
+    {
+        { "wood-texture", &gCylinderMaterial.texture },
+        { "snow-texture", &gSphereMaterial.texture },
+        { "desk-texture", &gPlaneMaterial.texture },
+        { "speaker-texture", &gCylinderMaterial2.texture },
+        { "silver-texture", &gTorusMaterial.texture },
+        { "rubik-texture", &gCubeMaterial.texture },
+        { "laptop-texture", &gPrismMaterial.texture },
+        { "cup-texture", &gCupMaterial.texture }
+    };
+    const size_t TEXTURE_COUNT = sizeof(TEXTURE_FILES) / sizeof(TEXTURE_FILES[0]);
+
+    // Meshes and textures are created on the loader thread while the first frames render: a mesh is drawn
+    // once its vertex buffer is filled, a material shows the 1x1 grey placeholder until its texture is ready
+    ResourceLoader gResourceLoader;
+    GLuint gPlaceholderTextureId = 0;
+    std::chrono::steady_clock::time_point gStartupTime;
+
+    // Every loaded texture is registered with its level sizes; over the budget (--texture-budget MB, no
+    // limit by default) the least recently bound textures lose their top levels until they are needed again
+    TextureResidency gTextureResidency;
+
+    // Desk surface from a virtual texture when --cook-virtual-texture IMAGE has written its page file: the plane
+    // samples pages from an atlas through a page table, and a feedback pass at a fraction of the resolution tells
+    // which pages to load. Forward lighting only, the clustered pass keeps the plain desk texture.
+    const char* const VIRTUAL_TEXTURE_FILE = "desk-texture.vtex";
+    VirtualTexture gDeskVirtualTexture;
+
+    // A texture created by a loader job, with what the residency registry needs to know about its levels
+    struct LoadedTexture
+    {
+        GLuint id;
+        GLenum internalFormat;
+        int width;
+        int height;
+        std::vector<size_t> levelBytes;
+        int baseLevel;                      // First level of levelBytes the texture holds
+        bool cooked;
+    };
+    const size_t NO_DECODE = size_t(-1);    // ULoadTextureFile: read the cooked file, decode only as a fallback
+
+    // Results of the startup texture jobs, each job fills its own entry and the completions read them
+    struct TextureLoads
+    {
+        LoadedTexture textures[TEXTURE_COUNT];
+        size_t completed;
+        unsigned int decodeThreads;
+    };
+}
+
+bool ULoadTextureFile(size_t file, TextureDecoder& decoder, size_t decodeIndex, LoadedTexture& loaded);
+bool ULoadCookedTexture(size_t file, LoadedTexture& loaded);
+bool UCreateDecodedTexture(const TextureDecoder::Image& image, LoadedTexture& loaded);
+void URegisterTexture(size_t file, const LoadedTexture& loaded);
+
+/* Shader chunks shared through #include */
+const GLchar* frameDataInclude = R"glsl(
+// Camera, light and cluster data shared by every draw of the frame (FrameUniforms on the CPU)
+#define MAX_FORWARD_LIGHTS 4
+layout(std140, binding = 0) uniform FrameData
+{
+    vec4 viewPosition;
+    vec4 viewDepthPlane;    // Negated third row of the view matrix
+    vec4 objectColor;
+    vec4 lightColors[MAX_FORWARD_LIGHTS];       // rgb color, w ambient strength
+    vec4 lightPositions[MAX_FORWARD_LIGHTS];
+    vec4 clusterParameters; // Tile width and height, depth slice scale and bias
+    uvec4 clusterDimensions;
+    vec4 virtualTextureSize;    // Width and height in texels, page size, level count
+    vec4 virtualTextureAtlas;   // Slot size, page border, atlas size in texels, feedback level bias
+} frame;
+)glsl";
+
+const GLchar* drawDataInclude = R"glsl(
+// Per-draw transform matrices (combined on the CPU once per object, read from the uniform ring buffer)
+layout(std140, binding = 1) uniform DrawData
+{
+    mat4 model;
+    mat4 modelViewProjection;
+    mat3 normalMatrix;      // transpose(inverse(model)), world space normals without translation
+    vec4 shapeColor;
+    vec2 uvScale;
+} draw;
+)glsl";
 
 /* Vertex Shader for Object*/
-const GLchar* vertexShaderSource = GLSL(440,
-    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+const GLchar* vertexShaderSource = R"glsl(#version 440 core
+layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 layout(location = 1) in vec3 normal; // VAP position 1 for normals
 layout(location = 2) in vec2 textureCoordinate;
 
@@ -136,254 +411,491 @@ out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
 
-//Global variables for the transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "draw_data.glsl"
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    gl_Position = draw.modelViewProjection * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    vertexFragmentPos = vec3(draw.model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // Get normal vectors in world space only and exclude normal translation properties
+    vertexNormal = draw.normalMatrix * normal; // Get normal vectors in world space only and exclude normal translation properties
 
     vertexTextureCoordinate = textureCoordinate;
 }
-);
+)glsl";
+
 
+/* Fragment Shader for Object, specialized per variant:
+ * LIGHT_COUNT      Phong lights read from FrameData (0 = unlit, used for the lamp markers)
+ * TEXTURED         albedo from uTexture, otherwise the draw's shape color
+ * NORMAL_MAPPED    normal perturbed by uNormalMap (texture unit 1)
+ * VIRTUAL_TEXTURE  1: albedo from the virtual texture, uPageTable (unit 2) and uPageAtlas (unit 3)
+ *                  2: feedback pass, writes the virtual texture page the fragment needs instead of shading
+ */
+const GLchar* fragmentShaderSource = R"glsl(#version 440 core
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 2
+#endif
+#ifndef TEXTURED
+#define TEXTURED 1
+#endif
+#ifndef NORMAL_MAPPED
+#define NORMAL_MAPPED 0
+#endif
+#ifndef VIRTUAL_TEXTURE
+#define VIRTUAL_TEXTURE 0
+#endif
 
-/* Fragment Shader for Object */
-const GLchar* fragmentShaderSource = GLSL(440,
-    in vec3 vertexNormal;
+in vec3 vertexNormal;
 in vec3 vertexFragmentPos;
 in vec2 vertexTextureCoordinate;
 
 out vec4 fragmentColor;
 
-uniform vec3 objectColor;
-
-uniform vec3 lightColor1;
-uniform vec3 lightPos1;
+#include "frame_data.glsl"
+#include "draw_data.glsl"
 
-uniform vec3 lightColor2;
-uniform vec3 lightPos2;
+#if TEXTURED
+layout(binding = 0) uniform sampler2D uTexture;
+#endif
 
-uniform vec3 viewPosition;
-uniform sampler2D uTexture;
-uniform vec2 uvScale;
+#if NORMAL_MAPPED
+layout(binding = 1) uniform sampler2D uNormalMap;
 
-void main()
+// The meshes carry no tangents, the tangent frame is built from screen space derivatives
+vec3 PerturbNormal(vec3 normal, vec2 uv)
 {
-    float ambientStrength1 = 0.3f;
-    vec3 ambient1 = ambientStrength1 * lightColor1;
-
-    float ambientStrength2 = 0.1f;
-    vec3 ambient2 = ambientStrength2 * lightColor2;
+    vec3 dp1 = dFdx(vertexFragmentPos);
+    vec3 dp2 = dFdy(vertexFragmentPos);
+    vec2 duv1 = dFdx(uv);
+    vec2 duv2 = dFdy(uv);
+
+    vec3 dp2perp = cross(dp2, normal);
+    vec3 dp1perp = cross(normal, dp1);
+    vec3 tangent = dp2perp * duv1.x + dp1perp * duv2.x;
+    vec3 bitangent = dp2perp * duv1.y + dp1perp * duv2.y;
+    float scale = inversesqrt(max(dot(tangent, tangent), dot(bitangent, bitangent)));
+
+    vec3 tangentNormal = texture(uNormalMap, uv).xyz * 2.0 - 1.0;
+    return normalize(mat3(tangent * scale, bitangent * scale, normal) * tangentNormal);
+}
+#endif
 
-    // Calculate Diffuse lighting
-    vec3 norm = normalize(vertexNormal);
-    vec3 lightDirection1 = normalize(lightPos1 - vertexFragmentPos);
-    vec3 lightDirection2 = normalize(lightPos2 - vertexFragmentPos);
+#if VIRTUAL_TEXTURE
+layout(binding = 2) uniform usampler2D uPageTable;
+layout(binding = 3) uniform sampler2D uPageAtlas;
 
-    float impact1 = max(dot(norm, lightDirection1), 0.0);
-    vec3 diffuse1 = impact1 * lightColor1;
+// Virtual texture level the fragment samples, from the screen derivatives of its texel coordinates
+float VirtualTextureLevel(vec2 uv, float bias)
+{
+    vec2 texels = uv * frame.virtualTextureSize.xy;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float level = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + bias;
+    return clamp(floor(level), 0.0, frame.virtualTextureSize.w - 1.0);
+}
 
-    float impact2 = max(dot(norm, lightDirection2), 0.0);
-    vec3 diffuse2 = impact2 * lightColor2;
+// Texel coordinates of uv on a level, repeating like the plain textures (level sizes round down like the mip chain)
+vec2 VirtualTextureTexel(vec2 uv, float level)
+{
+    return fract(uv) * max(floor(frame.virtualTextureSize.xy / exp2(level)), vec2(1.0));
+}
 
-    // Calculate Specular lighting
-    float specularIntensity1 = 0.1f;
-    float specularIntensity2 = 0.1f;
+// Bilinear sample of the finest resident page: the page table entry names the atlas slot and the level of the
+// page, which is coarser than the one asked for while that one is loading
+vec3 SampleVirtualTexture(vec2 uv)
+{
+    float pageSize = frame.virtualTextureSize.z;
+    float level = VirtualTextureLevel(uv, 0.0);
+    ivec2 page = ivec2(VirtualTextureTexel(uv, level) / pageSize);
+    uvec4 entry = texelFetch(uPageTable, page, int(level));
+
+    // Texel within the resident page; the rounding of odd level sizes stays inside the page border
+    float border = frame.virtualTextureAtlas.y;
+    vec2 texel = VirtualTextureTexel(uv, float(entry.z)) - vec2(page >> (int(entry.z) - int(level))) * pageSize;
+    vec2 atlasTexel = vec2(entry.xy) * frame.virtualTextureAtlas.x + border + clamp(texel, 0.5 - border, pageSize + border - 0.5);
+    return textureLod(uPageAtlas, atlasTexel / frame.virtualTextureAtlas.z, 0.0).rgb;
+}
+#endif
 
-    float highlightSize = 16.0f;
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos);
-    vec3 reflectDir1 = reflect(-lightDirection1, norm);
-    vec3 reflectDir2 = reflect(-lightDirection2, norm);
+const float specularIntensity = 0.1f;
+const float highlightSize = 16.0f;
 
-    float specularComponent1 = pow(max(dot(viewDir, reflectDir1), 0.0), highlightSize);
-    vec3 specular1 = specularIntensity1 * specularComponent1 * lightColor1;
+void main()
+{
+    vec2 uv = vertexTextureCoordinate * draw.uvScale;
 
-    float specularComponent2 = pow(max(dot(viewDir, reflectDir2), 0.0), highlightSize);
-    vec3 specular2 = specularIntensity2 * specularComponent2 * lightColor2;
+#if VIRTUAL_TEXTURE == 2
+    // The page as (x, y, level, 255) / 255, the feedback buffer is cleared to zero where nothing asks for one
+    float level = VirtualTextureLevel(uv, frame.virtualTextureAtlas.w);
+    fragmentColor = vec4(floor(VirtualTextureTexel(uv, level) / frame.virtualTextureSize.z), level, 255.0) / 255.0;
+    return;
+#endif
 
+#if VIRTUAL_TEXTURE == 1
+    vec3 albedo = SampleVirtualTexture(uv);
+#elif TEXTURED
     // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec3 albedo = texture(uTexture, uv).xyz;
+#else
+    vec3 albedo = draw.shapeColor.rgb;
+#endif
 
-    // Calculate phong result for both lights and sum them up
-    vec3 phong = (ambient1 + diffuse1 + specular1 + ambient2 + diffuse2 + specular2) * textureColor.xyz;
+#if LIGHT_COUNT == 0
+    fragmentColor = vec4(albedo, 1.0);
+#else
+    vec3 norm = normalize(vertexNormal);
+#if NORMAL_MAPPED
+    norm = PerturbNormal(norm, uv);
+#endif
+    vec3 viewDir = normalize(frame.viewPosition.xyz - vertexFragmentPos);
 
-    // Send lighting results to GPU
-    //fragmentColor = vec4(phong, 1.0);
-    fragmentColor = vec4(phong * textureColor.xyz, 1.0);
-    //vec4 reflectiveColor = vec4(phong, 1.0) * texture(uTexture, vertexTextureCoordinate);
-    //fragmentColor = reflectiveColor;
-}
-);
+    // Ambient, diffuse and specular lighting of every light, the loop count is a compile-time constant
+    vec3 phong = vec3(0.0);
+    for (int i = 0; i < LIGHT_COUNT; ++i)
+    {
+        vec3 lightColor = frame.lightColors[i].rgb;
+        vec3 lightDirection = normalize(frame.lightPositions[i].xyz - vertexFragmentPos);
+
+        vec3 ambient = frame.lightColors[i].w * lightColor;
+        vec3 diffuse = max(dot(norm, lightDirection), 0.0) * lightColor;
+
+        vec3 reflectDir = reflect(-lightDirection, norm);
+        vec3 specular = specularIntensity * pow(max(dot(viewDir, reflectDir), 0.0), highlightSize) * lightColor;
 
-/* Lamp Shader Source Code*/
-const GLchar* lampVertexShaderSource = GLSL(440,
+        phong += ambient + diffuse + specular;
+    }
 
-    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+    // The phong result is modulated by the albedo twice, as the original two light shader did
+    fragmentColor = vec4(phong * albedo * albedo, 1.0);
+#endif
+}
+)glsl";
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+/* Vertex Shader for the clustered forward+ object pass */
+const GLchar* clusteredVertexShaderSource = R"glsl(#version 440 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 textureCoordinate;
 
-// Uniform color for each shape
-uniform vec4 shapeColor;
+out vec3 vertexNormal;
+out vec3 vertexFragmentPos;
+out vec2 vertexTextureCoordinate;
+out float vertexViewDepth; // Positive distance along the view direction, selects the depth slice
 
-out vec4 vertexColor; // Variable to transfer color data to the fragment shader
+#include "frame_data.glsl"
+#include "draw_data.glsl"
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
-    vertexColor = shapeColor; // Use the uniform color
+    vec4 worldPosition = draw.model * vec4(position, 1.0f);
+    gl_Position = draw.modelViewProjection * vec4(position, 1.0f);
+
+    vertexFragmentPos = vec3(worldPosition);
+    vertexNormal = draw.normalMatrix * normal;
+    vertexTextureCoordinate = textureCoordinate;
+    vertexViewDepth = dot(frame.viewDepthPlane, worldPosition);
 }
-);
+)glsl";
+
+
+/* Fragment Shader for the clustered forward+ object pass: only shades with the lights of its own cluster */
+const GLchar* clusteredFragmentShaderSource = R"glsl(#version 440 core
+struct PointLight {
+    vec4 position;  // w = constant
+    vec4 ambient;   // w = linear
+    vec4 diffuse;   // w = quadratic
+    vec4 specular;  // w = range
+};
+
+struct SpotLight {
+    vec4 position;  // w = constant
+    vec4 direction; // w = cutOff
+    vec4 ambient;   // w = outerCutOff
+    vec4 diffuse;   // w = linear
+    vec4 specular;  // w = quadratic
+};
+
+layout(std430, binding = 2) readonly buffer PointLightBuffer { PointLight pointLights[]; };
+layout(std430, binding = 3) readonly buffer SpotLightBuffer { SpotLight spotLights[]; };
+layout(std430, binding = 4) readonly buffer ClusterGridBuffer { uvec4 clusterGrid[]; }; // offset, point count, spot count
+layout(std430, binding = 5) readonly buffer LightIndexBuffer { uint lightIndices[]; };
+
+in vec3 vertexNormal;
+in vec3 vertexFragmentPos;
+in vec2 vertexTextureCoordinate;
+in float vertexViewDepth;
+
+out vec4 fragmentColor;
 
-/* Fragment Shader Source Code*/
-const GLchar* lampFragmentShaderSource = GLSL(440,
-    in vec4 vertexColor; // Variable to hold incoming color data from vertex shader
+#include "frame_data.glsl"
+#include "draw_data.glsl"
 
-out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
+layout(binding = 0) uniform sampler2D uTexture;
 
-void main()
+const float specularIntensity = 0.1f;
+const float highlightSize = 16.0f;
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 viewDir, vec3 albedo)
 {
-    fragmentColor = vertexColor; // Use the incoming color directly
+    vec3 toLight = light.position.xyz - vertexFragmentPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), highlightSize);
+    float attenuation = 1.0 / (light.position.w + light.ambient.w * distance + light.diffuse.w * (distance * distance));
+
+    vec3 ambient = light.ambient.rgb * albedo;
+    vec3 diffuse = light.diffuse.rgb * diff * albedo;
+    vec3 specular = light.specular.rgb * spec * specularIntensity;
+    return (ambient + diffuse + specular) * attenuation;
 }
-);
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 viewDir, vec3 albedo)
 {
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
+    vec3 toLight = light.position.xyz - vertexFragmentPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+
+    float diff = max(dot(normal, lightDir), 0.0);
+    float spec = pow(max(dot(viewDir, reflect(-lightDir, normal)), 0.0), highlightSize);
+    float attenuation = 1.0 / (light.position.w + light.diffuse.w * distance + light.specular.w * (distance * distance));
+
+    float theta = dot(lightDir, normalize(-light.direction.xyz));
+    float epsilon = light.direction.w - light.ambient.w;
+    float intensity = clamp((theta - light.ambient.w) / epsilon, 0.0, 1.0);
+
+    vec3 ambient = light.ambient.rgb * albedo;
+    vec3 diffuse = light.diffuse.rgb * diff * albedo;
+    vec3 specular = light.specular.rgb * spec * specularIntensity;
+    return (ambient + (diffuse + specular) * intensity) * attenuation;
+}
 
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
+void main()
+{
+    vec3 norm = normalize(vertexNormal);
+    vec3 viewDir = normalize(frame.viewPosition.xyz - vertexFragmentPos);
+    vec3 albedo = texture(uTexture, vertexTextureCoordinate * draw.uvScale).xyz;
+
+    // Locate this fragment's cluster from its screen tile and view depth (slice = log(depth) * scale - bias)
+    uvec3 dimensions = frame.clusterDimensions.xyz;
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / frame.clusterParameters.xy), dimensions.xy - uvec2(1));
+    uint slice = uint(clamp(log(vertexViewDepth) * frame.clusterParameters.z - frame.clusterParameters.w, 0.0, float(dimensions.z - 1u)));
+    uvec4 cluster = clusterGrid[tile.x + dimensions.x * (tile.y + dimensions.y * slice)];
+
+    vec3 result = vec3(0.0);
+    uint index = cluster.x;
+    for (uint i = 0u; i < cluster.y; ++i)
+        result += CalcPointLight(pointLights[lightIndices[index++]], norm, viewDir, albedo);
+    for (uint i = 0u; i < cluster.z; ++i)
+        result += CalcSpotLight(spotLights[lightIndices[index++]], norm, viewDir, albedo);
+
+    fragmentColor = vec4(result, 1.0);
 }
+)glsl";
 
+namespace
+{
+    // Object shader specialized by light count, texturing and normal mapping, compiled on first use
+    ProgramVariants gObjectShaders(gPrograms, "OBJECT", vertexShaderSource, fragmentShaderSource);
+    const char* const LAMP_SHADER_VARIANT = "LIGHT_COUNT=0 TEXTURED=0 NORMAL_MAPPED=0";
+    const char* const VIRTUAL_TEXTURE_FEEDBACK_VARIANT = "LIGHT_COUNT=0 TEXTURED=0 NORMAL_MAPPED=0 VIRTUAL_TEXTURE=2";
+}
 
 int main(int argc, char* argv[])
 {
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
-
-    // Create the mesh
-    UCreateMesh(gMesh, "plane");
-    UCreateMesh(gCylinderMesh, "cylinder");
-    UCreateMesh(gSphereMesh, "sphere");
-    UCreateMesh(gCubeMesh, "cube");
-    UCreateMesh(gPrismMesh, "prism");
-    UCreateMesh(gTorusMesh, "torus");
-    UCreateMesh(gCupMesh, "cup");
-
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gKeyLightProgramId))
-        return EXIT_FAILURE;
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gFillLightProgramId))
-        return EXIT_FAILURE;
+    gStartupTime = std::chrono::steady_clock::now();
 
-    // Load textures for each shape
-    const char* cylinderTextureFile = "../../resources/textures/wood-texture.png";
-    const char* sphereTextureFile = "../../resources/textures/snow-texture.png";
-    const char* planeTextureFile = "../../resources/textures/desk-texture.png";
-    const char* cylinder2TextureFile = "../../resources/textures/speaker-texture.png";
-    const char* torusTextureFile = "../../resources/textures/silver-texture.png";
-    const char* cubeTextureFile = "../../resources/textures/rubik-texture.png";
-    const char* prismTextureFile = "../../resources/textures/laptop-texture.png";
-    const char* cupTextureFile = "../../resources/textures/cup-texture.png";
-
-    if (!UCreateTexture(cylinderTextureFile, gCylinderTextureId))
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "Failed to load texture " << cylinderTextureFile << endl;
-        return EXIT_FAILURE;
+        if (strcmp(argv[i], "--mesh-detail") == 0 && i + 1 < argc)
+            gMeshDetail = max(3, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--headless") == 0)
+            gHeadless = true;
+        else if (strcmp(argv[i], "--clustered") == 0)
+            gUseClusteredLighting = true;
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &gViewportWidth, &gViewportHeight) != 2 || gViewportWidth <= 0 || gViewportHeight <= 0)
+            {
+                cout << "Invalid --size, expected WIDTHxHEIGHT" << endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            gHeadlessFrames = max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            gTraceFile = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            if (!gInputRecorder.StartRecording(argv[++i]))
+                return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            if (!gInputRecorder.StartReplay(argv[++i]))
+                return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[i], "--gl-capture") == 0 && i + 1 < argc)
+        {
+            if (!GLTRACE_ENABLED)
+                cout << "WARNING: --gl-capture ignored, this build has no ENABLE_GL_TRACE" << endl;
+            else if (!gltrace::StartCapture(argv[++i]))
+                return EXIT_FAILURE;
+
+            // Programs have to be built from source in a capture: glProgramBinary is not traced, and a driver
+            // specific blob could not be replayed elsewhere anyway
+            gUseProgramBinaryCache = false;
+        }
+        else if (strcmp(argv[i], "--gl-replay") == 0 && i + 1 < argc)
+            gGLReplayFile = argv[++i];
+        else if (strcmp(argv[i], "--no-program-cache") == 0)
+            gUseProgramBinaryCache = false;
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+            gTextureResidency.SetBudget(static_cast<size_t>(max(1, atoi(argv[++i]))) * 1024 * 1024);
+        else if (strcmp(argv[i], "--bench-image-kernels") == 0 && i + 1 < argc)
+            return imagekernels::RunBench(argv[++i], cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+        else if (strcmp(argv[i], "--bench-image-decode") == 0 && i + 1 < argc)
+            return lzimage::RunBench(argv[++i], cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+        else if (strcmp(argv[i], "--cook-textures") == 0 && i + 1 < argc)
+            return UCookTextures(argv[++i]) ? EXIT_SUCCESS : EXIT_FAILURE;
+        else if (strcmp(argv[i], "--cook-virtual-texture") == 0 && i + 1 < argc)
+            return UCookVirtualTexture(argv[++i]) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    if (!UCreateTexture(sphereTextureFile, gSphereTextureId))
-    {
-        cout << "Failed to load texture " << sphereTextureFile << endl;
-        return EXIT_FAILURE;
-    }
+    if (gTraceFile && !PROFILER_ENABLED)
+        cout << "WARNING: --trace ignored, this build has no ENABLE_PROFILER" << endl;
 
-    if (!UCreateTexture(planeTextureFile, gPlaneTextureId))
+    if (gHeadless)
     {
-        cout << "Failed to load texture " << planeTextureFile << endl;
-        return EXIT_FAILURE;
+        if (!UInitializeHeadless(gViewportWidth, gViewportHeight))
+            return EXIT_FAILURE;
     }
-
-    if (!UCreateTexture(cylinder2TextureFile, gCylinderTextureId2))
-    {
-        cout << "Failed to load texture " << cylinder2TextureFile << endl;
+    else if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
-    }
 
-    if (!UCreateTexture(torusTextureFile, gTorusTextureId))
-    {
-        cout << "Failed to load texture " << torusTextureFile << endl;
+    // A GL capture recreates the whole scene itself, only the context is needed
+    if (gGLReplayFile)
+        return URunGLReplay(gGLReplayFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Submit the shader programs first so the driver compiles them while the meshes and textures are
+    // created; the key and fill lamps share one program. Programs linked by an earlier run with the same
+    // sources and driver are loaded from the binary cache instead of compiled.
+    const std::chrono::steady_clock::time_point programsStart = std::chrono::steady_clock::now();
+    if (gUseProgramBinaryCache && gProgramBinaryCache.Open(PROGRAM_BINARY_CACHE_DIRECTORY))
+        gPrograms.SetBinaryCache(&gProgramBinaryCache);
+    gPrograms.Preprocessor().AddInclude("frame_data.glsl", frameDataInclude);
+    gPrograms.Preprocessor().AddInclude("draw_data.glsl", drawDataInclude);
+    gObjectShaders.Prepare(UObjectShaderVariant(gForwardLightCount, true, false));
+    gObjectShaders.Prepare(LAMP_SHADER_VARIANT);
+    gPrograms.Request("CLUSTERED", clusteredVertexShaderSource, clusteredFragmentShaderSource, gClusteredProgramId);
+
+    // Meshes and textures are created by the loader thread while the programs compile and the first frames
+    // render; until then the shapes are skipped or drawn with the placeholder texture
+    UCreatePlaceholderTexture();
+    UStartResourceLoader();
+    ULoadMesh(gMesh, "plane");
+    ULoadMesh(gCylinderMesh, "cylinder");
+    ULoadMesh(gSphereMesh, "sphere");
+    ULoadMesh(gCubeMesh, "cube");
+    ULoadMesh(gPrismMesh, "prism");
+    ULoadMesh(gTorusMesh, "torus");
+    ULoadMesh(gCupMesh, "cup");
+    ULoadTextures();
+    gPrograms.Poll();
+
+    // The uTexture samplers are bound to texture unit 0 by their layout qualifier, the materials bind a
+    // shared sampler object there
+    UCreateSamplers();
+    gPrograms.Poll();
+
+    // The desk's virtual texture, when its page file has been cooked
+    UOpenVirtualTexture();
+
+    // Persistently mapped ring for the per-frame and per-draw shader data
+    if (!gUniformRing.Create(UNIFORM_RING_REGION_SIZE))
         return EXIT_FAILURE;
-    }
 
-    if (!UCreateTexture(cubeTextureFile, gCubeTextureId))
-    {
-        cout << "Failed to load texture " << cubeTextureFile << endl;
-        return EXIT_FAILURE;
-    }
+    // Timestamp queries for the per-pass GPU timings
+    gGpuTimers.Create();
 
-    if (!UCreateTexture(prismTextureFile, gPrismTextureId))
-    {
-        cout << "Failed to load texture " << prismTextureFile << endl;
-        return EXIT_FAILURE;
-    }
+    // Lights for the clustered forward+ mode
+    UCreateClusterLights();
 
-    if (!UCreateTexture(cupTextureFile, gCupTextureId))
-    {
-        cout << "Failed to load texture " << cupTextureFile << endl;
+    // Wait for the programs still compiling, all compile and link errors are reported together
+    const std::chrono::steady_clock::time_point programsWait = std::chrono::steady_clock::now();
+    if (!gPrograms.Finish())
         return EXIT_FAILURE;
-    }
+    const std::chrono::steady_clock::time_point programsEnd = std::chrono::steady_clock::now();
+    cout << "INFO: Shader programs ready " << std::chrono::duration<double, std::milli>(programsEnd - programsStart).count()
+        << " ms after submission, startup waited " << std::chrono::duration<double, std::milli>(programsEnd - programsWait).count()
+        << " ms for them" << endl;
+    gPrograms.Print(cout);
+    UResolveObjectPrograms();
 
-    // Tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gProgramId);
-    // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    // The benchmark measures the complete scene, not the frames that show it loading
+    if (gHeadless)
+        gResourceLoader.Finish();
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    // Resource creation bound whatever it needed, the render loop starts from unknown state
+    gStateCache.Invalidate();
+
     // Render loop
     // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    if (gHeadless)
+        URunHeadless(gInputRecorder.IsReplaying() ? int(gInputRecorder.FrameCount()) - HEADLESS_WARMUP_FRAMES : gHeadlessFrames);
+
+    bool firstFrame = true;
+    while (!gHeadless && !glfwWindowShouldClose(gWindow))
     {
+        PROFILE_ZONE("Frame");
+
         // per-frame timing
         // --------------------
         float currentFrame = glfwGetTime();
         gDeltaTime = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
+        // A replay overrides the time step and input with the recorded frame
+        if (!UBeginInputFrame())
+            break;
+
         // input
         // -----
         UProcessInput(gWindow);
 
         // Render this frame
+        double renderStart = glfwGetTime();
         URender();
+        UUpdateTimingTitle(glfwGetTime() - renderStart);
+        gltrace::EndFrame();
 
+        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
         glfwPollEvents();
+
+        if (firstFrame)
+        {
+            cout << "INFO: First frame presented " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gStartupTime).count()
+                << " ms after startup, " << gResourceLoader.Poll() << " resources still loading" << endl;
+            firstFrame = false;
+        }
+
+        UEndInputFrame();
     }
 
+    gInputRecorder.Finish();
+
+    // Jobs still queued are dropped, the loader context is released before the resources are destroyed
+    gResourceLoader.Stop();
+    if (gLoaderWindow)
+        glfwDestroyWindow(gLoaderWindow);
+
     // Release mesh data
     UDestroyMesh(gMesh);
     UDestroyMesh(gCylinderMesh);
@@ -393,19 +905,42 @@ int main(int argc, char* argv[])
     UDestroyMesh(gTorusMesh);
     UDestroyMesh(gCupMesh);
 
-    // Release textures
-    UDestroyTexture(gCylinderTextureId);
-    UDestroyTexture(gSphereTextureId);
-    UDestroyTexture(gPlaneTextureId);
-    UDestroyTexture(gCylinderTextureId2);
-    UDestroyTexture(gTorusTextureId);
-    UDestroyTexture(gPrismTextureId);
-    UDestroyTexture(gCupTextureId);
+    // Release textures and samplers; materials whose texture did not load still show the placeholder
+    if (!gHeadless)
+        gTextureResidency.Print(cout);
+    gTextureResidency.Clear();
+    if (gDeskVirtualTexture.IsOpen() && !gHeadless)
+        gDeskVirtualTexture.Print(cout);
+    gDeskVirtualTexture.Destroy();
+    UDestroyTexture(gPlaceholderTextureId);
+    glDeleteSamplers(SAMPLER_PRESET_COUNT, gSamplers);
+
+    gUniformRing.Destroy();
+
+    if (!gHeadless)
+    {
+        gGpuTimers.Print(cout);
+        gStateCache.Print(cout);
+    }
+    gGpuTimers.Destroy();
 
     // Release shader program
-    UDestroyShaderProgram(gProgramId);
-    UDestroyShaderProgram(gKeyLightProgramId);
-    UDestroyShaderProgram(gFillLightProgramId);
+    gObjectShaders.Release();
+    gPrograms.Release(gClusteredProgramId);
+
+    // Per-call GL statistics (ENABLE_GL_TRACE), the capture ends here
+    gltrace::Finish(cout);
+
+    if (gHeadless)
+        gHeadlessContext.Destroy();
+
+    if (gTraceFile && PROFILER_ENABLED)
+    {
+        if (profiler::WriteChromeTrace(gTraceFile))
+            cout << "INFO: Trace written to " << gTraceFile << endl;
+        else
+            cout << "Failed to write trace " << gTraceFile << endl;
+    }
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -420,6 +955,8 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_SAMPLES, 4); // MSAA stays available with forward+ shading
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -427,13 +964,20 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 
     // GLFW: window creation
     // ---------------------
-    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    * window = glfwCreateWindow(gViewportWidth, gViewportHeight, WINDOW_TITLE, NULL, NULL);
     if (*window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
         return false;
     }
+
+    // Shares objects with the main window, the resource loader thread makes its context current. Without it
+    // everything is loaded on the render thread.
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_SAMPLES, 0);
+    gLoaderWindow = glfwCreateWindow(1, 1, "loader", NULL, *window);
+
     glfwMakeContextCurrent(*window);
     glfwSetFramebufferSizeCallback(*window, UResizeWindow);
     glfwSetCursorPosCallback(*window, UMousePositionCallback);
@@ -458,48 +1002,211 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     // Displays GPU OpenGL version
     cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
+    glEnable(GL_MULTISAMPLE);
+
     return true;
 }
 
 
+// Create an offscreen GL context and framebuffer instead of a window
+bool UInitializeHeadless(int width, int height)
+{
+    if (!gHeadlessContext.Create(width, height))
+        return false;
+
+    // Displays GPU OpenGL version
+    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    cout << "INFO: OpenGL Renderer: " << glGetString(GL_RENDERER) << endl;
+
+    return true;
+}
+
+
+// Renders frameCount frames with a fixed timestep into the offscreen framebuffer and prints the frame time statistics.
+// frameCount is negative for a replay shorter than the warm-up, which then only plays the recorded frames.
+void URunHeadless(int frameCount)
+{
+    std::vector<double> frameTimes;
+    frameTimes.reserve(std::max(frameCount, 0));
+
+    for (int frame = 0; frame < HEADLESS_WARMUP_FRAMES + frameCount; ++frame)
+    {
+        PROFILE_ZONE("Frame");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // Without a recording the camera stays put and time advances at a fixed step
+        gDeltaTime = HEADLESS_TIMESTEP;
+        if (!UBeginInputFrame())
+            break;
+        if (gInputRecorder.IsReplaying())
+            UProcessInput(nullptr);
+
+        URender();
+        UEndInputFrame();
+        gltrace::EndFrame();
+
+        // Wait for the GPU so the measurement covers the whole frame, there is no swap to throttle us
+        glFinish();
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        if (frame >= HEADLESS_WARMUP_FRAMES)
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+
+    if (frameTimes.empty())
+    {
+        cout << "HEADLESS: no frames measured (the recording is shorter than the warm-up)" << endl;
+        return;
+    }
+
+    cout << "HEADLESS: " << gHeadlessContext.Width() << "x" << gHeadlessContext.Height() << ", "
+        << frameTimes.size() << " frames (" << HEADLESS_WARMUP_FRAMES << " warm-up frames skipped)"
+        << (gUseClusteredLighting ? ", clustered lighting" : "") << endl;
+    UPrintFrameTimes("HEADLESS", frameTimes);
+    gGpuTimers.Print(cout);
+    gStateCache.Print(cout);
+    gTextureResidency.Print(cout);
+    if (gDeskVirtualTexture.IsOpen())
+        gDeskVirtualTexture.Print(cout);
+}
+
+
+// Re-executes a GL capture frame by frame in the current context and prints the frame times
+bool URunGLReplay(const char* path)
+{
+    gltrace::Replayer replayer;
+    if (!replayer.Open(path))
+        return false;
+
+    std::vector<double> frameTimes;
+    size_t slowestFrame = 0;
+    while (gHeadless || !glfwWindowShouldClose(gWindow))
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool frameComplete = replayer.ReplayFrame();
+        glFinish();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        if (!frameComplete)
+            break;
+
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        if (frameTimes.back() > frameTimes[slowestFrame])
+            slowestFrame = frameTimes.size() - 1;
+
+        if (!gHeadless)
+        {
+            glfwSwapBuffers(gWindow);
+            glfwPollEvents();
+        }
+    }
+
+    cout << "GL REPLAY: " << path << ", " << frameTimes.size() << " frames, " << replayer.Calls() << " calls, slowest frame "
+        << slowestFrame << endl;
+
+    // The first frame also creates every mesh, texture and shader
+    if (frameTimes.size() > 1)
+        UPrintFrameTimes("GL REPLAY", std::vector<double>(frameTimes.begin() + 1, frameTimes.end()));
+    return true;
+}
+
+
+// Prints average, min, median, p95 and max of a list of frame times in milliseconds
+void UPrintFrameTimes(const char* label, std::vector<double> frameTimes)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < frameTimes.size(); ++i)
+        total += frameTimes[i];
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    const double average = total / frameTimes.size();
+    cout << label << ": frame ms avg " << average
+        << " min " << frameTimes.front()
+        << " median " << frameTimes[frameTimes.size() / 2]
+        << " p95 " << frameTimes[frameTimes.size() * 95 / 100]
+        << " max " << frameTimes.back() << endl;
+    cout << label << ": " << 1000.0 / average << " fps, " << total / 1000.0 << " s total" << endl;
+}
+
+
+// Shows the average CPU time of URender, the GPU frame time and the skipped GL calls in the window title, to tell CPU from GPU bound frames
+void UUpdateTimingTitle(double renderSeconds)
+{
+    gTimingTitleCpuSeconds += renderSeconds;
+    gTimingTitleSkippedCalls += gStateCache.LastFrameSkipped();
+    ++gTimingTitleFrames;
+
+    double now = glfwGetTime();
+    if (now - gTimingTitleLastUpdate < TIMING_TITLE_INTERVAL)
+        return;
+
+    char title[160];
+    snprintf(title, sizeof(title), "%s - CPU %.2f ms / GPU %.2f ms / %u GL calls skipped", WINDOW_TITLE,
+        gTimingTitleCpuSeconds * 1000.0 / gTimingTitleFrames, gGpuTimers.FrameMilliseconds(),
+        gTimingTitleSkippedCalls / gTimingTitleFrames);
+    glfwSetWindowTitle(gWindow, title);
+
+    gTimingTitleCpuSeconds = 0.0;
+    gTimingTitleSkippedCalls = 0;
+    gTimingTitleFrames = 0;
+    gTimingTitleLastUpdate = now;
+}
+
+
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
+    PROFILE_ZONE("UProcessInput");
+
     static const float cameraSpeed = 2.5f;
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_ESCAPE) && window)
         glfwSetWindowShouldClose(window, true);
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_W))
         gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_S))
         gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_A))
         gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_D))
         gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_Q))
         gCamera.Position += glm::vec3(0.0f, cameraSpeed * gDeltaTime, 0.0f);  // Move upward
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+    if (UIsKeyPressed(window, GLFW_KEY_E))
         gCamera.Position -= glm::vec3(0.0f, cameraSpeed * gDeltaTime, 0.0f);  // Move downward
 
     // Pause and resume lamp orbiting
     static bool isLKeyDown = false;
-    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !gIsLampOrbiting)
+    if (UIsKeyPressed(window, GLFW_KEY_L) && !gIsLampOrbiting)
         gIsLampOrbiting = true;
-    else if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && gIsLampOrbiting)
+    else if (UIsKeyPressed(window, GLFW_KEY_K) && gIsLampOrbiting)
         gIsLampOrbiting = false;
 
     // Switch between perspective and orthographic projections when "P" or "O" is pressed
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && !isPerspective)
+    if (UIsKeyPressed(window, GLFW_KEY_P) && !isPerspective)
     {
         isPerspective = true;
     }
-    else if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && isPerspective)
+    else if (UIsKeyPressed(window, GLFW_KEY_O) && isPerspective)
     {
         isPerspective = false;
     }
 
+    // Switch between the classic two-light shading and clustered forward+ shading with "C" or "X"
+    if (UIsKeyPressed(window, GLFW_KEY_C) && !gUseClusteredLighting)
+        gUseClusteredLighting = true;
+    else if (UIsKeyPressed(window, GLFW_KEY_X) && gUseClusteredLighting)
+        gUseClusteredLighting = false;
+
+    // Shade the objects with the key light only ("1") or with the key and fill lights ("2")
+    const int forwardLightCount = gForwardLightCount;
+    if (UIsKeyPressed(window, GLFW_KEY_1))
+        gForwardLightCount = 1;
+    else if (UIsKeyPressed(window, GLFW_KEY_2))
+        gForwardLightCount = 2;
+    if (gForwardLightCount != forwardLightCount)
+        UResolveObjectPrograms();
+
 
 }
 
@@ -507,6 +1214,8 @@ void UProcessInput(GLFWwindow* window)
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
+    gViewportWidth = width;
+    gViewportHeight = height;
     glViewport(0, 0, width, height);
 }
 
@@ -514,6 +1223,18 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+    // Live mouse input is ignored while a recording is replayed
+    if (gInputRecorder.IsReplaying())
+        return;
+
+    gInputRecorder.RecordEvent(InputEvent::CURSOR, xpos, ypos);
+    UMoveCamera(xpos, ypos);
+}
+
+
+// Turns the camera by the cursor movement since the last position
+void UMoveCamera(double xpos, double ypos)
 {
     if (gFirstMouse)
     {
@@ -535,10 +1256,75 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    if (gInputRecorder.IsReplaying())
+        return;
+
+    gInputRecorder.RecordEvent(InputEvent::SCROLL, 0.0, yoffset);
+    UZoomCamera(yoffset);
+}
+
+
+// Zooms the camera by the scroll offset
+void UZoomCamera(double yoffset)
 {
     gCamera.ProcessMouseScroll(yoffset);
 }
 
+
+// Key query used by UProcessInput: live keys (remembered for a recording) or the keys of the replayed frame
+bool UIsKeyPressed(GLFWwindow* window, int key)
+{
+    uint32_t bit = 0;
+    for (size_t i = 0; i < sizeof(RECORDED_KEYS) / sizeof(RECORDED_KEYS[0]); ++i)
+    {
+        if (RECORDED_KEYS[i] == key)
+            bit = 1u << i;
+    }
+
+    if (gInputRecorder.IsReplaying())
+        return (gInputRecorder.Frame().keys & bit) != 0;
+
+    bool pressed = window && glfwGetKey(window, key) == GLFW_PRESS;
+    if (pressed)
+        gFrameKeys |= bit;
+    return pressed;
+}
+
+
+// Starts a frame of input; a replay takes the recorded time step and returns false when the recording ends
+bool UBeginInputFrame()
+{
+    gFrameKeys = 0;
+    if (!gInputRecorder.IsReplaying())
+        return true;
+
+    if (!gInputRecorder.NextFrame())
+        return false;
+    gDeltaTime = gInputRecorder.Frame().deltaTime;
+    return true;
+}
+
+
+// Ends a frame of input: writes it to the recording, or applies the recorded mouse events in place of the live ones
+void UEndInputFrame()
+{
+    if (gInputRecorder.IsRecording())
+        gInputRecorder.RecordFrame(gDeltaTime, gFrameKeys);
+
+    if (gInputRecorder.IsReplaying())
+    {
+        const std::vector<InputEvent>& events = gInputRecorder.Frame().events;
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            if (events[i].type == InputEvent::CURSOR)
+                UMoveCamera(events[i].x, events[i].y);
+            else if (events[i].type == InputEvent::SCROLL)
+                UZoomCamera(events[i].y);
+        }
+    }
+}
+
 // glfw: handle mouse button events
 // --------------------------------
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
@@ -582,6 +1368,20 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 // Functioned called to render a frame
 void URender()
 {
+    PROFILE_ZONE("URender");
+    PROFILE_SECTIONS();
+    PROFILE_SECTION("Frame setup");
+
+    // Publish the meshes and textures the loader has finished since the last frame, stream in the mip levels
+    // the last frame's draws needed, then bring the textures back under the memory budget
+    gResourceLoader.Poll();
+    const size_t movedTextures = gTextureResidency.Stream();
+    if (movedTextures + gTextureResidency.Enforce() > 0)
+        gStateCache.Invalidate();
+
+    // Load the virtual texture pages an earlier frame's feedback asked for
+    if (gDeskVirtualTexture.IsOpen() && gDeskVirtualTexture.Update(ULoadVirtualTexturePage))
+        gStateCache.Invalidate();
 
     // Animation: Lamp orbits around the origin
     const float angularVelocity = glm::radians(45.0f);
@@ -596,23 +1396,37 @@ void URender()
         gFillLightPosition.x = newPosition2.x;
         gFillLightPosition.y = newPosition2.y;
         gFillLightPosition.z = newPosition2.z;
+
+        gDynamicLightAngle += angularVelocity * gDeltaTime;
     }
 
 
+    // Start writing into the ring region the GPU has finished reading
+    gUniformRing.BeginFrame();
+
+    // Read back the pass timings of an older frame and start this frame's
+    gGpuTimers.BeginFrame();
+    gGpuTimers.Mark("Clear");
+
     // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    gStateCache.Enable(GL_DEPTH_TEST);
+    // Textures are sampled to linear values, the framebuffer encodes the shaded result back to sRGB
+    gStateCache.Enable(GL_FRAMEBUFFER_SRGB);
 
     // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    gStateCache.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.vao);
+    gStateCache.BindVertexArray(gMesh.vao);
 
     // PLANE: Draw plane
     //----------------
+    PROFILE_SECTION("Plane");
+    gGpuTimers.Mark("Objects");
     // Set the shader to be used
-    glUseProgram(gProgramId);
+    const GLuint objectProgramId = gUseClusteredLighting ? gClusteredProgramId : gObjectProgramId;
+    gStateCache.UseProgram(objectProgramId);
 
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = glm::translate(gPlanePosition) * glm::scale(gPlaneScale);
@@ -625,7 +1439,7 @@ void URender()
     if (isPerspective)
     {
         // Creates a perspective projection
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)gViewportWidth / (GLfloat)gViewportHeight, 0.1f, 100.0f);
     }
     else
     {
@@ -633,213 +1447,305 @@ void URender()
         projection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 100.0f);
     }
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Combine the camera matrices once per frame, the per-object matrices are built from it on the CPU
+    const glm::mat4 viewProjection = projection * view;
+
+    // Camera, light and cluster data shared by every draw of the frame
+    FrameUniforms frame;
+    frame.viewPosition = glm::vec4(gCamera.Position, 1.0f);
+    frame.viewDepthPlane = glm::vec4(-view[0][2], -view[1][2], -view[2][2], -view[3][2]);
+    frame.objectColor = glm::vec4(gObjectColor, 1.0f);
+    frame.lightColors[0] = glm::vec4(gKeyLightColor, 0.3f);
+    frame.lightPositions[0] = glm::vec4(gKeyLightPosition, 1.0f);
+    frame.lightColors[1] = glm::vec4(gFillLightColor, 0.1f);
+    frame.lightPositions[1] = glm::vec4(gFillLightPosition, 1.0f);
+    for (int i = 2; i < MAX_FORWARD_LIGHTS; ++i)
+        frame.lightColors[i] = frame.lightPositions[i] = glm::vec4(0.0f);
+    frame.clusterDimensions[0] = ClusteredLighting::CLUSTERS_X;
+    frame.clusterDimensions[1] = ClusteredLighting::CLUSTERS_Y;
+    frame.clusterDimensions[2] = ClusteredLighting::CLUSTERS_Z;
+    frame.clusterDimensions[3] = 0;
+
+    // Assign the lights to clusters for this frame's camera
+    bool frameUniformsBound = true;
+    if (gUseClusteredLighting)
+    {
+        PROFILE_ZONE("Cluster light assignment");
+        UUpdateClusterLights();
+        frameUniformsBound = gClusteredLighting.Update(view, projection, 0.1f, 100.0f, gViewportWidth, gViewportHeight, gUniformRing);
+        if (frameUniformsBound)
+            gClusteredLighting.Bind(gUniformRing);
+    }
+    frame.clusterParameters = gClusteredLighting.LookupParameters();
 
-    // Reference matrix uniforms from the Cube Shader program for the cube color, light1 color, light1 position, light2 color, light2 position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    GLint light1ColorLoc = glGetUniformLocation(gProgramId, "lightColor1");
-    GLint light1PositionLoc = glGetUniformLocation(gProgramId, "lightPos1");
-    GLint light2ColorLoc = glGetUniformLocation(gProgramId, "lightColor2");
-    GLint light2PositionLoc = glGetUniformLocation(gProgramId, "lightPos2");
-    GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+    // The desk's virtual texture layout
+    const bool virtualDesk = gDeskVirtualTexture.IsOpen() && !gUseClusteredLighting;
+    frame.virtualTextureSize = frame.virtualTextureAtlas = glm::vec4(0.0f);
+    if (virtualDesk)
+    {
+        frame.virtualTextureSize = glm::vec4(gDeskVirtualTexture.Width(), gDeskVirtualTexture.Height(), VirtualTexture::PAGE_SIZE,
+            gDeskVirtualTexture.LevelCount());
+        frame.virtualTextureAtlas = glm::vec4(VirtualTexture::SLOT_SIZE, VirtualTexture::PAGE_BORDER, VirtualTexture::ATLAS_SLOTS * VirtualTexture::SLOT_SIZE,
+            VirtualTexture::FeedbackLevelBias());
+    }
 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(light1ColorLoc, gKeyLightColor.r, gKeyLightColor.g, gKeyLightColor.b);
-    glUniform3f(light1PositionLoc, gKeyLightPosition.x, gKeyLightPosition.y, gKeyLightPosition.z);
-    glUniform3f(light2ColorLoc, gFillLightColor.r, gFillLightColor.g, gFillLightColor.b);
-    glUniform3f(light2PositionLoc, gFillLightPosition.x, gFillLightPosition.y, gFillLightPosition.z);
+    frameUniformsBound = frameUniformsBound && UBindRingRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, gUniformRing.PushUniforms(&frame, sizeof(frame)));
 
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    // Without this frame's lights and camera nothing can be shaded, leave the cleared frame
+    if (!frameUniformsBound)
+    {
+        gUniformRing.EndFrame();
+        gGpuTimers.EndFrame();
+        gStateCache.EndFrame();
+        return;
+    }
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    // Write the plane's transforms to the ring and bind them, the plane is skipped when the ring is full
+    const bool planeUniformsBound = UPushDrawUniforms(model, viewProjection, glm::vec4(1.0f), gPlaneMaterial.uvScale);
 
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlaneTextureId);
+    if (planeUniformsBound && virtualDesk)
+    {
+        // Feedback pass: the pages the plane needs, read back and loaded by a later frame's Update
+        gDeskVirtualTexture.BeginFeedback(gViewportWidth, gViewportHeight);
+        gStateCache.ClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        gStateCache.UseProgram(gVirtualDeskFeedbackProgramId);
+        UDrawMesh(gMesh, GL_TRIANGLES);
+        gDeskVirtualTexture.EndFeedback();
+
+        // Shade with the pages resident so far, the page table and atlas carry their own filtering
+        gStateCache.UseProgram(gVirtualDeskProgramId);
+        gStateCache.BindTexture(2, GL_TEXTURE_2D, gDeskVirtualTexture.PageTable());
+        gStateCache.BindSampler(2, 0);
+        gStateCache.BindTexture(3, GL_TEXTURE_2D, gDeskVirtualTexture.Atlas());
+        gStateCache.BindSampler(3, 0);
+    }
+    else if (planeUniformsBound)
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gPlaneMaterial, gMesh, model);
+    }
 
     // Draws the pyramid
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.nVertices);
+    if (planeUniformsBound)
+        UDrawMesh(gMesh, GL_TRIANGLES);
 
 
     // CYLINDER: Draw Cylinder
     //----------------
+    PROFILE_SECTION("Cylinder");
+    gStateCache.UseProgram(objectProgramId);
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gCylinderMesh.vao);
+    gStateCache.BindVertexArray(gCylinderMesh.vao);
 
     // Render the Cylinder
     glm::mat4 cylinderModel = glm::translate(glm::vec3(-1.0f, -5.25f, 2.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(cylinderModel));
-
-    // Bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gCylinderTextureId);
+    if (UPushDrawUniforms(cylinderModel, viewProjection, glm::vec4(1.0f), gCylinderMaterial.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gCylinderMaterial, gCylinderMesh, cylinderModel);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, gCylinderMesh.nVertices);
+        // Draws the triangles
+        UDrawMesh(gCylinderMesh, GL_TRIANGLE_STRIP);
+    }
 
 
     // CYLINDER 2: Draw Second Cylinder
     //----------------
+    PROFILE_SECTION("Cylinder 2");
     // Render the Second Cylinder
     glm::mat4 cylinderModel2 = glm::scale(glm::vec3(1.5f, 1.5f, 1.5f)) * glm::rotate(90.0f, glm::vec3(1.0f, -1.0f, 1.0f)) * glm::translate(glm::vec3(0.0f, 0.0f, 3.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(cylinderModel2));
-
-    // Bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gCylinderTextureId2);
+    if (UPushDrawUniforms(cylinderModel2, viewProjection, glm::vec4(1.0f), gCylinderMaterial2.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gCylinderMaterial2, gCylinderMesh, cylinderModel2);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, gCylinderMesh.nVertices);
+        // Draws the triangles
+        UDrawMesh(gCylinderMesh, GL_TRIANGLE_STRIP);
+    }
 
 
     // SPHERE: Draw Sphere
     //----------------
+    PROFILE_SECTION("Sphere");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gSphereMesh.vao);
+    gStateCache.BindVertexArray(gSphereMesh.vao);
 
     // Render the sphere
     glm::mat4 sphereModel = cylinderModel * glm::translate(glm::vec3(0.0f, 0.75f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(sphereModel));
-
-    // bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gSphereTextureId);
+    if (UPushDrawUniforms(sphereModel, viewProjection, glm::vec4(1.0f), gSphereMaterial.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gSphereMaterial, gSphereMesh, sphereModel);
 
-    // Draws the sphere
-    glDrawArrays(GL_TRIANGLE_FAN, 0, gSphereMesh.nVertices);
+        // Draws the sphere
+        UDrawMesh(gSphereMesh, GL_TRIANGLE_FAN);
+    }
 
 
     // PRISM: Draw Prism
     //----------------
+    PROFILE_SECTION("Prism");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gPrismMesh.vao);
+    gStateCache.BindVertexArray(gPrismMesh.vao);
 
     // Render the prism
     glm::mat4 prismModel = glm::rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)) * glm::translate(glm::vec3(0.75f, 1.0f, 5.0f)) * glm::scale(glm::vec3(2.0f, 2.0f, 1.0f));
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(prismModel));
-
-    // bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gPrismTextureId);
+    if (UPushDrawUniforms(prismModel, viewProjection, glm::vec4(1.0f), gPrismMaterial.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gPrismMaterial, gPrismMesh, prismModel);
 
-    // Draws the prism
-    glDrawArrays(GL_TRIANGLES, 0, gPrismMesh.nVertices);
+        // Draws the prism
+        UDrawMesh(gPrismMesh, GL_TRIANGLES);
+    }
 
 
     // CUBE: Draw Cube
     //----------------
+    PROFILE_SECTION("Cube");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gCubeMesh.vao);
+    gStateCache.BindVertexArray(gCubeMesh.vao);
 
     // Render the cube
     glm::mat4 cubeModel = glm::translate(glm::vec3(0.25f, -4.6f, 0.75f)) * glm::scale(glm::vec3(0.5f, 0.5f, 0.5f)) * glm::rotate(90.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(cubeModel));
-
-    // bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gCubeTextureId);
+    if (UPushDrawUniforms(cubeModel, viewProjection, glm::vec4(1.0f), gCubeMaterial.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gCubeMaterial, gCubeMesh, cubeModel);
 
-    // Draws the cube
-    glDrawArrays(GL_TRIANGLES, 0, gCubeMesh.nVertices);
+        // Draws the cube
+        UDrawMesh(gCubeMesh, GL_TRIANGLES);
+    }
 
     // CUP: Draw Cup 
     //----------------
+    PROFILE_SECTION("Cup");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gCupMesh.vao);
+    gStateCache.BindVertexArray(gCupMesh.vao);
 
     // Render the cup
     glm::mat4 cupModel = glm::translate(glm::vec3(1.5f, -5.0f, -0.5f)) * glm::rotate(90.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(cupModel));
-
-    // bind textures on corresponding texture units
-    glBindTexture(GL_TEXTURE_2D, gCupTextureId);
+    if (UPushDrawUniforms(cupModel, viewProjection, glm::vec4(1.0f), gCupMaterial.uvScale))
+    {
+        // Bind the material's texture and sampler on texture unit 0, requesting the mip level the draw needs
+        UBindMaterial(gCupMaterial, gCupMesh, cupModel);
 
-    // Draws the cup
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, gCupMesh.nVertices);
+        // Draws the cup
+        UDrawMesh(gCupMesh, GL_TRIANGLE_STRIP);
+    }
 
 
     // KEY LIGHT: Draw Cube 1
     //----------------
+    PROFILE_SECTION("Key light");
+    gGpuTimers.Mark("Light markers");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gCubeMesh.vao);
+    gStateCache.BindVertexArray(gCubeMesh.vao);
 
-    // Set the shader to be used
-    glUseProgram(gKeyLightProgramId);
+    // Set the shader to be used: unlit and untextured, colored by the draw's shape color
+    gStateCache.UseProgram(gLampProgramId);
 
     //Transform the smaller cube used as a visual que for the light source
     model = glm::translate(gKeyLightPosition) * glm::scale(gLightScale);
 
-    // Reference matrix uniforms from the Light Shader program
-    modelLoc = glGetUniformLocation(gKeyLightProgramId, "model");
-    viewLoc = glGetUniformLocation(gKeyLightProgramId, "view");
-    projLoc = glGetUniformLocation(gKeyLightProgramId, "projection");
-    GLint shapeColorLoc1 = glGetUniformLocation(gKeyLightProgramId, "shapeColor"); // Declare shapeColorLoc
-
-
-    // Pass matrix data to the Light Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Set color for the cube
-    glUniform4f(shapeColorLoc1, 1.0f, 0.5f, 0.0f, 1.0f);
-
-    // Draws the cube
-    glDrawArrays(GL_TRIANGLES, 0, gCubeMesh.nVertices);
+    // Pass matrix data and the color for the cube to the Light Shader program
+    if (UPushDrawUniforms(model, viewProjection, glm::vec4(1.0f, 0.5f, 0.0f, 1.0f)))
+    {
+        // Draws the cube
+        UDrawMesh(gCubeMesh, GL_TRIANGLES);
+    }
 
 
     // FILL LIGHT: Draw Cube 2
     //----------------
+    PROFILE_SECTION("Fill light");
     // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gCubeMesh.vao);
+    gStateCache.BindVertexArray(gCubeMesh.vao);
 
     // Set the shader to be used
-    glUseProgram(gFillLightProgramId);
+    gStateCache.UseProgram(gLampProgramId);
 
     //Transform the smaller cube used as a visual que for the light source
     model = glm::translate(gFillLightPosition) * glm::scale(gLightScale);
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(gFillLightProgramId, "model");
-    viewLoc = glGetUniformLocation(gFillLightProgramId, "view");
-    projLoc = glGetUniformLocation(gFillLightProgramId, "projection");
-    GLint shapeColorLoc2 = glGetUniformLocation(gFillLightProgramId, "shapeColor"); // Declare shapeColorLoc
+    // Pass matrix data and the color for the cube to the Lamp Shader program
+    if (UPushDrawUniforms(model, viewProjection, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)))
+    {
+        // Draws the cube
+        UDrawMesh(gCubeMesh, GL_TRIANGLES);
+    }
+
+    // The VAO and program stay bound, the next frame starts with the same ones
+    // Fence this frame's ring region so it is not overwritten while the GPU still reads it
+    gUniformRing.EndFrame();
+    gGpuTimers.EndFrame();
+    gStateCache.EndFrame();
+}
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // Set color for the cube
-    glUniform4f(shapeColorLoc2, 1.0f, 1.0f, 1.0f, 1.0f);
+// Computes the per-object matrices once on the CPU, copies them into the ring buffer and binds the range;
+// false when the ring region is full and the draw has to be skipped
+bool UPushDrawUniforms(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec4& shapeColor, const glm::vec2& uvScale)
+{
+    const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
 
-    // Draws the cube
-    glDrawArrays(GL_TRIANGLES, 0, gCubeMesh.nVertices);
+    DrawUniforms draw;
+    draw.model = model;
+    draw.modelViewProjection = viewProjection * model;
+    for (int column = 0; column < 3; ++column)
+        draw.normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+    draw.shapeColor = shapeColor;
+    draw.uvScale = glm::vec4(uvScale.x, uvScale.y, 0.0f, 0.0f);
 
-    // Deactivate the Vertex Array Object and shader program
-    glBindVertexArray(0);
-    glUseProgram(0);
+    return UBindRingRange(GL_UNIFORM_BUFFER, DRAW_UNIFORM_BINDING, gUniformRing.PushUniforms(&draw, sizeof(draw)));
+}
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 
+// Looks up the object shader variants for the current forward light count (compiling one that was not
+// prepared) and keeps their ids for the render loop
+void UResolveObjectPrograms()
+{
+    gObjectProgramId = gObjectShaders.Get(UObjectShaderVariant(gForwardLightCount, true, false));
+    gLampProgramId = gObjectShaders.Get(LAMP_SHADER_VARIANT);
+    if (gDeskVirtualTexture.IsOpen())
+    {
+        gVirtualDeskFeedbackProgramId = gObjectShaders.Get(VIRTUAL_TEXTURE_FEEDBACK_VARIANT);
+        gVirtualDeskProgramId = gObjectShaders.Get(UObjectShaderVariant(gForwardLightCount, false, false) + " VIRTUAL_TEXTURE=1");
+    }
+}
+
+
+// Name of an object shader variant, see the defines at the top of fragmentShaderSource
+std::string UObjectShaderVariant(int lightCount, bool textured, bool normalMapped)
+{
+    char variant[64];
+    snprintf(variant, sizeof(variant), "LIGHT_COUNT=%d TEXTURED=%d NORMAL_MAPPED=%d", lightCount, textured ? 1 : 0, normalMapped ? 1 : 0);
+    return variant;
+}
+
+
+// Binds a range of the uniform ring through the state cache, false for an allocation the ring could not fit
+bool UBindRingRange(GLenum target, GLuint index, const PersistentRingBuffer::Allocation& allocation)
+{
+    if (!allocation.Valid())
+        return false;
+    gStateCache.BindBufferRange(target, index, gUniformRing.Buffer(), allocation.offset, allocation.size);
+    return true;
 }
 
 
 // Implements the UCreateMesh function
 void UCreateMesh(GLMesh& mesh, const char* type)
 {
+    PROFILE_ZONE("UCreateMesh");
+
     // For the cylinder
     if (type == "cylinder")
     {
         const float PI = 3.14159265359f;
-        int sectorCount = 30;
+        int sectorCount = gMeshDetail;
         float radius = 0.2f;
         float height = 1.0f;
 
@@ -889,34 +1795,18 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         }
 
         mesh.nVertices = verts.size() / 8;  // Updated for the additional normal components
-
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, verts.data(), GL_TRIANGLE_STRIP);
 
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * verts.size(), verts.data(), GL_STATIC_DRAW);
-
-        GLint stride = sizeof(float) * 8;  // Updated for the additional normal components
-
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        // Normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
-        glEnableVertexAttribArray(1);
-
-        // Texture coordinate attribute
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
-        glEnableVertexAttribArray(2);
     }
     // For the sphere
     else if (type == "sphere")
     {
         const float PI = glm::pi<float>();
-        int sectorCount = 30;
-        int stackCount = 30;
+        int sectorCount = gMeshDetail;
+        int stackCount = gMeshDetail;
         float radius = 0.35f;
 
         std::vector<float> vertices;
@@ -955,27 +1845,11 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         }
 
         mesh.nVertices = vertices.size() / 8;  // Updated for the additional normal components
-
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, vertices.data(), GL_TRIANGLE_FAN);
 
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-
-        GLint stride = sizeof(float) * 8;  // Updated for the additional normal components
-
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        // Normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
-        glEnableVertexAttribArray(1);
-
-        // Texture coordinate attribute
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
-        glEnableVertexAttribArray(2);
     }
     // For the plane
     else if (type == "plane")
@@ -996,27 +1870,12 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         const GLuint floatsPerUV = 2;
 
         mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, verts, GL_TRIANGLES);
 
         // Create 2 buffers: first one for the vertex data; second one for the indices
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
         glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-        // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-        glEnableVertexAttribArray(1);
-
-        glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-        glEnableVertexAttribArray(2);
     }
     // For the cube
     else if (type == "cube")
@@ -1079,33 +1938,18 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         const GLuint floatsPerUV = 2;
 
         mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, verts, GL_TRIANGLES);
 
         // Create 2 buffers: first one for the vertex data; second one for the indices
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
         glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-        // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-        glEnableVertexAttribArray(1);
-
-        glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-        glEnableVertexAttribArray(2);
     }
     else if (type == "torus")
     {
         const float PI = 3.14159265359f;
-        int ringCount = 30;  // Number of rings
-        int sideCount = 30;  // Number of sides per ring
+        int ringCount = gMeshDetail;  // Number of rings
+        int sideCount = gMeshDetail;  // Number of sides per ring
         float majorRadius = 1.0f;  // Radius from the center of the torus to the center of the tube
         float minorRadius = 0.3f;  // Radius of the tube
 
@@ -1150,32 +1994,17 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         }
 
         mesh.nVertices = verts.size() / 8;  // Updated for the additional normal components
-
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
+        // Not drawn by the scene; measured as the strips its rings would form
+        UMeasureMesh(mesh, verts.data(), GL_TRIANGLE_STRIP);
 
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * verts.size(), verts.data(), GL_STATIC_DRAW);
-
-        GLint stride = sizeof(float) * 8;  // Updated for the additional normal components
-
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        // Normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
-        glEnableVertexAttribArray(1);
-
-        // Texture coordinate attribute
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
-        glEnableVertexAttribArray(2);
     }
     else if (type == "cup")
     {
         const float PI = 3.14159265359f;
-        int sectorCount = 30;
+        int sectorCount = gMeshDetail;
         float topRadius = 0.5f;  // Radius of the top of the cup
         float bottomRadius = 0.3f;  // Radius of the bottom of the cup
         float height = 1.5f;
@@ -1229,27 +2058,11 @@ void UCreateMesh(GLMesh& mesh, const char* type)
         }
 
         mesh.nVertices = verts.size() / 8;  // Updated for the additional normal components
-
-        glGenVertexArrays(1, &mesh.vao);
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, verts.data(), GL_TRIANGLE_STRIP);
 
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * verts.size(), verts.data(), GL_STATIC_DRAW);
-
-        GLint stride = sizeof(float) * 8;  // Updated for the additional normal components
-
-        // Position attribute
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        // Normal attribute
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
-        glEnableVertexAttribArray(1);
-
-        // Texture coordinate attribute
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
-        glEnableVertexAttribArray(2);
     }
     else if (type == "prism")
     {
@@ -1305,34 +2118,17 @@ void UCreateMesh(GLMesh& mesh, const char* type)
              -0.75f,  0.5f, -0.1f,  0.0f,  1.0f,  0.0f,  0.0f, 1.0f
         };
 
-
-
         const GLuint floatsPerVertex = 3;
         const GLuint floatsPerNormal = 3;
         const GLuint floatsPerUV = 2;
 
         mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-        glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-        glBindVertexArray(mesh.vao);
+        UMeasureMesh(mesh, verts, GL_TRIANGLES);
 
         // Create 2 buffers: first one for the vertex data; second one for the indices
         glGenBuffers(1, &mesh.vbo);
         glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
         glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-        // Strides between vertex coordinates is 8 (x, y, z, r, g, b, a, s, t). A tightly packed stride is 0.
-        GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
-
-        // Create Vertex Attribute Pointers
-        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-        glEnableVertexAttribArray(1);
-
-        glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-        glEnableVertexAttribArray(2);
     }
 }
 
@@ -1343,117 +2139,639 @@ void UDestroyMesh(GLMesh& mesh)
 }
 
 
-/*Generate and load the texture*/
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Vertex array over a filled vertex buffer: position, normal and texture coordinates interleaved
+void UCreateMeshVertexArray(GLMesh& mesh)
+{
+    const GLint stride = sizeof(float) * 8;
+
+    glGenVertexArrays(1, &mesh.vao);
+    glBindVertexArray(mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+
+    // Position attribute
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
+
+    // Normal attribute
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3));
+    glEnableVertexAttribArray(1);
+
+    // Texture coordinate attribute
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 6));
+    glEnableVertexAttribArray(2);
+
+    glBindVertexArray(0);
+
+    // Runs between frames, the binds above went around the state cache
+    gStateCache.Invalidate();
+}
+
+
+// Draws the mesh whose vertex array is bound; a mesh the loader has not finished has none and is skipped
+void UDrawMesh(const GLMesh& mesh, GLenum mode)
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
+    if (mesh.vao != 0)
+        glDrawArrays(mode, 0, mesh.nVertices);
+}
+
+
+// Bounding sphere and texture density of the mesh's interleaved vertex data drawn as mode; the density is the
+// square root of the ratio of the triangles' texture coordinate and object space areas
+void UMeasureMesh(GLMesh& mesh, const float* vertices, GLenum mode)
+{
+    const GLuint stride = 8;
+    if (mesh.nVertices == 0)
+        return;
+
+    glm::vec3 lower(vertices[0], vertices[1], vertices[2]);
+    glm::vec3 upper = lower;
+    for (GLuint i = 1; i < mesh.nVertices; ++i)
+    {
+        const glm::vec3 position(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+        lower = glm::min(lower, position);
+        upper = glm::max(upper, position);
+    }
+    mesh.center = (lower + upper) * 0.5f;
+    mesh.radius = 0.0f;
+    for (GLuint i = 0; i < mesh.nVertices; ++i)
+        mesh.radius = max(mesh.radius, glm::distance(mesh.center, glm::vec3(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2])));
+
+    float area = 0.0f;
+    float textureArea = 0.0f;
+    const GLuint triangleCount = mode == GL_TRIANGLES ? mesh.nVertices / 3 : mesh.nVertices >= 3 ? mesh.nVertices - 2 : 0;
+    for (GLuint triangle = 0; triangle < triangleCount; ++triangle)
     {
-        flipImageVertically(image, width, height, channels);
+        // Separate triangles, a strip (the degenerate triangles add no area) or a fan around the first vertex
+        const GLuint first = mode == GL_TRIANGLES ? triangle * 3 : triangle;
+        const GLuint corners[3] = { mode == GL_TRIANGLE_FAN ? 0 : first, first + 1, first + 2 };
+
+        glm::vec3 positions[3];
+        glm::vec2 coordinates[3];
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const float* vertex = vertices + corners[corner] * stride;
+            positions[corner] = glm::vec3(vertex[0], vertex[1], vertex[2]);
+            coordinates[corner] = glm::vec2(vertex[6], vertex[7]);
+        }
+        const glm::vec2 u = coordinates[1] - coordinates[0];
+        const glm::vec2 v = coordinates[2] - coordinates[0];
+        area += 0.5f * glm::length(glm::cross(positions[1] - positions[0], positions[2] - positions[0]));
+        textureArea += 0.5f * fabs(u.x * v.y - u.y * v.x);
+    }
+    mesh.uvDensity = area > 0.0f ? sqrt(textureArea / area) : 0.0f;
+}
 
+
+// Starts the loader thread on a context that shares objects with the render context. Traced builds load on
+// the render thread since the call counters and the capture stream are not thread-safe.
+void UStartResourceLoader()
+{
+    if (!GLTRACE_ENABLED && gHeadless)
+    {
+        if (gHeadlessContext.CreateLoaderContext())
+            gResourceLoader.Start([](bool current) { return gHeadlessContext.MakeLoaderContextCurrent(current); });
+    }
+    else if (!GLTRACE_ENABLED && gLoaderWindow)
+    {
+        gResourceLoader.Start([](bool current)
+        {
+            glfwMakeContextCurrent(current ? gLoaderWindow : NULL);
+            return glfwGetCurrentContext() == (current ? gLoaderWindow : NULL);
+        });
+    }
+    cout << "INFO: Meshes and textures load on the " << (gResourceLoader.IsThreaded() ? "loader" : "render") << " thread" << endl;
+}
+
+
+// Fills the mesh's vertex buffer on the loader thread. Vertex arrays are not shared between contexts, the
+// completion creates it on the render thread and only then replaces the mesh.
+void ULoadMesh(GLMesh& mesh, const char* type)
+{
+    std::shared_ptr<GLMesh> loaded = std::make_shared<GLMesh>();
+    gResourceLoader.Submit(
+        [loaded, type]()
+        {
+            UCreateMesh(*loaded, type);
+            return loaded->vbo != 0;
+        },
+        [loaded, &mesh](bool created)
+        {
+            if (!created)
+                return;
+            UCreateMeshVertexArray(*loaded);
+            mesh = *loaded;
+        });
+}
+
+
+/*Generate the texture from a decoded image and its mip chain*/
+bool UCreateTexture(const TextureDecoder::Image& image, GLuint& textureId)
+{
+    PROFILE_ZONE("UCreateTexture");
+
+    if (image.pixels)
+    {
         glGenTextures(1, &textureId);
         glBindTexture(GL_TEXTURE_2D, textureId);
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
+        // Immutable storage for every level the decode workers built; the texels are sRGB, so sampling returns
+        // linear values and filtering and mip selection happen in linear light. Wrapping and filtering come
+        // from the material's sampler object.
+        glTexStorage2D(GL_TEXTURE_2D, image.levels, GL_SRGB8_ALPHA8, image.width, image.height);
+        const unsigned char* level = image.pixels;
+        int width = image.width;
+        int height = image.height;
+        for (int i = 0; i < image.levels; ++i)
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+            glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, level);
+            level += static_cast<size_t>(width) * height * 4;
+            width = imagekernels::MipSize(width);
+            height = imagekernels::MipSize(height);
         }
 
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(image);
         glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
         return true;
     }
 
+    if (image.channels != 0)
+        cout << "Not implemented to handle image with " << image.channels << " channels" << endl;
+
     // Error loading the image
     return false;
 }
 
 
-void UDestroyTexture(GLuint textureId)
+/*Generate the texture from a cooked block-compressed mip chain, false when the driver lacks its format. The
+  storage starts at the first level that was read, the finer ones are streamed in later.*/
+bool UCreateCompressedTexture(const CompressedTexture& texture, GLuint& textureId)
 {
+    PROFILE_ZONE("UCreateCompressedTexture");
+
+    const GLenum internalFormat = UCompressedFormat(texture.format);
+    if (internalFormat == 0)
+    {
+        cout << "INFO: No " << bc::FormatName(texture.format) << " texture support, decoding the image file instead" << endl;
+        return false;
+    }
+
     glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+
+    // Every level was compressed by the cooker, the driver only copies the blocks into immutable storage
+    const size_t firstLevel = texturecooker::FirstLevel(texture);
+    const GLsizei levels = static_cast<GLsizei>(texture.levels.size() - firstLevel);
+    int width = texture.width;
+    int height = texture.height;
+    for (size_t i = 0; i < firstLevel; ++i)
+    {
+        width = imagekernels::MipSize(width);
+        height = imagekernels::MipSize(height);
+    }
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+    for (GLsizei i = 0; i < levels; ++i)
+    {
+        const std::vector<unsigned char>& level = texture.levels[firstLevel + i];
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, width, height, internalFormat, static_cast<GLsizei>(level.size()), &level[0]);
+        width = imagekernels::MipSize(width);
+        height = imagekernels::MipSize(height);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+
+    return true;
 }
 
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+/*sRGB internal format of a block-compressed format, 0 when the driver does not support it*/
+GLenum UCompressedFormat(bc::Format format)
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
+    if (format == bc::FORMAT_BC1 && GLEW_EXT_texture_compression_s3tc)
+        return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    if (format == bc::FORMAT_BC3 && GLEW_EXT_texture_compression_s3tc)
+        return GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+    if (format == bc::FORMAT_BC7 && GLEW_ARB_texture_compression_bptc)
+        return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    return 0;
+}
+
+
+/*Cook every texture of the scene into the cooked directory: "bc1" uses BC1, or BC3 for images with alpha,
+  "bc7" uses BC7 for all of them, "lossless" writes the fast-decode containers that replace the PNGs*/
+bool UCookTextures(const char* mode)
+{
+    const bool lossless = strcmp(mode, "lossless") == 0;
+    if (strcmp(mode, "bc1") != 0 && strcmp(mode, "bc7") != 0 && !lossless)
+    {
+        cout << "Invalid --cook-textures, expected bc1, bc7 or lossless" << endl;
+        return false;
+    }
+
+    texturecooker::MakeDirectory(COOKED_TEXTURE_DIRECTORY);
+    bool cooked = true;
+    for (size_t i = 0; i < TEXTURE_COUNT; ++i)
+    {
+        const std::string imagePath = std::string(TEXTURE_DIRECTORY) + TEXTURE_FILES[i].name + ".png";
+        const std::string cookedPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[i].name + (lossless ? lzimage::EXTENSION : ".ktx2");
+        if (lossless ? !lzimage::Cook(imagePath.c_str(), cookedPath.c_str(), cout)
+            : !texturecooker::Cook(imagePath.c_str(), cookedPath.c_str(), strcmp(mode, "bc7") == 0, cout))
+            cooked = false;
+    }
+    return cooked;
+}
+
 
-    // Create a Shader program object.
-    programId = glCreateProgram();
+void UDestroyTexture(GLuint textureId)
+{
+    glDeleteTextures(1, &textureId);
+    gStateCache.ForgetTexture(textureId);
+}
 
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+// 1x1 mid grey texture every material starts with
+void UCreatePlaceholderTexture()
+{
+    const unsigned char grey[] = { 128, 128, 128, 255 };
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    glGenTextures(1, &gPlaceholderTextureId);
+    glBindTexture(GL_TEXTURE_2D, gPlaceholderTextureId);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    for (size_t i = 0; i < TEXTURE_COUNT; ++i)
+        *TEXTURE_FILES[i].textureId = gPlaceholderTextureId;
+}
+
+
+// Queues a loader job per texture: cooked textures are read and uploaded as they are, every other file is
+// submitted to the decode workers now and uploaded by its job once decoded. Each completion replaces the
+// material's placeholder; a texture that fails to load keeps it.
+void ULoadTextures()
+{
+    const unsigned int cores = std::thread::hardware_concurrency();
+    std::shared_ptr<TextureDecoder> decoder = std::make_shared<TextureDecoder>(
+        static_cast<unsigned int>(std::min<size_t>(cores > 0 ? cores : 2, TEXTURE_COUNT)));
+    std::shared_ptr<TextureLoads> loads = std::make_shared<TextureLoads>();
+    loads->decodeThreads = decoder->ThreadCount();
+
+    for (size_t i = 0; i < TEXTURE_COUNT; ++i)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        const std::string imagePath = std::string(TEXTURE_DIRECTORY) + TEXTURE_FILES[i].name + ".png";
+        const std::string cookedPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[i].name + ".ktx2";
+        const size_t decodeIndex = texturecooker::IsUpToDate(imagePath.c_str(), cookedPath.c_str()) ? NO_DECODE : decoder->Submit(UDecodedImagePath(i).c_str());
 
-        return false;
+        gResourceLoader.Submit(
+            [decoder, loads, i, decodeIndex]() { return ULoadTextureFile(i, *decoder, decodeIndex, loads->textures[i]); },
+            [loads, i, imagePath](bool created)
+            {
+                if (created)
+                    URegisterTexture(i, loads->textures[i]);
+                else
+                    cout << "Failed to load texture " << imagePath << ", the placeholder stays" << endl;
+
+                if (++loads->completed < TEXTURE_COUNT)
+                    return;
+                size_t loadedCount = 0;
+                size_t cookedCount = 0;
+                size_t uncompressedBytes = 0;
+                for (size_t j = 0; j < TEXTURE_COUNT; ++j)
+                {
+                    const LoadedTexture& texture = loads->textures[j];
+                    if (texture.levelBytes.empty())
+                        continue;
+                    ++loadedCount;
+                    cookedCount += texture.cooked ? 1 : 0;
+                    uncompressedBytes += imagekernels::MipChainBytes(texture.width, texture.height);
+                }
+                cout << "INFO: " << loadedCount << " of " << TEXTURE_COUNT << " textures (" << cookedCount << " cooked, the others decoded on "
+                    << loads->decodeThreads << " threads) ready " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gStartupTime).count()
+                    << " ms after startup, " << gTextureResidency.ResidentBytes() / (1024.0 * 1024.0) << " MB of texture memory instead of "
+                    << uncompressedBytes / (1024.0 * 1024.0) << " MB" << endl;
+                DecodeBufferPool::Shared().Print(cout);
+                DecodeBufferPool::Shared().Trim();
+            });
     }
+}
+
+
+// Image file the decoder reads for TEXTURE_FILES[file]: its lossless container when one is up to date, the PNG
+// otherwise
+std::string UDecodedImagePath(size_t file)
+{
+    const std::string imagePath = std::string(TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + ".png";
+    const std::string containerPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + lzimage::EXTENSION;
+    return texturecooker::IsUpToDate(imagePath.c_str(), containerPath.c_str()) ? containerPath : imagePath;
+}
+
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+// Loader thread: creates the texture of TEXTURE_FILES[file] from its cooked file when decodeIndex is
+// NO_DECODE, otherwise (or when the driver cannot use the cooked file) from the decoded image file
+bool ULoadTextureFile(size_t file, TextureDecoder& decoder, size_t decodeIndex, LoadedTexture& loaded)
+{
+    if (decodeIndex == NO_DECODE && ULoadCookedTexture(file, loaded))
+        return true;
+
+    // A cooked file the driver cannot use falls back to the image file
+    const size_t index = decodeIndex != NO_DECODE ? decodeIndex : decoder.Submit(UDecodedImagePath(file).c_str());
+    const bool created = UCreateDecodedTexture(decoder.Wait(index), loaded);
+    decoder.Release(index);
+    return created;
+}
+
+
+// Loader thread: creates the texture of TEXTURE_FILES[file] from its cooked file. Only the cooked levels no
+// larger than the residency registry keeps anyway are read, the draws stream in the others.
+bool ULoadCookedTexture(size_t file, LoadedTexture& loaded)
+{
+    const std::string cookedPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + ".ktx2";
+    loaded.levelBytes.clear();
+
+    CompressedTexture texture;
+    if (!texturecooker::ReadKTX2(cookedPath.c_str(), texture, TextureResidency::MIN_RESIDENT_SIZE) || !UCreateCompressedTexture(texture, loaded.id))
+        return false;
+
+    loaded.internalFormat = UCompressedFormat(texture.format);
+    loaded.width = texture.width;
+    loaded.height = texture.height;
+    int width = texture.width;
+    int height = texture.height;
+    for (size_t level = 0; level < texture.levels.size(); ++level)
     {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        loaded.levelBytes.push_back(bc::LevelBytes(texture.format, width, height));
+        width = imagekernels::MipSize(width);
+        height = imagekernels::MipSize(height);
+    }
+    loaded.baseLevel = static_cast<int>(texturecooker::FirstLevel(texture));
+    loaded.cooked = true;
+    return true;
+}
+
 
+// Loader thread: creates the texture from a decoded image, the caller gives the pixels back afterwards
+bool UCreateDecodedTexture(const TextureDecoder::Image& image, LoadedTexture& loaded)
+{
+    loaded.levelBytes.clear();
+    if (!UCreateTexture(image, loaded.id))
         return false;
+
+    loaded.internalFormat = GL_SRGB8_ALPHA8;
+    loaded.width = image.width;
+    loaded.height = image.height;
+    int width = image.width;
+    int height = image.height;
+    for (int level = 0; level < image.levels; ++level)
+    {
+        loaded.levelBytes.push_back(static_cast<size_t>(width) * height * 4);
+        width = imagekernels::MipSize(width);
+        height = imagekernels::MipSize(height);
     }
+    loaded.baseLevel = 0;
+    loaded.cooked = false;
+    return true;
+}
+
+
+// Render thread: hands a loaded texture to the residency registry, which stores it in the material. Cooked
+// textures stream their finer levels from the cooked file, decoded ones are reloaded in full.
+void URegisterTexture(size_t file, const LoadedTexture& loaded)
+{
+    TextureResidency::Streamer stream;
+    if (loaded.cooked)
+        stream = [file](int level) { UStreamTextureLevel(file, level); };
+    gTextureResidency.Add(TEXTURE_FILES[file].textureId, loaded.id, loaded.internalFormat, loaded.width, loaded.height, loaded.levelBytes,
+        loaded.baseLevel, [file]() { UReloadTexture(file); }, stream);
+
+    // A reload deleted the reduced texture the state cache may still show as bound
+    gStateCache.Invalidate();
+}
+
+
+// Loads the full texture again after the registry dropped levels of it; until the job completes the material
+// keeps the reduced texture. The job already runs on the loader thread, so the image is decoded right there
+// instead of on decode workers of its own.
+void UReloadTexture(size_t file)
+{
+    std::shared_ptr<LoadedTexture> loaded = std::make_shared<LoadedTexture>();
+    gResourceLoader.Submit(
+        [file, loaded]()
+        {
+            const std::string imagePath = std::string(TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + ".png";
+            const std::string cookedPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + ".ktx2";
+            if (texturecooker::IsUpToDate(imagePath.c_str(), cookedPath.c_str()) && ULoadCookedTexture(file, *loaded))
+                return true;
+
+            const TextureDecoder::Image image = TextureDecoder::Decode(UDecodedImagePath(file).c_str());
+            const bool created = UCreateDecodedTexture(image, *loaded);
+            DecodeBufferPool::Shared().Free(image.pixels);
+            return created;
+        },
+        [file, loaded](bool created)
+        {
+            if (created)
+                URegisterTexture(file, *loaded);
+        });
+}
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+// Reads one level of a cooked texture on the loader thread, the completion uploads it into whatever storage the
+// residency registry holds the texture in by then
+void UStreamTextureLevel(size_t file, int level)
+{
+    std::shared_ptr<CompressedTexture> texture = std::make_shared<CompressedTexture>();
+    gResourceLoader.Submit(
+        [file, level, texture]()
+        {
+            const std::string cookedPath = std::string(COOKED_TEXTURE_DIRECTORY) + TEXTURE_FILES[file].name + ".ktx2";
+            return texturecooker::ReadKTX2Level(cookedPath.c_str(), level, *texture);
+        },
+        [file, level, texture](bool read)
+        {
+            if (read && gTextureResidency.AddLevel(TEXTURE_FILES[file].textureId, level, texture->levels[level]))
+                gStateCache.Invalidate();
+        });
+}
+
+
+// Cooks an image into the page file of the desk's virtual texture
+bool UCookVirtualTexture(const char* imagePath)
+{
+    texturecooker::MakeDirectory(COOKED_TEXTURE_DIRECTORY);
+    const std::string pagePath = std::string(COOKED_TEXTURE_DIRECTORY) + VIRTUAL_TEXTURE_FILE;
+    return VirtualTexture::Cook(imagePath, pagePath.c_str(), cout);
+}
+
+
+// Opens the desk's virtual texture when its page file has been cooked and the driver has BC1 textures, and
+// starts compiling the shader variants that draw it
+void UOpenVirtualTexture()
+{
+    const std::string pagePath = std::string(COOKED_TEXTURE_DIRECTORY) + VIRTUAL_TEXTURE_FILE;
+    if (!std::ifstream(pagePath.c_str()))
+        return;
+    const GLenum format = UCompressedFormat(bc::FORMAT_BC1);
+    if (format == 0)
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        cout << "INFO: " << pagePath << " ignored, the driver has no BC1 textures" << endl;
+        return;
+    }
+    if (!gDeskVirtualTexture.Open(pagePath.c_str(), format))
+        return;
 
-        return false;
+    gObjectShaders.Prepare(VIRTUAL_TEXTURE_FEEDBACK_VARIANT);
+    gObjectShaders.Prepare(UObjectShaderVariant(gForwardLightCount, false, false) + " VIRTUAL_TEXTURE=1");
+    cout << "INFO: Desk surface from the virtual texture " << pagePath << " (" << gDeskVirtualTexture.Width() << "x"
+        << gDeskVirtualTexture.Height() << ", " << gDeskVirtualTexture.LevelCount() << " levels)" << endl;
+}
+
+
+// Reads a page of the desk's virtual texture on the loader thread, the completion uploads it into the atlas; a
+// page that cannot be read is handed over empty so it is not asked for again
+void ULoadVirtualTexturePage(int level, int x, int y)
+{
+    std::shared_ptr<std::vector<unsigned char>> page = std::make_shared<std::vector<unsigned char>>();
+    gResourceLoader.Submit(
+        [level, x, y, page]()
+        {
+            return gDeskVirtualTexture.ReadPage(level, x, y, *page);
+        },
+        [level, x, y, page](bool read)
+        {
+            if (!read)
+                page->clear();
+            if (gDeskVirtualTexture.AddPage(level, x, y, *page))
+                gStateCache.Invalidate();
+        });
+}
+
+
+// Creates the sampler object of each preset
+void UCreateSamplers()
+{
+    glGenSamplers(SAMPLER_PRESET_COUNT, gSamplers);
+    for (int i = 0; i < SAMPLER_PRESET_COUNT; ++i)
+    {
+        glSamplerParameteri(gSamplers[i], GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glSamplerParameteri(gSamplers[i], GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glSamplerParameteri(gSamplers[i], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glSamplerParameteri(gSamplers[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // Without the extension the anisotropic preset stays trilinear
+    if (GLEW_EXT_texture_filter_anisotropic)
+    {
+        GLfloat maxAnisotropy = 1.0f;
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+        glSamplerParameterf(gSamplers[SAMPLER_ANISOTROPIC], GL_TEXTURE_MAX_ANISOTROPY_EXT, min(MAX_ANISOTROPY, maxAnisotropy));
     }
+}
 
-    glUseProgram(programId);    // Uses the shader program
 
-    return true;
+// Binds the material's texture and its sampler preset on texture unit 0, and requests the mip level the
+// draw of the mesh with this model matrix samples
+void UBindMaterial(const Material& material, const GLMesh& mesh, const glm::mat4& model)
+{
+    // Without a loader thread a reload runs right here and binds textures around the state cache
+    if (gTextureResidency.Touch(&material.texture) && !gResourceLoader.IsThreaded())
+        gStateCache.Invalidate();
+    if (mesh.vao != 0)
+        gTextureResidency.Request(&material.texture, UTextureCoordinatesPerPixel(mesh, model, material.uvScale));
+    gStateCache.BindTexture(0, GL_TEXTURE_2D, material.texture);
+    gStateCache.BindSampler(0, gSamplers[material.sampler]);
 }
 
 
-void UDestroyShaderProgram(GLuint programId)
+// Texture coordinate units one screen pixel covers where the draw comes closest to the camera: the mesh's
+// texture density times the size of a pixel at that distance. The surface is taken to face the camera, the
+// finest case, so surfaces seen at grazing angles still get the detail anisotropic filtering samples.
+float UTextureCoordinatesPerPixel(const GLMesh& mesh, const glm::mat4& model, const glm::vec2& uvScale)
 {
-    glDeleteProgram(programId);
+    const float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+
+    float pixelSize;
+    if (isPerspective)
+    {
+        const glm::vec3 center = glm::vec3(model * glm::vec4(mesh.center, 1.0f));
+        const float distance = max(0.1f, glm::distance(center, gCamera.Position) - mesh.radius * scale);     // Not closer than the near plane
+        pixelSize = 2.0f * distance * tan(glm::radians(gCamera.Zoom) * 0.5f) / gViewportHeight;
+    }
+    else
+        pixelSize = 10.0f / gViewportHeight;    // The orthographic projection is 10 units high
+
+    return mesh.uvDensity * max(uvScale.x, uvScale.y) * pixelSize / scale;
+}
+
+
+// Creates the light set used by the clustered forward+ mode: the key and fill lamps followed by
+// small coloured point lights on rings above the desk, plus a desk spot light
+void UCreateClusterLights()
+{
+    PointLight lamp;
+    lamp.constant = 1.0f;
+    lamp.linear = 0.09f;
+    lamp.quadratic = 0.032f;
+    lamp.specular = glm::vec3(1.0f);
+
+    lamp.position = gKeyLightPosition;
+    lamp.ambient = gKeyLightColor * 0.3f;
+    lamp.diffuse = gKeyLightColor;
+    gClusteredLighting.PointLights.push_back(lamp);
+
+    lamp.position = gFillLightPosition;
+    lamp.ambient = gFillLightColor * 0.1f;
+    lamp.diffuse = gFillLightColor;
+    gClusteredLighting.PointLights.push_back(lamp);
+
+    const float PI = glm::pi<float>();
+    const int lightsPerRing = 32;
+    for (int i = 0; i < CLUSTER_DYNAMIC_LIGHT_COUNT; ++i)
+    {
+        const int ring = i / lightsPerRing;
+        const float angle = 2.0f * PI * (i % lightsPerRing) / lightsPerRing + ring * 0.37f;
+        const float radius = 1.0f + 0.55f * ring;
+        gDynamicLightBasePositions.push_back(glm::vec3(radius * cos(angle), -5.0f + 0.15f * (ring % 3), radius * sin(angle)));
+
+        // Cheap deterministic hue spread
+        const float hue = float(i) / CLUSTER_DYNAMIC_LIGHT_COUNT;
+        const glm::vec3 color(0.5f + 0.5f * cos(2.0f * PI * hue), 0.5f + 0.5f * cos(2.0f * PI * (hue - 0.333f)), 0.5f + 0.5f * cos(2.0f * PI * (hue - 0.667f)));
+
+        PointLight light;
+        light.position = gDynamicLightBasePositions.back();
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        light.ambient = glm::vec3(0.0f);
+        light.diffuse = color;
+        light.specular = color;
+        gClusteredLighting.PointLights.push_back(light);
+    }
+
+    SpotLight deskLamp;
+    deskLamp.position = glm::vec3(0.5f, -2.0f, 1.0f);
+    deskLamp.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    deskLamp.cutOff = cos(glm::radians(20.0f));
+    deskLamp.outerCutOff = cos(glm::radians(30.0f));
+    deskLamp.constant = 1.0f;
+    deskLamp.linear = 0.09f;
+    deskLamp.quadratic = 0.032f;
+    deskLamp.ambient = glm::vec3(0.0f);
+    deskLamp.diffuse = glm::vec3(1.0f, 0.95f, 0.8f);
+    deskLamp.specular = glm::vec3(1.0f);
+    gClusteredLighting.SpotLights.push_back(deskLamp);
+}
+
+
+// Moves the clustered lights: the lamps follow their orbit and the dynamic lights circle the desk
+void UUpdateClusterLights()
+{
+    std::vector<PointLight>& lights = gClusteredLighting.PointLights;
+    lights[0].position = gKeyLightPosition;
+    lights[1].position = gFillLightPosition;
+
+    const glm::mat4 rotation = glm::rotate(gDynamicLightAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+    for (size_t i = 0; i < gDynamicLightBasePositions.size(); ++i)
+    {
+        const glm::vec4 p = rotation * glm::vec4(gDynamicLightBasePositions[i], 1.0f);
+        lights[i + 2].position = glm::vec3(p.x, p.y, p.z);
+    }
 }
@@ -13,6 +13,8 @@
 
 #include <learnOpengl/camera.h> // Camera class
 
+#include "texture_cache.h"      // Textures shared by the content hash of their file
+
 using namespace std;  // Standard namespaace
 
 /*Shader program Macro*/
@@ -87,10 +89,18 @@ void URender();
 void UCreateMesh(GLMesh& mesh, const char* type);
 void UDestroyMesh(GLMesh& mesh);
 bool UCreateTexture(const char* filename, GLuint& textureId);
+bool UCreateTextureFromFileBytes(const unsigned char* bytes, size_t size, unsigned int& textureId);
 void UDestroyTexture(GLuint textureId);
+void UDeleteTexture(unsigned int textureId);
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
 void UDestroyShaderProgram(GLuint programId);
 
+namespace
+{
+    // Every texture is requested through the cache, a file whose contents were loaded before is not decoded again
+    TextureCache gTextureCache(UCreateTextureFromFileBytes, UDeleteTexture);
+}
+
 // Vertex Shader Source Code
 const GLchar* vertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
@@ -182,6 +192,7 @@ int main(int argc, char* argv[])
         cout << "Failed to load texture " << texFilename << endl;
         return EXIT_FAILURE;
     }
+    gTextureCache.print(cout);
 
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
     glUseProgram(gProgramId);
@@ -685,9 +696,16 @@ void UDestroyMesh(GLMesh& mesh)
 
 /*Generate and load the texture*/
 bool UCreateTexture(const char* filename, GLuint& textureId)
+{
+    return gTextureCache.acquire(filename, textureId);
+}
+
+
+// Decodes the bytes of an image file into a new texture, called by the cache for contents it has not seen
+bool UCreateTextureFromFileBytes(const unsigned char* bytes, size_t size, unsigned int& textureId)
 {
     int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    unsigned char* image = stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &channels, 0);
     if (image)
     {
         flipImageVertically(image, width, height, channels);
@@ -727,7 +745,13 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
 
 void UDestroyTexture(GLuint textureId)
 {
-    glGenTextures(1, &textureId);
+    gTextureCache.release(textureId);
+}
+
+
+void UDeleteTexture(unsigned int textureId)
+{
+    glDeleteTextures(1, &textureId);
 }
 
 // Implements the UCreateShaders function
@@ -25,6 +25,7 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
+// id comes from a TextureCache, so meshes whose texture files have the same contents share one texture
 struct Texture {
 	unsigned int id;
 	string type;
@@ -48,22 +49,66 @@ public:
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
+		setupBindings();
 	}
 
-	// render the mesh
+	// render the mesh; the shader has to be in use. Texture units and sampler names are worked out
+	// once in the constructor and the sampler locations once per shader, so drawing does no string work
 	void Draw(Shader &shader)
 	{
+		if (samplerTable != shader.uniformTable())
+		{
+			for (size_t i = 0; i < bindings.size(); i++)
+				bindings[i].location = shader.location(UniformId(bindings[i].samplerHash, bindings[i].sampler.c_str()));
+			samplerTable = shader.uniformTable();
+		}
+
 		// bind appropriate textures
+		for (size_t i = 0; i < bindings.size(); i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + bindings[i].unit); // active proper texture unit before binding
+			// now set the sampler to the correct texture unit
+			glUniform1i(bindings[i].location, bindings[i].unit);
+			// and finally bind the texture
+			glBindTexture(GL_TEXTURE_2D, bindings[i].texture);
+		}
+
+		// draw mesh
+		glBindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+private:
+	// render data 
+	unsigned int VBO, EBO;
+
+	// texture unit, texture and sampler uniform (diffuse_textureN and so on) of each texture
+	struct TextureBinding {
+		GLint unit;
+		unsigned int texture;
+		string sampler;
+		unsigned int samplerHash;
+		GLint location;
+	};
+	vector<TextureBinding> bindings;
+	unsigned int samplerTable = 0;	// uniform table the locations were looked up in
+
+	// numbers the textures of each type (the N in diffuse_textureN) and assigns them units in order
+	void setupBindings()
+	{
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
 		unsigned int normalNr = 1;
 		unsigned int heightNr = 1;
+		bindings.resize(textures.size());
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-			// retrieve texture number (the N in diffuse_textureN)
 			string number;
-			string name = textures[i].type;
+			const string& name = textures[i].type;
 			if (name == "texture_diffuse")
 				number = std::to_string(diffuseNr++);
 			else if (name == "texture_specular")
@@ -73,25 +118,14 @@ public:
 			else if (name == "texture_height")
 				number = std::to_string(heightNr++); // transfer unsigned int to stream
 
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			bindings[i].unit = i;
+			bindings[i].texture = textures[i].id;
+			bindings[i].sampler = name + number;
+			bindings[i].samplerHash = UniformId::hashName(bindings[i].sampler.c_str(), bindings[i].sampler.size());
+			bindings[i].location = -1;
 		}
-
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
 	}
 
-private:
-	// render data 
-	unsigned int VBO, EBO;
-
 	// initializes all the buffer objects/arrays
 	void setupMesh()
 	{
@@ -1,10 +1,10 @@
 #include <stdio.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
-#include <fstream>
 #include <algorithm>
-#include <sstream>
+#include <map>
 using namespace std;
 
 #include <stdlib.h>
@@ -13,45 +13,68 @@ using namespace std;
 #include <GL/glew.h>
 
 #include "shader.hpp"
+#include "source_cache.h"
+
+// Program shared by every LoadShaders call with the same sources
+struct SharedProgram {
+	GLuint ProgramID;
+	int References;
+	std::string VertexSource;	// Copies, the mapped files may change while the program lives
+	std::string FragmentSource;
+};
+
+// Shared programs keyed by the 64-bit FNV-1a hash of their sources
+static std::map<unsigned long long, SharedProgram> SharedPrograms;
+
+static const unsigned long long FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+// Continues Hash with Sources, so the sources can be hashed piece by piece
+static unsigned long long HashSources(unsigned long long Hash, std::string_view Sources){
+	for(size_t i = 0; i < Sources.size(); ++i){
+		Hash ^= (unsigned char)Sources[i];
+		Hash *= 1099511628211ull;
+	}
+	return Hash;
+}
 
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
+	// Map both files (once, they are shared with every other program reading them)
+	std::string_view VertexShaderCode;
+	if(!SourceCache::shared().get(vertex_file_path, VertexShaderCode)){
 		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
+		return 0;
+	}
+	std::string_view FragmentShaderCode;
+	if(!SourceCache::shared().get(fragment_file_path, FragmentShaderCode)){
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", fragment_file_path);
 		return 0;
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	// Identical sources share the program linked by an earlier call
+	unsigned long long Key = HashSources(FNV_OFFSET_BASIS, "VERTEX\n");
+	Key = HashSources(Key, VertexShaderCode);
+	Key = HashSources(Key, "\nFRAGMENT\n");
+	Key = HashSources(Key, FragmentShaderCode);
+	std::map<unsigned long long, SharedProgram>::iterator Shared = SharedPrograms.find(Key);
+	if(Shared != SharedPrograms.end() && Shared->second.VertexSource == VertexShaderCode && Shared->second.FragmentSource == FragmentShaderCode){
+		Shared->second.References++;
+		return Shared->second.ProgramID;
 	}
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
 
 	// Compile Vertex Shader
 	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	char const * VertexSourcePointer = VertexShaderCode.data();
+	GLint VertexSourceLength = (GLint)VertexShaderCode.size();
+	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , &VertexSourceLength);
 	glCompileShader(VertexShaderID);
 
 	// Check Vertex Shader
@@ -67,8 +90,9 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 	// Compile Fragment Shader
 	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+	char const * FragmentSourcePointer = FragmentShaderCode.data();
+	GLint FragmentSourceLength = (GLint)FragmentShaderCode.size();
+	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , &FragmentSourceLength);
 	glCompileShader(FragmentShaderID);
 
 	// Check Fragment Shader
@@ -105,7 +129,30 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	// A hash collision keeps the first program registered, this one is then owned by the caller alone
+	if(Shared == SharedPrograms.end()){
+		SharedProgram & Entry = SharedPrograms[Key];
+		Entry.ProgramID = ProgramID;
+		Entry.References = 1;
+		Entry.VertexSource = VertexShaderCode;
+		Entry.FragmentSource = FragmentShaderCode;
+	}
+
 	return ProgramID;
 }
 
+void ReleaseShaders(GLuint ProgramID){
+
+	for(std::map<unsigned long long, SharedProgram>::iterator it = SharedPrograms.begin(); it != SharedPrograms.end(); ++it){
+		if(it->second.ProgramID != ProgramID)
+			continue;
+		if(--it->second.References == 0){
+			glDeleteProgram(ProgramID);
+			SharedPrograms.erase(it);
+		}
+		return;
+	}
+	glDeleteProgram(ProgramID);
+}
+
 
@@ -5,80 +5,127 @@
 
 #include <glm/glm.hpp>
 
+#include "source_cache.h"
+
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
+#include <type_traits>
 #include <iostream>
+#include <map>
+#include <vector>
+#include <algorithm>
+
+// name of a uniform together with its 32-bit FNV-1a hash; built from a string literal the hash is
+// a constant expression (declare the id constexpr to force it), so setting a uniform does no string work.
+// Only the characters up to the first '\0' are hashed, so a name formatted into a char buffer matches
+class UniformId
+{
+public:
+	unsigned int hash;
+	const char* name;
+
+	template <size_t N>
+	constexpr UniformId(const char (&text)[N]) : hash(hashName(text, nameLength(text, N - 1))), name(text)
+	{
+	}
+	// C strings (arrays take the constructor above), the string has to outlive the id
+	template <typename Text, typename = typename std::enable_if<std::is_convertible<Text, const char*>::value
+		&& !std::is_array<typename std::remove_reference<Text>::type>::value>::type>
+	constexpr UniformId(Text&& text) : hash(hashName(text, nameLength(text, static_cast<size_t>(-1)))), name(text)
+	{
+	}
+	// names assembled at run time, the string has to outlive the id
+	UniformId(const std::string &text) : hash(hashName(text.c_str(), text.size())), name(text.c_str())
+	{
+	}
+	constexpr UniformId(unsigned int nameHash, const char* text) : hash(nameHash), name(text)
+	{
+	}
+
+	// length of text up to its first '\0', at most limit
+	static constexpr size_t nameLength(const char* text, size_t limit)
+	{
+		size_t length = 0;
+		while (length < limit && text[length] != '\0')
+			++length;
+		return length;
+	}
+
+	static constexpr unsigned int hashName(const char* text, size_t length)
+	{
+		unsigned int value = 2166136261u;
+		for (size_t i = 0; i < length; ++i)
+		{
+			value ^= static_cast<unsigned char>(text[i]);
+			value *= 16777619u;
+		}
+		return value;
+	}
+};
 
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly; Shaders built from identical sources share one
+	// reference-counted program, call release() once per constructed Shader to drop it
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
-		// 1. retrieve the vertex/fragment source code from filePath
-		std::string vertexCode;
-		std::string fragmentCode;
-		std::string geometryCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-		std::ifstream gShaderFile;
-		// ensure ifstream objects can throw exceptions:
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
+		// 1. retrieve the vertex/fragment source code from filePath; the files are mapped once and shared
+		// with every other Shader reading them
+		std::string_view vertexCode;
+		std::string_view fragmentCode;
+		std::string_view geometryCode;
+		SourceCache& sourceCache = SourceCache::shared();
+		if (!sourceCache.get(vertexPath, vertexCode) || !sourceCache.get(fragmentPath, fragmentCode)
+			|| (geometryPath != nullptr && !sourceCache.get(geometryPath, geometryCode)))
 		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
-			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
-			}
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
-		catch (std::ifstream::failure& e)
+		// reuse the program of an earlier Shader with the same sources
+		unsigned long long key = hashSources(FNV_OFFSET_BASIS, "VERTEX\n");
+		key = hashSources(key, vertexCode);
+		key = hashSources(key, "\nFRAGMENT\n");
+		key = hashSources(key, fragmentCode);
+		if (geometryPath != nullptr)
 		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+			key = hashSources(key, "\nGEOMETRY\n");
+			key = hashSources(key, geometryCode);
 		}
-		const char* vShaderCode = vertexCode.c_str();
-		const char * fShaderCode = fragmentCode.c_str();
+		std::map<unsigned long long, SharedProgram>::iterator shared = programs().find(key);
+		if (shared != programs().end() && shared->second.vertex == vertexCode && shared->second.fragment == fragmentCode
+			&& shared->second.hasGeometry == (geometryPath != nullptr) && shared->second.geometry == geometryCode)
+		{
+			++shared->second.references;
+			ID = shared->second.ID;
+			buildUniformTable();
+			return;
+		}
+		const char* vShaderCode = vertexCode.data();
+		const char * fShaderCode = fragmentCode.data();
+		const GLint vShaderLength = static_cast<GLint>(vertexCode.size());
+		const GLint fShaderLength = static_cast<GLint>(fragmentCode.size());
 		// 2. compile shaders
 		unsigned int vertex, fragment;
 		// vertex shader
 		vertex = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertex, 1, &vShaderCode, NULL);
+		glShaderSource(vertex, 1, &vShaderCode, &vShaderLength);
 		glCompileShader(vertex);
 		checkCompileErrors(vertex, "VERTEX");
 		// fragment Shader
 		fragment = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragment, 1, &fShaderCode, NULL);
+		glShaderSource(fragment, 1, &fShaderCode, &fShaderLength);
 		glCompileShader(fragment);
 		checkCompileErrors(fragment, "FRAGMENT");
 		// if geometry shader is given, compile geometry shader
 		unsigned int geometry;
 		if (geometryPath != nullptr)
 		{
-			const char * gShaderCode = geometryCode.c_str();
+			const char * gShaderCode = geometryCode.data();
+			const GLint gShaderLength = static_cast<GLint>(geometryCode.size());
 			geometry = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometry, 1, &gShaderCode, NULL);
+			glShaderSource(geometry, 1, &gShaderCode, &gShaderLength);
 			glCompileShader(geometry);
 			checkCompileErrors(geometry, "GEOMETRY");
 		}
@@ -95,7 +142,39 @@ public:
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
-
+		// share the program with later Shaders (a hash collision keeps the first program registered)
+		if (shared == programs().end())
+		{
+			SharedProgram& entry = programs()[key];
+			entry.ID = ID;
+			entry.references = 1;
+			entry.vertex = vertexCode;
+			entry.fragment = fragmentCode;
+			entry.geometry = geometryCode;
+			entry.hasGeometry = geometryPath != nullptr;
+		}
+		buildUniformTable();
+	}
+	// drop this Shader's reference, the program is deleted when no Shader uses it anymore
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		for (std::map<unsigned long long, SharedProgram>::iterator it = programs().begin(); it != programs().end(); ++it)
+		{
+			if (it->second.ID != ID)
+				continue;
+			if (--it->second.references == 0)
+			{
+				glDeleteProgram(ID);
+				programs().erase(it);
+			}
+			ID = 0;
+			uniforms.clear();
+			return;
+		}
+		glDeleteProgram(ID);
+		ID = 0;
+		uniforms.clear();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
@@ -103,66 +182,181 @@ public:
 	{
 		glUseProgram(ID);
 	}
+	// location of a uniform, looked up in the table built at link time; -1 (ignored by glUniform*) when
+	// the program has no such active uniform
+	// ------------------------------------------------------------------------
+	GLint location(const UniformId &uniform) const
+	{
+		std::vector<UniformLocation>::const_iterator it = std::lower_bound(uniforms.begin(), uniforms.end(), uniform.hash, hashLess);
+		if (it == uniforms.end() || it->hash != uniform.hash)
+			return -1;
+		if (it->location == HASH_COLLISION)
+			return glGetUniformLocation(ID, uniform.name);
+		return it->location;
+	}
+	// changes whenever the uniform table is rebuilt, lets callers cache locations per program
+	// ------------------------------------------------------------------------
+	unsigned int uniformTable() const
+	{
+		return uniformTableId;
+	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(const UniformId &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		glUniform1i(location(name), (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(const UniformId &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1i(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(const UniformId &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		glUniform1f(location(name), value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(const UniformId &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform2fv(location(name), 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(const UniformId &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(location(name), x, y);
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(const UniformId &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform3fv(location(name), 1, &value[0]);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(const UniformId &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(location(name), x, y, z);
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(const UniformId &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		glUniform4fv(location(name), 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(const UniformId &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(location(name), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(const UniformId &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(const UniformId &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(const UniformId &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
 	}
 
 private:
+	static const GLint HASH_COLLISION = -2;
+
+	struct UniformLocation
+	{
+		unsigned int hash;
+		GLint location;
+	};
+	std::vector<UniformLocation> uniforms;     // sorted by hash
+	unsigned int uniformTableId = 0;
+
+	struct SharedProgram
+	{
+		unsigned int ID;
+		int references;
+		// copies, the mapped files may change while the program lives
+		std::string vertex;
+		std::string fragment;
+		std::string geometry;
+		bool hasGeometry;
+	};
+	// programs of all Shaders, keyed by the hash of their sources
+	// ------------------------------------------------------------------------
+	static std::map<unsigned long long, SharedProgram>& programs()
+	{
+		static std::map<unsigned long long, SharedProgram> instance;
+		return instance;
+	}
+	static bool hashLess(const UniformLocation &entry, unsigned int hash)
+	{
+		return entry.hash < hash;
+	}
+	// hash -> location of every active uniform outside a uniform block, array uniforms under their
+	// base name and under every element name; names whose hashes collide are looked up by name instead
+	// ------------------------------------------------------------------------
+	void buildUniformTable()
+	{
+		static unsigned int tableCount = 0;
+		uniformTableId = ++tableCount;
+		uniforms.clear();
+
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+		std::map<unsigned int, std::string> names;
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, i, static_cast<GLsizei>(buffer.size()), &length, &size, &type, &buffer[0]);
+			std::string name(&buffer[0], length);
+			if (glGetUniformLocation(ID, name.c_str()) < 0)
+				continue;
+			if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+			{
+				name.erase(name.size() - 3);
+				for (GLint element = 0; element < size; ++element)
+					addUniform(name + "[" + std::to_string(element) + "]", names);
+			}
+			addUniform(name, names);
+		}
+		std::sort(uniforms.begin(), uniforms.end(), [](const UniformLocation &a, const UniformLocation &b) { return a.hash < b.hash; });
+	}
+	void addUniform(const std::string &name, std::map<unsigned int, std::string> &names)
+	{
+		const unsigned int hash = UniformId::hashName(name.c_str(), name.size());
+		std::map<unsigned int, std::string>::iterator previous = names.find(hash);
+		if (previous != names.end())
+		{
+			if (previous->second == name)
+				return;
+			std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << previous->second << " " << name << std::endl;
+			for (size_t i = 0; i < uniforms.size(); ++i)
+				if (uniforms[i].hash == hash)
+					uniforms[i].location = HASH_COLLISION;
+			return;
+		}
+		names[hash] = name;
+		UniformLocation entry;
+		entry.hash = hash;
+		entry.location = glGetUniformLocation(ID, name.c_str());
+		uniforms.push_back(entry);
+	}
+	static const unsigned long long FNV_OFFSET_BASIS = 14695981039346656037ull;
+	// 64-bit FNV-1a, continued from hash so the sources can be hashed piece by piece
+	// ------------------------------------------------------------------------
+	static unsigned long long hashSources(unsigned long long hash, std::string_view sources)
+	{
+		for (size_t i = 0; i < sources.size(); ++i)
+		{
+			hash ^= static_cast<unsigned char>(sources[i]);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -1,6 +1,10 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+// Returns a program linked from the two files; calls with identical sources share one program
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+// Drops one LoadShaders reference, the program is deleted with the last one
+void ReleaseShaders(GLuint ProgramID);
+
 #endif
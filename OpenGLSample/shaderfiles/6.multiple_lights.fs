@@ -42,7 +42,10 @@ struct SpotLight {
     vec3 specular;       
 };
 
+// Light count variant, injected by the shader preprocessor when compiling a specialized program
+#ifndef NR_POINT_LIGHTS
 #define NR_POINT_LIGHTS 4
+#endif
 
 in vec3 FragPos;
 in vec3 Normal;
@@ -0,0 +1,190 @@
+#ifndef SOURCE_CACHE_H
+#define SOURCE_CACHE_H
+
+#include <map>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Shader source files mapped into memory once and shared by every program that reads them. get() hands
+// out a view of the mapped file without copying it; a file is mapped again only when its modification
+// time changes, which also invalidates the views handed out for the old contents.
+// ------------------------------------------------------------------------
+class SourceCache
+{
+public:
+	// the cache used by Shader and LoadShaders
+	static SourceCache& shared()
+	{
+		static SourceCache instance;
+		return instance;
+	}
+
+	SourceCache() = default;
+	SourceCache(const SourceCache&) = delete;
+	SourceCache& operator=(const SourceCache&) = delete;
+
+	~SourceCache()
+	{
+		clear();
+	}
+
+	// contents of the file at path, false when it cannot be opened
+	bool get(const char* path, std::string_view& source)
+	{
+		long long modified = 0;
+		if (!modificationTime(path, modified))
+			return false;
+
+		std::map<std::string, MappedFile>::iterator it = files.find(path);
+		if (it != files.end())
+		{
+			if (it->second.modified == modified)
+			{
+				source = it->second.view();
+				return true;
+			}
+			unmap(it->second);
+			files.erase(it);
+		}
+
+		MappedFile file;
+		if (!map(path, file))
+			return false;
+		file.modified = modified;
+		source = file.view();
+		files[path] = file;
+		return true;
+	}
+
+	// unmaps every file, views handed out before are invalid afterwards
+	void clear()
+	{
+		for (std::map<std::string, MappedFile>::iterator it = files.begin(); it != files.end(); ++it)
+			unmap(it->second);
+		files.clear();
+	}
+
+private:
+	struct MappedFile
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+		long long modified = 0;
+#ifdef _WIN32
+		HANDLE mapping = NULL;
+#endif
+		std::string_view view() const
+		{
+			return std::string_view(data, size);
+		}
+	};
+
+	std::map<std::string, MappedFile> files;
+
+#ifdef _WIN32
+	static bool modificationTime(const char* path, long long& modified)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+			return false;
+		modified = (static_cast<long long>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	static bool map(const char* path, MappedFile& file)
+	{
+		HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (handle == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size))
+		{
+			CloseHandle(handle);
+			return false;
+		}
+		file.size = static_cast<size_t>(size.QuadPart);
+		// an empty file cannot be mapped and needs no mapping
+		if (file.size > 0)
+		{
+			file.mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (file.mapping != NULL)
+				file.data = static_cast<const char*>(MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0));
+		}
+		CloseHandle(handle);
+		if (file.size > 0 && file.data == nullptr)
+		{
+			if (file.mapping != NULL)
+				CloseHandle(file.mapping);
+			return false;
+		}
+		return true;
+	}
+
+	static void unmap(MappedFile& file)
+	{
+		if (file.data != nullptr)
+			UnmapViewOfFile(file.data);
+		if (file.mapping != NULL)
+			CloseHandle(file.mapping);
+		file.data = nullptr;
+		file.mapping = NULL;
+	}
+#else
+	static bool modificationTime(const char* path, long long& modified)
+	{
+		struct stat status;
+		if (stat(path, &status) != 0)
+			return false;
+		modified = static_cast<long long>(status.st_mtime) * 1000000000LL;
+#ifdef __linux__
+		modified += status.st_mtim.tv_nsec;
+#endif
+		return true;
+	}
+
+	static bool map(const char* path, MappedFile& file)
+	{
+		int descriptor = open(path, O_RDONLY);
+		if (descriptor < 0)
+			return false;
+		struct stat status;
+		if (fstat(descriptor, &status) != 0)
+		{
+			close(descriptor);
+			return false;
+		}
+		file.size = static_cast<size_t>(status.st_size);
+		// an empty file cannot be mapped and needs no mapping
+		if (file.size > 0)
+		{
+			void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			file.data = data == MAP_FAILED ? nullptr : static_cast<const char*>(data);
+		}
+		close(descriptor);
+		return file.size == 0 || file.data != nullptr;
+	}
+
+	static void unmap(MappedFile& file)
+	{
+		if (file.data != nullptr)
+			munmap(const_cast<char*>(file.data), file.size);
+		file.data = nullptr;
+	}
+#endif
+};
+#endif
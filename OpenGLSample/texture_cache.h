@@ -0,0 +1,201 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// GL textures shared by the contents of their image file. Every file is hashed with XXH64; a file whose
+// bytes were loaded before, under any path, gets the texture already created for them with one more
+// reference instead of being decoded and uploaded again. release() deletes the texture with its last
+// reference. The cache does not include a GL loader itself: the functions that create a texture from the
+// file bytes and delete one come from the code that uses it (GLEW or glad).
+// ------------------------------------------------------------------------
+class TextureCache
+{
+public:
+	// creates a texture from the bytes of an image file, false when they cannot be decoded
+	typedef bool (*CreateFunction)(const unsigned char* bytes, size_t size, unsigned int& id);
+	typedef void (*DestroyFunction)(unsigned int id);
+
+	TextureCache(CreateFunction create, DestroyFunction destroy) : create(create), destroy(destroy)
+	{
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// texture of the image file at path, false when the file cannot be read or decoded
+	bool acquire(const char* path, unsigned int& id)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+		const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const Key key(xxh64(bytes.data(), bytes.size()), bytes.size());
+		hashSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		hashedBytes += bytes.size();
+
+		std::map<Key, Entry>::iterator it = entries.find(key);
+		if (it != entries.end())
+		{
+			++it->second.references;
+			++hits;
+			id = it->second.id;
+			return true;
+		}
+
+		++misses;
+		if (!create(bytes.data(), bytes.size(), id))
+			return false;
+		Entry& entry = entries[key];
+		entry.id = id;
+		entry.references = 1;
+		keys[id] = key;
+		return true;
+	}
+
+	// drops one reference to the texture, the last one deletes it; ids the cache did not hand out are
+	// deleted right away
+	void release(unsigned int id)
+	{
+		std::map<unsigned int, Key>::iterator key = keys.find(id);
+		if (key == keys.end())
+		{
+			destroy(id);
+			return;
+		}
+		std::map<Key, Entry>::iterator it = entries.find(key->second);
+		if (--it->second.references > 0)
+			return;
+		destroy(id);
+		entries.erase(it);
+		keys.erase(key);
+	}
+
+	void print(std::ostream& out) const
+	{
+		out << "TEXTURE CACHE: " << hits + misses << " requests, " << hits << " hits, " << misses << " misses, "
+			<< entries.size() << " textures live, " << hashedBytes / (1024.0 * 1024.0) << " MB hashed in "
+			<< hashSeconds * 1000.0 << " ms" << std::endl;
+	}
+
+	// XXH64 of a block of memory
+	static uint64_t xxh64(const void* data, size_t length, uint64_t seed = 0)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		const unsigned char* const end = p + length;
+		uint64_t hash;
+
+		if (length >= 32)
+		{
+			uint64_t v1 = seed + PRIME1 + PRIME2;
+			uint64_t v2 = seed + PRIME2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - PRIME1;
+			const unsigned char* const limit = end - 32;
+			do
+			{
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+				p += 32;
+			} while (p <= limit);
+
+			hash = rotate(v1, 1) + rotate(v2, 7) + rotate(v3, 12) + rotate(v4, 18);
+			hash = mergeRound(hash, v1);
+			hash = mergeRound(hash, v2);
+			hash = mergeRound(hash, v3);
+			hash = mergeRound(hash, v4);
+		}
+		else
+			hash = seed + PRIME5;
+
+		hash += static_cast<uint64_t>(length);
+		for (; p + 8 <= end; p += 8)
+			hash = rotate(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+		if (p + 4 <= end)
+		{
+			hash = rotate(hash ^ (static_cast<uint64_t>(read32(p)) * PRIME1), 23) * PRIME2 + PRIME3;
+			p += 4;
+		}
+		for (; p < end; ++p)
+			hash = rotate(hash ^ (*p * PRIME5), 11) * PRIME1;
+
+		hash ^= hash >> 33;
+		hash *= PRIME2;
+		hash ^= hash >> 29;
+		hash *= PRIME3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
+private:
+	// content hash and size of the file; the size keeps a hash collision between different sizes apart
+	typedef std::pair<uint64_t, size_t> Key;
+
+	struct Entry
+	{
+		unsigned int id = 0;
+		unsigned int references = 0;
+	};
+
+	static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+	static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+	CreateFunction create;
+	DestroyFunction destroy;
+	std::map<Key, Entry> entries;
+	std::map<unsigned int, Key> keys;	// texture id to its entry
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	unsigned long long hashedBytes = 0;
+	double hashSeconds = 0.0;
+
+	static uint64_t rotate(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	// little-endian reads without alignment requirements
+	static uint64_t read64(const unsigned char* p)
+	{
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static uint32_t read32(const unsigned char* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	static uint64_t round(uint64_t accumulator, uint64_t input)
+	{
+		accumulator += input * PRIME2;
+		accumulator = rotate(accumulator, 31);
+		return accumulator * PRIME1;
+	}
+
+	static uint64_t mergeRound(uint64_t hash, uint64_t value)
+	{
+		hash ^= round(0, value);
+		return hash * PRIME1 + PRIME4;
+	}
+};
+#endif
@@ -0,0 +1,545 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Encoders and decoders for the GPU block-compressed formats the texture cooker writes. Every format
+// stores 4x4 texel blocks of RGBA8 input:
+//
+//   BC1   8 bytes, two RGB565 endpoints and 2-bit indices (always the opaque four-colour mode)
+//   BC3   16 bytes, an 8-value alpha block followed by a BC1 colour block
+//   BC7   16 bytes, written in mode 6 only: RGBA 7.7.7.7 endpoints with a p-bit each and 4-bit indices
+//
+// Endpoints come from the principal axis of the block's colours, followed by one least-squares
+// refinement for BC1; good quality for a cooker that runs once, not the best an offline tool can do.
+namespace bc
+{
+    enum Format
+    {
+        FORMAT_BC1,
+        FORMAT_BC3,
+        FORMAT_BC7
+    };
+
+    inline const char* FormatName(Format format)
+    {
+        return format == FORMAT_BC1 ? "BC1" : format == FORMAT_BC3 ? "BC3" : "BC7";
+    }
+
+    inline int BlockBytes(Format format)
+    {
+        return format == FORMAT_BC1 ? 8 : 16;
+    }
+
+    // Bytes of one compressed level; partial blocks at the right and bottom edges are stored whole
+    inline size_t LevelBytes(Format format, int width, int height)
+    {
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+    }
+
+    // Mean and principal axis of count points with channels components each (power iteration on the covariance)
+    inline void principalAxis(const float* points, int count, int channels, float* mean, float* axis)
+    {
+        float covariance[4][4] = {};
+        for (int c = 0; c < channels; ++c)
+        {
+            mean[c] = 0.0f;
+            for (int i = 0; i < count; ++i)
+                mean[c] += points[i * channels + c];
+            mean[c] /= count;
+        }
+        for (int i = 0; i < count; ++i)
+            for (int a = 0; a < channels; ++a)
+                for (int b = 0; b < channels; ++b)
+                    covariance[a][b] += (points[i * channels + a] - mean[a]) * (points[i * channels + b] - mean[b]);
+
+        for (int c = 0; c < channels; ++c)
+            axis[c] = 1.0f;
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = {};
+            float length = 0.0f;
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                    next[a] += covariance[a][b] * axis[b];
+                length += next[a] * next[a];
+            }
+            if (length < 1e-12f)
+                break;  // Flat block, any axis does
+            length = std::sqrt(length);
+            for (int c = 0; c < channels; ++c)
+                axis[c] = next[c] / length;
+        }
+    }
+
+    // Extremes of the points projected on the axis through mean
+    inline void axisEndpoints(const float* points, int count, int channels, const float* mean, const float* axis, float* low, float* high)
+    {
+        float minimum = 1e30f;
+        float maximum = -1e30f;
+        for (int i = 0; i < count; ++i)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < channels; ++c)
+                t += (points[i * channels + c] - mean[c]) * axis[c];
+            minimum = t < minimum ? t : minimum;
+            maximum = t > maximum ? t : maximum;
+        }
+        for (int c = 0; c < channels; ++c)
+        {
+            low[c] = mean[c] + axis[c] * minimum;
+            high[c] = mean[c] + axis[c] * maximum;
+        }
+    }
+
+    inline int clampInt(int value, int low, int high)
+    {
+        return value < low ? low : value > high ? high : value;
+    }
+
+    inline uint16_t pack565(const float* color)
+    {
+        const int r = clampInt(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+        const int g = clampInt(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+        const int b = clampInt(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpack565(uint16_t value, int* color)
+    {
+        const int r = (value >> 11) & 31;
+        const int g = (value >> 5) & 63;
+        const int b = value & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // Four-colour palette of two 565 endpoints
+    inline void colorPalette(uint16_t color0, uint16_t color1, int palette[4][3])
+    {
+        unpack565(color0, palette[0]);
+        unpack565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+    }
+
+    // Nearest palette entry of every texel, returns the total squared error
+    inline int colorIndices(const float* points, uint16_t color0, uint16_t color1, int* indices)
+    {
+        int palette[4][3];
+        colorPalette(color0, color1, palette);
+        int total = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            int bestError = 1 << 30;
+            for (int p = 0; p < 4; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const int difference = static_cast<int>(points[i * 3 + c]) - palette[p][c];
+                    error += difference * difference;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices[i] = best;
+            total += bestError;
+        }
+        return total;
+    }
+
+    // Endpoints in four-colour order (color0 > color1); equal endpoints keep every index at 0
+    inline void orderEndpoints(uint16_t& color0, uint16_t& color1)
+    {
+        if (color0 < color1)
+        {
+            const uint16_t swap = color0;
+            color0 = color1;
+            color1 = swap;
+        }
+    }
+
+    // BC1 colour block of 16 RGBA texels, also the colour half of BC3
+    inline void EncodeColorBlock(const unsigned char* texels, unsigned char* block)
+    {
+        float points[16 * 3];
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c)
+                points[i * 3 + c] = texels[i * 4 + c];
+
+        float mean[3];
+        float axis[3];
+        float low[3];
+        float high[3];
+        principalAxis(points, 16, 3, mean, axis);
+        axisEndpoints(points, 16, 3, mean, axis, low, high);
+
+        // Pull the endpoints in a little, the extremes are rarely hit exactly after quantization
+        for (int c = 0; c < 3; ++c)
+        {
+            const float inset = (high[c] - low[c]) / 16.0f;
+            low[c] += inset;
+            high[c] -= inset;
+        }
+
+        uint16_t color0 = pack565(high);
+        uint16_t color1 = pack565(low);
+        orderEndpoints(color0, color1);
+        int indices[16];
+        int error = color0 == color1 ? 0 : colorIndices(points, color0, color1, indices);
+        if (color0 == color1)
+            memset(indices, 0, sizeof(indices));
+
+        // One least-squares pass: the endpoints that best fit the chosen indices
+        if (color0 != color1)
+        {
+            static const float WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[3] = {};
+            float bx[3] = {};
+            for (int i = 0; i < 16; ++i)
+            {
+                const float a = WEIGHTS[indices[i]];
+                const float b = 1.0f - a;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < 3; ++c)
+                {
+                    ax[c] += a * points[i * 3 + c];
+                    bx[c] += b * points[i * 3 + c];
+                }
+            }
+            const float determinant = aa * bb - ab * ab;
+            if (std::fabs(determinant) > 1e-6f)
+            {
+                float refined0[3];
+                float refined1[3];
+                for (int c = 0; c < 3; ++c)
+                {
+                    refined0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+                    refined1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+                }
+                uint16_t refinedColor0 = pack565(refined0);
+                uint16_t refinedColor1 = pack565(refined1);
+                orderEndpoints(refinedColor0, refinedColor1);
+                if (refinedColor0 != refinedColor1)
+                {
+                    int refinedIndices[16];
+                    const int refinedError = colorIndices(points, refinedColor0, refinedColor1, refinedIndices);
+                    if (refinedError < error)
+                    {
+                        color0 = refinedColor0;
+                        color1 = refinedColor1;
+                        memcpy(indices, refinedIndices, sizeof(indices));
+                    }
+                }
+            }
+        }
+
+        block[0] = static_cast<unsigned char>(color0 & 0xFF);
+        block[1] = static_cast<unsigned char>(color0 >> 8);
+        block[2] = static_cast<unsigned char>(color1 & 0xFF);
+        block[3] = static_cast<unsigned char>(color1 >> 8);
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+        for (int i = 0; i < 4; ++i)
+            block[4 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    // BC3 alpha block: the alpha range in eight steps
+    inline void EncodeAlphaBlock(const unsigned char* texels, unsigned char* block)
+    {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (int i = 0; i < 16; ++i)
+        {
+            alpha0 = texels[i * 4 + 3] > alpha0 ? texels[i * 4 + 3] : alpha0;
+            alpha1 = texels[i * 4 + 3] < alpha1 ? texels[i * 4 + 3] : alpha1;
+        }
+        block[0] = static_cast<unsigned char>(alpha0);
+        block[1] = static_cast<unsigned char>(alpha1);
+
+        uint64_t bits = 0;
+        if (alpha0 != alpha1)
+        {
+            int palette[8] = { alpha0, alpha1 };
+            for (int p = 1; p < 7; ++p)
+                palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+            for (int i = 0; i < 16; ++i)
+            {
+                int best = 0;
+                for (int p = 1; p < 8; ++p)
+                    if (std::abs(palette[p] - texels[i * 4 + 3]) < std::abs(palette[best] - texels[i * 4 + 3]))
+                        best = p;
+                bits |= static_cast<uint64_t>(best) << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; ++i)
+            block[2 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    // 4-bit interpolation weights of BC7
+    static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    inline int bc7Interpolate(int endpoint0, int endpoint1, int weight)
+    {
+        return ((64 - weight) * endpoint0 + weight * endpoint1 + 32) >> 6;
+    }
+
+    // Appends bits to a 128-bit little-endian block
+    inline void putBits(unsigned char* block, int& position, uint32_t value, int count)
+    {
+        for (int i = 0; i < count; ++i, ++position)
+            if ((value >> i) & 1)
+                block[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+    }
+
+    inline uint32_t getBits(const unsigned char* block, int& position, int count)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i, ++position)
+            value |= static_cast<uint32_t>((block[position >> 3] >> (position & 7)) & 1) << i;
+        return value;
+    }
+
+    // 7-bit channels and the p-bit that quantize an RGBA endpoint best
+    inline void quantizeBC7Endpoint(const float* endpoint, int* quantized, int& pBit)
+    {
+        float bestError = 1e30f;
+        for (int p = 0; p < 2; ++p)
+        {
+            int candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c)
+            {
+                candidate[c] = clampInt(static_cast<int>((endpoint[c] - p) / 2.0f + 0.5f), 0, 127);
+                const float difference = endpoint[c] - ((candidate[c] << 1) | p);
+                error += difference * difference;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pBit = p;
+                memcpy(quantized, candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    inline void EncodeBC7Block(const unsigned char* texels, unsigned char* block)
+    {
+        float points[16 * 4];
+        for (int i = 0; i < 64; ++i)
+            points[i] = texels[i];
+
+        float mean[4];
+        float axis[4];
+        float low[4];
+        float high[4];
+        principalAxis(points, 16, 4, mean, axis);
+        axisEndpoints(points, 16, 4, mean, axis, low, high);
+
+        int quantized[2][4];
+        int pBits[2];
+        quantizeBC7Endpoint(low, quantized[0], pBits[0]);
+        quantizeBC7Endpoint(high, quantized[1], pBits[1]);
+
+        int endpoints[2][4];
+        for (int e = 0; e < 2; ++e)
+            for (int c = 0; c < 4; ++c)
+                endpoints[e][c] = (quantized[e][c] << 1) | pBits[e];
+
+        int indices[16];
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            int bestError = 1 << 30;
+            for (int w = 0; w < 16; ++w)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; ++c)
+                {
+                    const int difference = texels[i * 4 + c] - bc7Interpolate(endpoints[0][c], endpoints[1][c], BC7_WEIGHTS[w]);
+                    error += difference * difference;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = w;
+                }
+            }
+            indices[i] = best;
+        }
+
+        // The first index is stored without its top bit, so it has to be below 8
+        if (indices[0] >= 8)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                const int swap = quantized[0][c];
+                quantized[0][c] = quantized[1][c];
+                quantized[1][c] = swap;
+            }
+            const int swap = pBits[0];
+            pBits[0] = pBits[1];
+            pBits[1] = swap;
+            for (int i = 0; i < 16; ++i)
+                indices[i] = 15 - indices[i];
+        }
+
+        memset(block, 0, 16);
+        int position = 0;
+        putBits(block, position, 1 << 6, 7);    // Mode 6
+        for (int c = 0; c < 4; ++c)
+        {
+            putBits(block, position, quantized[0][c], 7);
+            putBits(block, position, quantized[1][c], 7);
+        }
+        putBits(block, position, pBits[0], 1);
+        putBits(block, position, pBits[1], 1);
+        for (int i = 0; i < 16; ++i)
+            putBits(block, position, indices[i], i == 0 ? 3 : 4);
+    }
+
+    inline void DecodeColorBlock(const unsigned char* block, unsigned char* texels)
+    {
+        int palette[4][3];
+        colorPalette(static_cast<uint16_t>(block[0] | (block[1] << 8)), static_cast<uint16_t>(block[2] | (block[3] << 8)), palette);
+        const uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) | (static_cast<uint32_t>(block[7]) << 24);
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 3; ++c)
+                texels[i * 4 + c] = static_cast<unsigned char>(palette[(bits >> (2 * i)) & 3][c]);
+    }
+
+    inline void DecodeAlphaBlock(const unsigned char* block, unsigned char* texels)
+    {
+        const int alpha0 = block[0];
+        const int alpha1 = block[1];
+        int palette[8] = { alpha0, alpha1 };
+        if (alpha0 > alpha1)
+        {
+            for (int p = 1; p < 7; ++p)
+                palette[p + 1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+        }
+        else
+        {
+            for (int p = 1; p < 5; ++p)
+                palette[p + 1] = ((5 - p) * alpha0 + p * alpha1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; ++i)
+            bits |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+        for (int i = 0; i < 16; ++i)
+            texels[i * 4 + 3] = static_cast<unsigned char>(palette[(bits >> (3 * i)) & 7]);
+    }
+
+    // Decodes mode 6 blocks, the only mode the cooker writes; other modes come out magenta
+    inline void DecodeBC7Block(const unsigned char* block, unsigned char* texels)
+    {
+        int position = 0;
+        if (getBits(block, position, 7) != (1 << 6))
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                texels[i * 4] = 255;
+                texels[i * 4 + 1] = 0;
+                texels[i * 4 + 2] = 255;
+                texels[i * 4 + 3] = 255;
+            }
+            return;
+        }
+        int quantized[2][4];
+        for (int c = 0; c < 4; ++c)
+        {
+            quantized[0][c] = getBits(block, position, 7);
+            quantized[1][c] = getBits(block, position, 7);
+        }
+        const int pBit0 = getBits(block, position, 1);
+        const int pBit1 = getBits(block, position, 1);
+        for (int i = 0; i < 16; ++i)
+        {
+            const int index = getBits(block, position, i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; ++c)
+                texels[i * 4 + c] = static_cast<unsigned char>(bc7Interpolate((quantized[0][c] << 1) | pBit0, (quantized[1][c] << 1) | pBit1, BC7_WEIGHTS[index]));
+        }
+    }
+
+    // Compresses one RGBA8 level; edge blocks repeat the last row and column
+    inline void CompressLevel(Format format, const unsigned char* pixels, int width, int height, unsigned char* output)
+    {
+        unsigned char texels[16 * 4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                for (int y = 0; y < 4; ++y)
+                {
+                    const int row = by + y < height ? by + y : height - 1;
+                    for (int x = 0; x < 4; ++x)
+                    {
+                        const int column = bx + x < width ? bx + x : width - 1;
+                        memcpy(texels + (y * 4 + x) * 4, pixels + (static_cast<size_t>(row) * width + column) * 4, 4);
+                    }
+                }
+                if (format == FORMAT_BC1)
+                    EncodeColorBlock(texels, output);
+                else if (format == FORMAT_BC3)
+                {
+                    EncodeAlphaBlock(texels, output);
+                    EncodeColorBlock(texels, output + 8);
+                }
+                else
+                    EncodeBC7Block(texels, output);
+                output += BlockBytes(format);
+            }
+        }
+    }
+
+    // Back to RGBA8 (BC1 alpha comes out opaque)
+    inline void DecompressLevel(Format format, const unsigned char* blocks, int width, int height, unsigned char* pixels)
+    {
+        unsigned char texels[16 * 4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                if (format == FORMAT_BC1)
+                {
+                    DecodeColorBlock(blocks, texels);
+                    for (int i = 0; i < 16; ++i)
+                        texels[i * 4 + 3] = 255;
+                }
+                else if (format == FORMAT_BC3)
+                {
+                    DecodeAlphaBlock(blocks, texels);
+                    DecodeColorBlock(blocks + 8, texels);
+                }
+                else
+                    DecodeBC7Block(blocks, texels);
+                blocks += BlockBytes(format);
+
+                for (int y = 0; y < 4 && by + y < height; ++y)
+                    for (int x = 0; x < 4 && bx + x < width; ++x)
+                        memcpy(pixels + (static_cast<size_t>(by + y) * width + bx + x) * 4, texels + (y * 4 + x) * 4, 4);
+            }
+        }
+    }
+}
+
+#endif
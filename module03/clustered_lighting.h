@@ -0,0 +1,463 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// SSE is used to test four lights against a cluster at once when the target supports it
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CLUSTERED_LIGHTING_SSE 1
+#endif
+
+// Point light, same members as PointLight in 6.multiple_lights.fs
+struct PointLight {
+    glm::vec3 position;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+// Spot light, same members as SpotLight in 6.multiple_lights.fs (cut-offs are cosines)
+struct SpotLight {
+    glm::vec3 position;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+// Divides the view frustum into a 3D grid of clusters, assigns lights to them on the CPU
+// and publishes the per-cluster light lists to the fragment shader through SSBO ranges of the frame's ring buffer
+class ClusteredLighting
+{
+public:
+    // Cluster grid resolution (screen tiles in x/y, exponential depth slices in z)
+    static const unsigned int CLUSTERS_X = 16;
+    static const unsigned int CLUSTERS_Y = 9;
+    static const unsigned int CLUSTERS_Z = 24;
+    static const unsigned int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+    // Upper bound of a cluster's light list. A crowded cluster keeps the lights closest to its centre relative to
+    // their range, which bounds both the shading loop and the index list (CLUSTER_COUNT * 64 * 4 bytes = 864 KB).
+    static const unsigned int MAX_LIGHTS_PER_CLUSTER = 64;
+
+    // Ring bytes one Update can take for the given light counts, including the padding of four ranges aligned to
+    // at most 256 bytes; the ring region has to be at least this large
+    static GLsizeiptr MaxRingBytes(size_t pointLights, size_t spotLights)
+    {
+        const size_t padding = 4 * 256;
+        return static_cast<GLsizeiptr>(std::max<size_t>(sizeof(GPUPointLight) * pointLights, 16) + std::max<size_t>(sizeof(GPUSpotLight) * spotLights, 16) +
+            sizeof(GLuint) * CLUSTER_COUNT * 4 + sizeof(GLuint) * CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER + padding);
+    }
+
+    // SSBO binding points, must match the layout qualifiers in the clustered fragment shader
+    static const GLuint POINT_LIGHT_BINDING = 2;
+    static const GLuint SPOT_LIGHT_BINDING = 3;
+    static const GLuint CLUSTER_GRID_BINDING = 4;
+    static const GLuint LIGHT_INDEX_BINDING = 5;
+
+    std::vector<PointLight> PointLights;
+    std::vector<SpotLight> SpotLights;
+
+    ClusteredLighting() : nearPlane(0.0f), farPlane(0.0f), viewportWidth(0), viewportHeight(0), cachedProjection(0.0f), lightCount(0)
+    {
+    }
+
+    // Rebuilds the cluster bounds when the projection changed, assigns every light to the clusters it touches
+    // and writes the lights and light lists for this frame into the ring buffer. Returns false when the ring
+    // region had no room for them, Bind must not be called and the clustered pass has to be skipped then.
+    bool Update(const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar, int width, int height, PersistentRingBuffer& ring)
+    {
+        if (zNear != nearPlane || zFar != farPlane || width != viewportWidth || height != viewportHeight || !sameMatrix(projection, cachedProjection))
+        {
+            nearPlane = zNear;
+            farPlane = zFar;
+            viewportWidth = width;
+            viewportHeight = height;
+            cachedProjection = projection;
+            buildClusterBounds(projection);
+        }
+
+        gatherViewSpaceBounds(view);
+        assignLights();
+        return upload(ring);
+    }
+
+    // Binds this frame's light and cluster ranges to their SSBO binding points
+    void Bind(const PersistentRingBuffer& ring) const
+    {
+        ring.BindRange(GL_SHADER_STORAGE_BUFFER, POINT_LIGHT_BINDING, pointLightRange);
+        ring.BindRange(GL_SHADER_STORAGE_BUFFER, SPOT_LIGHT_BINDING, spotLightRange);
+        ring.BindRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, clusterGridRange);
+        ring.BindRange(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_BINDING, lightIndexRange);
+    }
+
+    // Cluster lookup parameters for the fragment shader: tile width, tile height, slice scale and slice bias
+    // (slice = log(depth) * scale - bias)
+    glm::vec4 LookupParameters() const
+    {
+        if (nearPlane <= 0.0f)
+            return glm::vec4(0.0f); // Update has not run yet
+
+        const float logDepthRatio = std::log(farPlane / nearPlane);
+        const float sliceScale = CLUSTERS_Z / logDepthRatio;
+        const float sliceBias = CLUSTERS_Z * std::log(nearPlane) / logDepthRatio;
+        return glm::vec4(tileWidth(), tileHeight(), sliceScale, sliceBias);
+    }
+
+    // Number of light indices written during the last update, useful to judge the light density
+    size_t LightIndexCount() const
+    {
+        return lightIndices.size();
+    }
+
+private:
+    // GPU layouts (std430), the scalar members are packed into the w components
+    struct GPUPointLight {
+        glm::vec4 position;     // w = constant
+        glm::vec4 ambient;      // w = linear
+        glm::vec4 diffuse;      // w = quadratic
+        glm::vec4 specular;     // w = range
+    };
+
+    struct GPUSpotLight {
+        glm::vec4 position;     // w = constant
+        glm::vec4 direction;    // w = cutOff
+        glm::vec4 ambient;      // w = outerCutOff
+        glm::vec4 diffuse;      // w = linear
+        glm::vec4 specular;     // w = quadratic
+    };
+
+    // View space axis aligned bounds of one cluster
+    struct ClusterBounds {
+        glm::vec3 minPoint;
+        glm::vec3 maxPoint;
+    };
+
+    PersistentRingBuffer::Allocation pointLightRange;
+    PersistentRingBuffer::Allocation spotLightRange;
+    PersistentRingBuffer::Allocation clusterGridRange;
+    PersistentRingBuffer::Allocation lightIndexRange;
+
+    float nearPlane;
+    float farPlane;
+    int viewportWidth;
+    int viewportHeight;
+    glm::mat4 cachedProjection;
+
+    std::vector<ClusterBounds> clusterBounds;
+
+    // Light bounding spheres in view space, stored as structure of arrays for the SIMD test (points first, then spots)
+    std::vector<float> lightX, lightY, lightZ, lightRadiusSq;
+    std::vector<float> lightRadius;
+    unsigned int lightCount;
+
+    std::vector<GLuint> clusterGrid;    // offset, point count, spot count, unused
+    std::vector<GLuint> lightIndices;
+    std::vector<unsigned int> sliceLights;
+    std::vector<std::pair<float, GLuint> > rankedLights;
+
+    float tileWidth() const
+    {
+        return std::ceil(float(viewportWidth) / CLUSTERS_X);
+    }
+
+    float tileHeight() const
+    {
+        return std::ceil(float(viewportHeight) / CLUSTERS_Y);
+    }
+
+    static bool sameMatrix(const glm::mat4& a, const glm::mat4& b)
+    {
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                if (a[c][r] != b[c][r])
+                    return false;
+        return true;
+    }
+
+    // Depth of the near side of a slice, slices are spaced exponentially
+    float sliceDepth(unsigned int slice) const
+    {
+        return nearPlane * std::pow(farPlane / nearPlane, float(slice) / CLUSTERS_Z);
+    }
+
+    // Distance at which the light's attenuation drops its brightest channel below 5/256
+    static float lightRange(float constant, float linear, float quadratic, const glm::vec3& diffuse)
+    {
+        const float brightest = std::max(std::max(diffuse.r, diffuse.g), diffuse.b);
+        const float cutoff = brightest * 256.0f / 5.0f;
+        if (quadratic > 0.0f)
+            return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * (constant - cutoff))) / (2.0f * quadratic);
+        if (linear > 0.0f)
+            return (cutoff - constant) / linear;
+        return 1.0e6f;
+    }
+
+    // Point on the line through nearPoint and farPoint that lies at the given view depth (z = -depth)
+    static glm::vec3 pointAtDepth(const glm::vec3& nearPoint, const glm::vec3& farPoint, float depth)
+    {
+        const float t = (-depth - nearPoint.z) / (farPoint.z - nearPoint.z);
+        return nearPoint + (farPoint - nearPoint) * t;
+    }
+
+    static glm::vec3 unproject(const glm::mat4& inverseProjection, float x, float y, float z)
+    {
+        glm::vec4 p = inverseProjection * glm::vec4(x, y, z, 1.0f);
+        return glm::vec3(p.x / p.w, p.y / p.w, p.z / p.w);
+    }
+
+    // Computes the view space AABB of every cluster; works for both perspective and orthographic projections
+    void buildClusterBounds(const glm::mat4& projection)
+    {
+        const glm::mat4 inverseProjection = glm::inverse(projection);
+        clusterBounds.resize(CLUSTER_COUNT);
+
+        for (unsigned int z = 0; z < CLUSTERS_Z; ++z)
+        {
+            const float depthNear = sliceDepth(z);
+            const float depthFar = sliceDepth(z + 1);
+
+            for (unsigned int y = 0; y < CLUSTERS_Y; ++y)
+            {
+                for (unsigned int x = 0; x < CLUSTERS_X; ++x)
+                {
+                    // Tile corners in NDC (tiles are sized in pixels, the last column/row may overhang)
+                    const float x0 = 2.0f * (x * tileWidth()) / viewportWidth - 1.0f;
+                    const float x1 = 2.0f * ((x + 1) * tileWidth()) / viewportWidth - 1.0f;
+                    const float y0 = 2.0f * (y * tileHeight()) / viewportHeight - 1.0f;
+                    const float y1 = 2.0f * ((y + 1) * tileHeight()) / viewportHeight - 1.0f;
+
+                    ClusterBounds& bounds = clusterBounds[x + CLUSTERS_X * (y + CLUSTERS_Y * z)];
+                    bounds.minPoint = glm::vec3(1.0e30f);
+                    bounds.maxPoint = glm::vec3(-1.0e30f);
+
+                    const float cornersX[2] = { x0, x1 };
+                    const float cornersY[2] = { y0, y1 };
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        for (int j = 0; j < 2; ++j)
+                        {
+                            const glm::vec3 nearPoint = unproject(inverseProjection, cornersX[i], cornersY[j], -1.0f);
+                            const glm::vec3 farPoint = unproject(inverseProjection, cornersX[i], cornersY[j], 1.0f);
+                            const glm::vec3 a = pointAtDepth(nearPoint, farPoint, depthNear);
+                            const glm::vec3 b = pointAtDepth(nearPoint, farPoint, depthFar);
+                            bounds.minPoint = glm::min(bounds.minPoint, glm::min(a, b));
+                            bounds.maxPoint = glm::max(bounds.maxPoint, glm::max(a, b));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Transforms the light bounding spheres into view space
+    void gatherViewSpaceBounds(const glm::mat4& view)
+    {
+        lightCount = static_cast<unsigned int>(PointLights.size() + SpotLights.size());
+        lightX.resize(lightCount);
+        lightY.resize(lightCount);
+        lightZ.resize(lightCount);
+        lightRadiusSq.resize(lightCount);
+        lightRadius.resize(lightCount);
+
+        unsigned int index = 0;
+        for (size_t i = 0; i < PointLights.size(); ++i, ++index)
+        {
+            const PointLight& light = PointLights[i];
+            storeBounds(index, view * glm::vec4(light.position, 1.0f), lightRange(light.constant, light.linear, light.quadratic, light.diffuse));
+        }
+        for (size_t i = 0; i < SpotLights.size(); ++i, ++index)
+        {
+            const SpotLight& light = SpotLights[i];
+            storeBounds(index, view * glm::vec4(light.position, 1.0f), lightRange(light.constant, light.linear, light.quadratic, light.diffuse));
+        }
+    }
+
+    void storeBounds(unsigned int index, const glm::vec4& viewPosition, float radius)
+    {
+        lightX[index] = viewPosition.x;
+        lightY[index] = viewPosition.y;
+        lightZ[index] = viewPosition.z;
+        lightRadius[index] = radius;
+        lightRadiusSq[index] = radius * radius;
+    }
+
+    // Builds the per-cluster light lists. Lights are first binned by depth slice so each cluster only tests
+    // the lights overlapping its slice, then tested four at a time against the cluster AABB.
+    void assignLights()
+    {
+        clusterGrid.assign(CLUSTER_COUNT * 4, 0);
+        lightIndices.clear();
+
+        const unsigned int pointCount = static_cast<unsigned int>(PointLights.size());
+
+        for (unsigned int z = 0; z < CLUSTERS_Z; ++z)
+        {
+            const float depthNear = sliceDepth(z);
+            const float depthFar = sliceDepth(z + 1);
+
+            sliceLights.clear();
+            for (unsigned int i = 0; i < lightCount; ++i)
+            {
+                const float depth = -lightZ[i];
+                if (depth + lightRadius[i] >= depthNear && depth - lightRadius[i] <= depthFar)
+                    sliceLights.push_back(i);
+            }
+
+            for (unsigned int y = 0; y < CLUSTERS_Y; ++y)
+            {
+                for (unsigned int x = 0; x < CLUSTERS_X; ++x)
+                {
+                    const unsigned int cluster = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+                    const ClusterBounds& bounds = clusterBounds[cluster];
+                    const GLuint offset = static_cast<GLuint>(lightIndices.size());
+
+                    testCluster(bounds);
+                    if (lightIndices.size() - offset > MAX_LIGHTS_PER_CLUSTER)
+                        keepClosestLights(bounds, offset);
+
+                    // Lights were pushed in ascending order, so the spot lights are at the end of the list
+                    GLuint spots = 0;
+                    for (size_t i = offset; i < lightIndices.size(); ++i)
+                    {
+                        if (lightIndices[i] >= pointCount)
+                        {
+                            lightIndices[i] -= pointCount;
+                            ++spots;
+                        }
+                    }
+
+                    clusterGrid[cluster * 4 + 0] = offset;
+                    clusterGrid[cluster * 4 + 1] = static_cast<GLuint>(lightIndices.size()) - offset - spots;
+                    clusterGrid[cluster * 4 + 2] = spots;
+                }
+            }
+        }
+    }
+
+    // Appends the indices of the lights of the current slice whose sphere touches the cluster AABB
+    void testCluster(const ClusterBounds& bounds)
+    {
+        size_t i = 0;
+#ifdef CLUSTERED_LIGHTING_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 minX = _mm_set1_ps(bounds.minPoint.x), maxX = _mm_set1_ps(bounds.maxPoint.x);
+        const __m128 minY = _mm_set1_ps(bounds.minPoint.y), maxY = _mm_set1_ps(bounds.maxPoint.y);
+        const __m128 minZ = _mm_set1_ps(bounds.minPoint.z), maxZ = _mm_set1_ps(bounds.maxPoint.z);
+
+        for (; i + 4 <= sliceLights.size(); i += 4)
+        {
+            const unsigned int* ids = &sliceLights[i];
+            const __m128 px = _mm_setr_ps(lightX[ids[0]], lightX[ids[1]], lightX[ids[2]], lightX[ids[3]]);
+            const __m128 py = _mm_setr_ps(lightY[ids[0]], lightY[ids[1]], lightY[ids[2]], lightY[ids[3]]);
+            const __m128 pz = _mm_setr_ps(lightZ[ids[0]], lightZ[ids[1]], lightZ[ids[2]], lightZ[ids[3]]);
+            const __m128 r2 = _mm_setr_ps(lightRadiusSq[ids[0]], lightRadiusSq[ids[1]], lightRadiusSq[ids[2]], lightRadiusSq[ids[3]]);
+
+            // Distance from the sphere centre to the box, per axis
+            const __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, px), zero), _mm_max_ps(_mm_sub_ps(px, maxX), zero));
+            const __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, py), zero), _mm_max_ps(_mm_sub_ps(py, maxY), zero));
+            const __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minZ, pz), zero), _mm_max_ps(_mm_sub_ps(pz, maxZ), zero));
+            const __m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+            const int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, r2));
+            for (int lane = 0; lane < 4; ++lane)
+                if (mask & (1 << lane))
+                    lightIndices.push_back(ids[lane]);
+        }
+#endif
+        for (; i < sliceLights.size(); ++i)
+        {
+            const unsigned int id = sliceLights[i];
+            const float dx = std::max(bounds.minPoint.x - lightX[id], 0.0f) + std::max(lightX[id] - bounds.maxPoint.x, 0.0f);
+            const float dy = std::max(bounds.minPoint.y - lightY[id], 0.0f) + std::max(lightY[id] - bounds.maxPoint.y, 0.0f);
+            const float dz = std::max(bounds.minPoint.z - lightZ[id], 0.0f) + std::max(lightZ[id] - bounds.maxPoint.z, 0.0f);
+            if (dx * dx + dy * dy + dz * dz <= lightRadiusSq[id])
+                lightIndices.push_back(id);
+        }
+    }
+
+    // Trims the light list of a cluster starting at offset to MAX_LIGHTS_PER_CLUSTER entries, keeping the lights whose
+    // centre is closest to the cluster centre in units of their range. The kept indices stay in ascending order.
+    void keepClosestLights(const ClusterBounds& bounds, size_t offset)
+    {
+        const glm::vec3 centre = (bounds.minPoint + bounds.maxPoint) * 0.5f;
+
+        rankedLights.clear();
+        for (size_t i = offset; i < lightIndices.size(); ++i)
+        {
+            const GLuint id = lightIndices[i];
+            const glm::vec3 toLight = glm::vec3(lightX[id], lightY[id], lightZ[id]) - centre;
+            rankedLights.push_back(std::make_pair(glm::dot(toLight, toLight) / lightRadiusSq[id], id));
+        }
+        std::nth_element(rankedLights.begin(), rankedLights.begin() + MAX_LIGHTS_PER_CLUSTER, rankedLights.end());
+
+        lightIndices.resize(offset);
+        for (unsigned int i = 0; i < MAX_LIGHTS_PER_CLUSTER; ++i)
+            lightIndices.push_back(rankedLights[i].second);
+        std::sort(lightIndices.begin() + offset, lightIndices.end());
+    }
+
+    // Writes the packed lights, the cluster grid and the light index list straight into the mapped ring buffer
+    // (empty arrays still get a small range, zero sized SSBO bindings are invalid)
+    bool upload(PersistentRingBuffer& ring)
+    {
+        pointLightRange = ring.AllocateStorage(std::max<size_t>(sizeof(GPUPointLight) * PointLights.size(), 16));
+        spotLightRange = ring.AllocateStorage(std::max<size_t>(sizeof(GPUSpotLight) * SpotLights.size(), 16));
+        clusterGridRange = ring.AllocateStorage(sizeof(GLuint) * clusterGrid.size());
+        lightIndexRange = ring.AllocateStorage(std::max<size_t>(sizeof(GLuint) * lightIndices.size(), 16));
+        if (!pointLightRange.Valid() || !spotLightRange.Valid() || !clusterGridRange.Valid() || !lightIndexRange.Valid())
+            return false;
+
+        GPUPointLight* points = static_cast<GPUPointLight*>(pointLightRange.data);
+        for (size_t i = 0; i < PointLights.size(); ++i)
+        {
+            const PointLight& light = PointLights[i];
+            points[i].position = glm::vec4(light.position, light.constant);
+            points[i].ambient = glm::vec4(light.ambient, light.linear);
+            points[i].diffuse = glm::vec4(light.diffuse, light.quadratic);
+            points[i].specular = glm::vec4(light.specular, lightRadius[i]);
+        }
+
+        GPUSpotLight* spots = static_cast<GPUSpotLight*>(spotLightRange.data);
+        for (size_t i = 0; i < SpotLights.size(); ++i)
+        {
+            const SpotLight& light = SpotLights[i];
+            spots[i].position = glm::vec4(light.position, light.constant);
+            spots[i].direction = glm::vec4(light.direction, light.cutOff);
+            spots[i].ambient = glm::vec4(light.ambient, light.outerCutOff);
+            spots[i].diffuse = glm::vec4(light.diffuse, light.linear);
+            spots[i].specular = glm::vec4(light.specular, light.quadratic);
+        }
+
+        memcpy(clusterGridRange.data, clusterGrid.data(), sizeof(GLuint) * clusterGrid.size());
+
+        if (!lightIndices.empty())
+            memcpy(lightIndexRange.data, lightIndices.data(), sizeof(GLuint) * lightIndices.size());
+        return true;
+    }
+};
+
+#endif
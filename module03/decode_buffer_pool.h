@@ -0,0 +1,148 @@
+#ifndef DECODE_BUFFER_POOL_H
+#define DECODE_BUFFER_POOL_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+// Reusable memory for the image decoder, wired into stb_image through STBI_MALLOC, STBI_REALLOC and
+// STBI_FREE. Blocks are rounded up to a power of two and a freed block goes back on the free list of its
+// size, so decoding one texture after another (or on several threads) reuses the pixel and zlib buffers
+// of the previous ones instead of going back to the system allocator. Trim hands the idle blocks back
+// once loading is done.
+class DecodeBufferPool
+{
+public:
+    static DecodeBufferPool& Shared()
+    {
+        static DecodeBufferPool instance;
+        return instance;
+    }
+
+    ~DecodeBufferPool()
+    {
+        Trim();
+    }
+
+    // NULL when the request is larger than the biggest size class (2^39 bytes) or the system is out of memory
+    void* Allocate(size_t size)
+    {
+        const int sizeClass = classOf(size);
+        if (sizeClass >= SIZE_CLASSES)
+            return NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++allocations;
+            if (!idle[sizeClass].empty())
+            {
+                Header* header = idle[sizeClass].back();
+                idle[sizeClass].pop_back();
+                idleBytes -= capacityOf(sizeClass);
+                ++reused;
+                return header + 1;
+            }
+        }
+
+        Header* header = static_cast<Header*>(malloc(sizeof(Header) + capacityOf(sizeClass)));
+        if (header == NULL)
+            return NULL;
+        header->sizeClass = sizeClass;
+        return header + 1;
+    }
+
+    void* Reallocate(void* block, size_t size)
+    {
+        if (block == NULL)
+            return Allocate(size);
+        const size_t capacity = capacityOf(headerOf(block)->sizeClass);
+        if (size <= capacity)
+            return block;
+
+        void* grown = Allocate(size);
+        if (grown == NULL)
+            return NULL;
+        memcpy(grown, block, capacity);
+        Free(block);
+        return grown;
+    }
+
+    void Free(void* block)
+    {
+        if (block == NULL)
+            return;
+        Header* header = headerOf(block);
+        std::lock_guard<std::mutex> lock(mutex);
+        idle[header->sizeClass].push_back(header);
+        idleBytes += capacityOf(header->sizeClass);
+        if (idleBytes > peakIdleBytes)
+            peakIdleBytes = idleBytes;
+    }
+
+    // Returns every idle block to the system
+    void Trim()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < SIZE_CLASSES; ++i)
+        {
+            for (size_t j = 0; j < idle[i].size(); ++j)
+                free(idle[i][j]);
+            idle[i].clear();
+        }
+        idleBytes = 0;
+    }
+
+    void Print(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "INFO: Decode buffer pool: " << allocations << " allocations, " << reused << " reused, "
+            << peakIdleBytes / (1024.0 * 1024.0) << " MB peak idle" << std::endl;
+    }
+
+private:
+    static const int MIN_CLASS = 6;         // 64 bytes
+    static const int SIZE_CLASSES = 40;
+
+    // Keeps the returned memory 16-byte aligned
+    struct Header
+    {
+        int sizeClass;
+        char padding[16 - sizeof(int)];
+    };
+
+    std::mutex mutex;
+    std::vector<Header*> idle[SIZE_CLASSES];
+    size_t idleBytes;
+    size_t peakIdleBytes;
+    int allocations;
+    int reused;
+
+    DecodeBufferPool() : idleBytes(0), peakIdleBytes(0), allocations(0), reused(0)
+    {
+    }
+
+    DecodeBufferPool(const DecodeBufferPool&);
+    DecodeBufferPool& operator=(const DecodeBufferPool&);
+
+    // Smallest class holding size bytes, SIZE_CLASSES when none does
+    static int classOf(size_t size)
+    {
+        int sizeClass = MIN_CLASS;
+        while (sizeClass < SIZE_CLASSES && capacityOf(sizeClass) < size)
+            ++sizeClass;
+        return sizeClass;
+    }
+
+    static size_t capacityOf(int sizeClass)
+    {
+        return static_cast<size_t>(1) << sizeClass;
+    }
+
+    static Header* headerOf(void* block)
+    {
+        return static_cast<Header*>(block) - 1;
+    }
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <GL/glew.h>
+
+#include <map>
+#include <ostream>
+#include <utility>
+
+// Shadow copy of the GL binding and enable state the render loop touches. Calls that would not change the
+// current state are skipped and counted. Code that changes this state directly (object creation, deletion)
+// must call Invalidate afterwards so the cache does not skip a call that is actually needed.
+class GLStateCache
+{
+public:
+    enum Call
+    {
+        USE_PROGRAM,
+        BIND_VERTEX_ARRAY,
+        ACTIVE_TEXTURE,
+        BIND_TEXTURE,
+        BIND_SAMPLER,
+        BIND_BUFFER,
+        BIND_BUFFER_RANGE,
+        ENABLE,
+        CLEAR_COLOR,
+        CALL_COUNT
+    };
+
+    static const int TEXTURE_UNITS = 16;
+
+    GLStateCache() : lastFrameSkipped(0), frames(0)
+    {
+        for (int i = 0; i < CALL_COUNT; ++i)
+        {
+            frameSkipped[i] = frameIssued[i] = 0;
+            totalSkipped[i] = totalIssued[i] = 0;
+        }
+        Invalidate();
+    }
+
+    // Forgets everything, the next call of each kind goes through
+    void Invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeTexture = UNKNOWN;
+        for (int i = 0; i < TEXTURE_UNITS; ++i)
+        {
+            textures[i] = std::make_pair(GLenum(0), UNKNOWN);
+            samplers[i] = UNKNOWN;
+        }
+        buffers.clear();
+        bufferRanges.clear();
+        enables.clear();
+        clearColorKnown = false;
+    }
+
+    void UseProgram(GLuint id)
+    {
+        if (skip(USE_PROGRAM, program == id))
+            return;
+        program = id;
+        glUseProgram(id);
+    }
+
+    void BindVertexArray(GLuint id)
+    {
+        if (skip(BIND_VERTEX_ARRAY, vertexArray == id))
+            return;
+        vertexArray = id;
+        glBindVertexArray(id);
+    }
+
+    // Binds a texture to a unit, switching the active unit only when the texture actually changes
+    void BindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        if (unit >= TEXTURE_UNITS)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, id);
+            activeTexture = GL_TEXTURE0 + unit;
+            return;
+        }
+        if (skip(BIND_TEXTURE, textures[unit].first == target && textures[unit].second == id))
+            return;
+        if (!skip(ACTIVE_TEXTURE, activeTexture == GL_TEXTURE0 + unit))
+        {
+            activeTexture = GL_TEXTURE0 + unit;
+            glActiveTexture(activeTexture);
+        }
+        textures[unit] = std::make_pair(target, id);
+        glBindTexture(target, id);
+    }
+
+    // Sampler objects are bound per unit without switching the active unit
+    void BindSampler(GLuint unit, GLuint id)
+    {
+        if (unit < TEXTURE_UNITS)
+        {
+            if (skip(BIND_SAMPLER, samplers[unit] == id))
+                return;
+            samplers[unit] = id;
+        }
+        glBindSampler(unit, id);
+    }
+
+    // A deleted texture name can be handed out again, drop it from the units that still show it
+    void ForgetTexture(GLuint id)
+    {
+        for (int i = 0; i < TEXTURE_UNITS; ++i)
+        {
+            if (textures[i].second == id)
+                textures[i].second = UNKNOWN;
+        }
+    }
+
+    void BindBuffer(GLenum target, GLuint id)
+    {
+        std::map<GLenum, GLuint>::iterator it = buffers.find(target);
+        if (skip(BIND_BUFFER, it != buffers.end() && it->second == id))
+            return;
+        buffers[target] = id;
+        glBindBuffer(target, id);
+    }
+
+    // Indexed binding of a buffer range; it also replaces the generic binding of the target
+    void BindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size)
+    {
+        const BufferRange range = { id, offset, size };
+        std::map<std::pair<GLenum, GLuint>, BufferRange>::iterator it = bufferRanges.find(std::make_pair(target, index));
+        if (skip(BIND_BUFFER_RANGE, it != bufferRanges.end() && it->second.buffer == id && it->second.offset == offset && it->second.size == size))
+            return;
+        bufferRanges[std::make_pair(target, index)] = range;
+        buffers[target] = id;
+        glBindBufferRange(target, index, id, offset, size);
+    }
+
+    void Enable(GLenum capability)
+    {
+        std::map<GLenum, bool>::iterator it = enables.find(capability);
+        if (skip(ENABLE, it != enables.end() && it->second))
+            return;
+        enables[capability] = true;
+        glEnable(capability);
+    }
+
+    void Disable(GLenum capability)
+    {
+        std::map<GLenum, bool>::iterator it = enables.find(capability);
+        if (skip(ENABLE, it != enables.end() && !it->second))
+            return;
+        enables[capability] = false;
+        glDisable(capability);
+    }
+
+    void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+    {
+        if (skip(CLEAR_COLOR, clearColorKnown && clearColor[0] == red && clearColor[1] == green && clearColor[2] == blue && clearColor[3] == alpha))
+            return;
+        clearColorKnown = true;
+        clearColor[0] = red;
+        clearColor[1] = green;
+        clearColor[2] = blue;
+        clearColor[3] = alpha;
+        glClearColor(red, green, blue, alpha);
+    }
+
+    // Closes the frame's counters
+    void EndFrame()
+    {
+        lastFrameSkipped = 0;
+        for (int i = 0; i < CALL_COUNT; ++i)
+        {
+            lastFrameSkipped += frameSkipped[i];
+            totalSkipped[i] += frameSkipped[i];
+            totalIssued[i] += frameIssued[i];
+            frameSkipped[i] = frameIssued[i] = 0;
+        }
+        ++frames;
+    }
+
+    // Calls skipped during the last complete frame
+    unsigned int LastFrameSkipped() const
+    {
+        return lastFrameSkipped;
+    }
+
+    void Print(std::ostream& out) const
+    {
+        static const char* const names[CALL_COUNT] = {
+            "glUseProgram", "glBindVertexArray", "glActiveTexture", "glBindTexture",
+            "glBindSampler", "glBindBuffer", "glBindBufferRange", "glEnable/glDisable", "glClearColor"
+        };
+
+        const double frameCount = frames > 0 ? frames : 1;
+        out << "GL STATE: redundant calls skipped per frame (issued per frame)" << std::endl;
+        for (int i = 0; i < CALL_COUNT; ++i)
+        {
+            if (totalSkipped[i] + totalIssued[i] == 0)
+                continue;
+            out << "GL STATE:   " << names[i] << " " << totalSkipped[i] / frameCount
+                << " (" << totalIssued[i] / frameCount << ")" << std::endl;
+        }
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    struct BufferRange
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    GLuint program;
+    GLuint vertexArray;
+    GLenum activeTexture;
+    std::pair<GLenum, GLuint> textures[TEXTURE_UNITS];
+    GLuint samplers[TEXTURE_UNITS];
+    std::map<GLenum, GLuint> buffers;
+    std::map<std::pair<GLenum, GLuint>, BufferRange> bufferRanges;
+    std::map<GLenum, bool> enables;
+    bool clearColorKnown;
+    GLfloat clearColor[4];
+
+    unsigned int frameSkipped[CALL_COUNT];
+    unsigned int frameIssued[CALL_COUNT];
+    unsigned long long totalSkipped[CALL_COUNT];
+    unsigned long long totalIssued[CALL_COUNT];
+    unsigned int lastFrameSkipped;
+    unsigned int frames;
+
+    bool skip(Call call, bool redundant)
+    {
+        if (redundant)
+            ++frameSkipped[call];
+        else
+            ++frameIssued[call];
+        return redundant;
+    }
+};
+
+#endif
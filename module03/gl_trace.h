@@ -0,0 +1,998 @@
+#ifndef GL_TRACE_H
+#define GL_TRACE_H
+
+// GL call tracing and command stream capture/replay.
+//
+// With ENABLE_GL_TRACE defined, every GL entry point in GLTRACE_FUNCTIONS is redirected (by macro, for the code
+// included after this header) through a wrapper that counts and times the call per frame and, once StartCapture
+// was called, writes the call with its arguments and data payloads to a file. Replayer re-executes such a file
+// and is available in every build. Include this header right after <GL/glew.h> and before any header whose GL
+// calls should be traced.
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Every traced entry point; the capture file stores calls by their index in this list
+#define GLTRACE_FUNCTIONS(X) \
+    X(glActiveTexture) \
+    X(glAttachShader) \
+    X(glBindBuffer) \
+    X(glBindBufferRange) \
+    X(glBindFramebuffer) \
+    X(glBindRenderbuffer) \
+    X(glBindSampler) \
+    X(glBindTexture) \
+    X(glBindVertexArray) \
+    X(glBufferData) \
+    X(glBufferStorage) \
+    X(glCheckFramebufferStatus) \
+    X(glClear) \
+    X(glClearColor) \
+    X(glClientWaitSync) \
+    X(glCompileShader) \
+    X(glCompressedTexImage2D) \
+    X(glCompressedTexSubImage2D) \
+    X(glCopyImageSubData) \
+    X(glCreateProgram) \
+    X(glCreateShader) \
+    X(glDeleteBuffers) \
+    X(glDeleteFramebuffers) \
+    X(glDeleteProgram) \
+    X(glDeleteQueries) \
+    X(glDeleteRenderbuffers) \
+    X(glDeleteSamplers) \
+    X(glDeleteShader) \
+    X(glDeleteSync) \
+    X(glDeleteTextures) \
+    X(glDeleteVertexArrays) \
+    X(glDetachShader) \
+    X(glDrawArrays) \
+    X(glEnable) \
+    X(glEnableVertexAttribArray) \
+    X(glFenceSync) \
+    X(glFinish) \
+    X(glFramebufferRenderbuffer) \
+    X(glGenBuffers) \
+    X(glGenerateMipmap) \
+    X(glGenFramebuffers) \
+    X(glGenQueries) \
+    X(glGenRenderbuffers) \
+    X(glGenSamplers) \
+    X(glGenTextures) \
+    X(glGenVertexArrays) \
+    X(glGetIntegerv) \
+    X(glGetProgramInfoLog) \
+    X(glGetProgramiv) \
+    X(glGetQueryObjectui64v) \
+    X(glGetQueryObjectuiv) \
+    X(glGetShaderInfoLog) \
+    X(glGetShaderiv) \
+    X(glGetString) \
+    X(glLinkProgram) \
+    X(glMapBufferRange) \
+    X(glProgramParameteri) \
+    X(glQueryCounter) \
+    X(glReadPixels) \
+    X(glRenderbufferStorage) \
+    X(glSamplerParameterf) \
+    X(glSamplerParameteri) \
+    X(glShaderSource) \
+    X(glTexImage2D) \
+    X(glTexParameteri) \
+    X(glTexStorage2D) \
+    X(glTexSubImage2D) \
+    X(glUnmapBuffer) \
+    X(glUseProgram) \
+    X(glVertexAttribPointer) \
+    X(glViewport)
+
+namespace gltrace
+{
+    enum CallId
+    {
+#define GLTRACE_ENUM(name) CALL_##name,
+        GLTRACE_FUNCTIONS(GLTRACE_ENUM)
+#undef GLTRACE_ENUM
+        CALL_COUNT
+    };
+
+    const uint16_t FRAME_MARKER = 0xFFFF;
+    const uint32_t FILE_VERSION = 5;          // Bumped whenever GLTRACE_FUNCTIONS changes
+
+    inline const char* CallName(int id)
+    {
+#define GLTRACE_NAME(name) #name,
+        static const char* const names[] = { GLTRACE_FUNCTIONS(GLTRACE_NAME) };
+#undef GLTRACE_NAME
+        return names[id];
+    }
+
+    // The untraced entry points; GLEW function pointers are read at call time because glewInit fills them in
+#define GLTRACE_REAL(name) inline std::decay<decltype(name)>::type real_##name() { return name; }
+    GLTRACE_FUNCTIONS(GLTRACE_REAL)
+#undef GLTRACE_REAL
+
+    // Bytes of a glTexImage2D or glTexSubImage2D upload with the default unpack alignment of 4
+    inline size_t imageSize(GLsizei width, GLsizei height, GLenum format, GLenum type)
+    {
+        size_t components = 4;
+        switch (format)
+        {
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: components = 1; break;
+        case GL_RG: case GL_RG_INTEGER: components = 2; break;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: components = 3; break;
+        }
+        size_t componentSize = 1;
+        switch (type)
+        {
+        case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: componentSize = 2; break;
+        case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: componentSize = 4; break;
+        }
+        const size_t rowSize = (width * components * componentSize + 3) / 4 * 4;
+        return rowSize * height;
+    }
+
+    // Capture file writer: scalars are stored raw, pointers as 64 bit values, payloads as size prefixed blobs
+    class Writer
+    {
+    public:
+        bool Open(const char* path)
+        {
+            file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+            if (!file)
+                return false;
+            file.write("FPGL", 4);
+            Put(FILE_VERSION);
+            return true;
+        }
+
+        bool IsOpen() const
+        {
+            return file.is_open();
+        }
+
+        void Close()
+        {
+            file.close();
+        }
+
+        template <typename T>
+        typename std::enable_if<!std::is_pointer<T>::value>::type Put(const T& value)
+        {
+            file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_pointer<T>::value>::type Put(const T& value)
+        {
+            Put(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value)));
+        }
+
+        void Blob(const void* data, size_t size)
+        {
+            Put(static_cast<uint64_t>(data ? size : 0));
+            if (data && size)
+                file.write(static_cast<const char*>(data), size);
+        }
+
+    private:
+        std::ofstream file;
+    };
+
+    class Replayer;
+
+    // Per call extra data; specialized below for calls that pass arrays, buffer contents or object names
+    template <int Id>
+    struct Hooks
+    {
+        // Capture: data behind pointer arguments, written after the arguments
+        template <typename Args> static void RecordPayload(Writer&, const Args&) {}
+        // Capture: bookkeeping and outputs after the call returned
+        template <typename Args> static void RecordOutputs(Writer&, const Args&) {}
+        template <typename Args, typename R> static void RecordResult(const Args&, R) {}
+        // Replay: point the arguments at the recorded payloads
+        template <typename Args> static void ReplayPayload(Replayer&, Args&) {}
+        // Replay: compare outputs with the capture
+        template <typename Args> static void ReplayOutputs(Replayer&, const Args&) {}
+        template <typename R> static void CheckResult(Replayer&, R, R) {}
+    };
+
+    // Capture side bookkeeping of persistently mapped buffers, their contents are captured when a range is bound
+    struct Mappings
+    {
+        std::map<GLenum, GLuint> bound;                 // Buffer bound to each target
+        std::map<GLuint, std::pair<char*, GLintptr> > mapped; // Buffer -> mapped pointer and mapped offset
+
+        static Mappings& Instance()
+        {
+            static Mappings instance;
+            return instance;
+        }
+    };
+
+    // Reads a capture back and issues the calls through the untraced entry points
+    class Replayer
+    {
+    public:
+        Replayer() : calls(0), nameMismatches(0)
+        {
+        }
+
+        bool Open(const char* path)
+        {
+            file.open(path, std::ios::binary | std::ios::in);
+            char magic[4] = { 0, 0, 0, 0 };
+            uint32_t version = 0;
+            file.read(magic, 4);
+            file.read(reinterpret_cast<char*>(&version), sizeof(version));
+            if (!file || memcmp(magic, "FPGL", 4) != 0 || version != FILE_VERSION)
+            {
+                std::cout << "ERROR::GL_REPLAY::INVALID_CAPTURE " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // Executes the calls up to the next frame marker, false at the end of the capture
+        bool ReplayFrame();
+
+        // Calls executed so far
+        uint64_t Calls() const
+        {
+            return calls;
+        }
+
+        template <typename T>
+        typename std::enable_if<!std::is_pointer<T>::value, T>::type Get()
+        {
+            T value;
+            file.read(reinterpret_cast<char*>(&value), sizeof(T));
+            return value;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_pointer<T>::value, T>::type Get()
+        {
+            return reinterpret_cast<T>(static_cast<uintptr_t>(Get<uint64_t>()));
+        }
+
+        // Argument of a replayed call: output pointers get scratch memory, sync objects are translated
+        template <typename T>
+        T Argument()
+        {
+            return argument(static_cast<T*>(NULL));
+        }
+
+        // Recorded return value; fence syncs are remembered for the calls that use them later
+        template <typename R>
+        R Result(R actual)
+        {
+            R recorded = Get<R>();
+            rememberSync(recorded, actual);
+            return recorded;
+        }
+
+        // Next payload of the current call, NULL when the capture stored none
+        const void* Blob()
+        {
+            const uint64_t size = Get<uint64_t>();
+            if (size == 0)
+                return NULL;
+            blobs.push_back(std::vector<char>(static_cast<size_t>(size)));
+            file.read(blobs.back().data(), size);
+            return blobs.back().data();
+        }
+
+        size_t LastBlobSize() const
+        {
+            return blobs.empty() ? 0 : blobs.back().size();
+        }
+
+        // Object names are not remapped: a fresh context hands out the same names for the same call sequence
+        void CheckNames(const GLuint* recorded, const GLuint* actual, GLsizei count)
+        {
+            for (GLsizei i = 0; i < count; ++i)
+            {
+                if (recorded[i] != actual[i] && nameMismatches++ == 0)
+                    std::cout << "WARNING::GL_REPLAY::OBJECT_NAMES_DIFFER, the replay may not match the capture" << std::endl;
+            }
+        }
+
+        // Called before each replayed call
+        void BeginCall()
+        {
+            blobs.clear();
+            scratchIndex = 0;
+            ++calls;
+        }
+
+    private:
+        static const int SCRATCH_SLOTS = 4;
+        static const size_t SCRATCH_SIZE = 64 * 1024;
+
+        std::ifstream file;
+        std::vector<std::vector<char> > blobs;
+        std::vector<char> scratch[SCRATCH_SLOTS];
+        int scratchIndex;
+        std::map<uint64_t, GLsync> syncs;
+        uint64_t calls;
+        int nameMismatches;
+
+        template <typename T>
+        T argument(T*)
+        {
+            return Get<T>();
+        }
+
+        // Output arrays (glGen*, glGet*) are written into scratch memory
+        template <typename T>
+        T* argument(T**)
+        {
+            Get<uint64_t>();
+            std::vector<char>& slot = scratch[scratchIndex++ % SCRATCH_SLOTS];
+            slot.assign(SCRATCH_SIZE, 0);
+            return reinterpret_cast<T*>(slot.data());
+        }
+
+        // Input pointers keep their recorded value (buffer offsets), payload hooks replace real arrays
+        template <typename T>
+        const T* argument(const T**)
+        {
+            return Get<const T*>();
+        }
+
+        GLsync argument(GLsync*)
+        {
+            std::map<uint64_t, GLsync>::const_iterator it = syncs.find(Get<uint64_t>());
+            return it != syncs.end() ? it->second : static_cast<GLsync>(NULL);
+        }
+
+        template <typename R>
+        void rememberSync(R, R)
+        {
+        }
+
+        void rememberSync(GLsync recorded, GLsync actual)
+        {
+            syncs[static_cast<uint64_t>(reinterpret_cast<uintptr_t>(recorded))] = actual;
+        }
+    };
+
+    // Buffer uploads carry their data
+    template <>
+    struct Hooks<CALL_glBufferData> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<2>(args), std::get<1>(args));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<2>(args) = replayer.Blob();
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glBufferStorage> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<2>(args), std::get<1>(args));
+        }
+        // The replay refreshes persistently mapped ranges with glBufferSubData, which needs dynamic storage
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<2>(args) = replayer.Blob();
+            std::get<3>(args) |= GL_DYNAMIC_STORAGE_BIT;
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glTexImage2D> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<8>(args), imageSize(std::get<3>(args), std::get<4>(args), std::get<6>(args), std::get<7>(args)));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<8>(args) = replayer.Blob();
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glTexSubImage2D> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<8>(args), imageSize(std::get<4>(args), std::get<5>(args), std::get<6>(args), std::get<7>(args)));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<8>(args) = replayer.Blob();
+        }
+    };
+
+    // Compressed uploads state their size
+    template <>
+    struct Hooks<CALL_glCompressedTexImage2D> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<7>(args), std::get<6>(args));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<7>(args) = replayer.Blob();
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glCompressedTexSubImage2D> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<8>(args), std::get<7>(args));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<8>(args) = replayer.Blob();
+        }
+    };
+
+    // Reads into a pixel pack buffer pass an offset, which the replay keeps instead of handing out scratch memory
+    template <>
+    struct Hooks<CALL_glReadPixels> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            const uint64_t offset = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(std::get<6>(args)));
+            writer.Blob(Mappings::Instance().bound[GL_PIXEL_PACK_BUFFER] != 0 ? &offset : NULL, sizeof(offset));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            const void* offset = replayer.Blob();
+            if (offset)
+                std::get<6>(args) = reinterpret_cast<void*>(static_cast<uintptr_t>(*static_cast<const uint64_t*>(offset)));
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glShaderSource> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            for (GLsizei i = 0; i < std::get<1>(args); ++i)
+            {
+                const GLint* lengths = std::get<3>(args);
+                const GLchar* source = std::get<2>(args)[i];
+                writer.Blob(source, lengths && lengths[i] >= 0 ? size_t(lengths[i]) : strlen(source));
+            }
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            static std::vector<const GLchar*> sources;
+            static std::vector<GLint> lengths;
+            sources.clear();
+            lengths.clear();
+            for (GLsizei i = 0; i < std::get<1>(args); ++i)
+            {
+                sources.push_back(static_cast<const GLchar*>(replayer.Blob()));
+                lengths.push_back(static_cast<GLint>(replayer.LastBlobSize()));
+            }
+            std::get<2>(args) = sources.data();
+            std::get<3>(args) = lengths.data();
+        }
+    };
+
+    // glDelete*(n, names) read an array of names
+    struct DeleteHooks : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<1>(args), sizeof(GLuint) * std::get<0>(args));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            std::get<1>(args) = static_cast<const GLuint*>(replayer.Blob());
+        }
+    };
+    template <> struct Hooks<CALL_glDeleteBuffers> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteFramebuffers> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteQueries> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteRenderbuffers> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteSamplers> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteTextures> : DeleteHooks {};
+    template <> struct Hooks<CALL_glDeleteVertexArrays> : DeleteHooks {};
+
+    // glGen*(n, names) write an array of names, the replay checks it gets the same ones
+    struct GenHooks : Hooks<-1>
+    {
+        template <typename Args> static void RecordOutputs(Writer& writer, const Args& args)
+        {
+            writer.Blob(std::get<1>(args), sizeof(GLuint) * std::get<0>(args));
+        }
+        template <typename Args> static void ReplayOutputs(Replayer& replayer, const Args& args)
+        {
+            const GLuint* recorded = static_cast<const GLuint*>(replayer.Blob());
+            if (recorded)
+                replayer.CheckNames(recorded, std::get<1>(args), std::get<0>(args));
+        }
+    };
+    template <> struct Hooks<CALL_glGenBuffers> : GenHooks {};
+    template <> struct Hooks<CALL_glGenFramebuffers> : GenHooks {};
+    template <> struct Hooks<CALL_glGenQueries> : GenHooks {};
+    template <> struct Hooks<CALL_glGenRenderbuffers> : GenHooks {};
+    template <> struct Hooks<CALL_glGenSamplers> : GenHooks {};
+    template <> struct Hooks<CALL_glGenTextures> : GenHooks {};
+    template <> struct Hooks<CALL_glGenVertexArrays> : GenHooks {};
+
+    struct CreateHooks : Hooks<-1>
+    {
+        static void CheckResult(Replayer& replayer, GLuint actual, GLuint recorded)
+        {
+            replayer.CheckNames(&recorded, &actual, 1);
+        }
+    };
+    template <> struct Hooks<CALL_glCreateProgram> : CreateHooks {};
+    template <> struct Hooks<CALL_glCreateShader> : CreateHooks {};
+
+    // Persistently mapped buffers are written with memcpy, invisible to the call stream: remember the mappings
+    // and capture the contents of each range when it is bound for drawing
+    template <>
+    struct Hooks<CALL_glBindBuffer> : Hooks<-1>
+    {
+        template <typename Args> static void RecordOutputs(Writer&, const Args& args)
+        {
+            Mappings::Instance().bound[std::get<0>(args)] = std::get<1>(args);
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glMapBufferRange> : Hooks<-1>
+    {
+        template <typename Args> static void RecordResult(const Args& args, void* pointer)
+        {
+            Mappings& mappings = Mappings::Instance();
+            if (pointer && (std::get<3>(args) & GL_MAP_PERSISTENT_BIT))
+                mappings.mapped[mappings.bound[std::get<0>(args)]] = std::make_pair(static_cast<char*>(pointer), std::get<1>(args));
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glUnmapBuffer> : Hooks<-1>
+    {
+        template <typename Args> static void RecordOutputs(Writer&, const Args& args)
+        {
+            Mappings& mappings = Mappings::Instance();
+            mappings.mapped.erase(mappings.bound[std::get<0>(args)]);
+        }
+    };
+
+    template <>
+    struct Hooks<CALL_glBindBufferRange> : Hooks<-1>
+    {
+        template <typename Args> static void RecordPayload(Writer& writer, const Args& args)
+        {
+            Mappings& mappings = Mappings::Instance();
+            std::map<GLuint, std::pair<char*, GLintptr> >::const_iterator it = mappings.mapped.find(std::get<2>(args));
+            if (it == mappings.mapped.end())
+                writer.Blob(NULL, 0);
+            else
+                writer.Blob(it->second.first + (std::get<3>(args) - it->second.second), std::get<4>(args));
+        }
+        template <typename Args> static void ReplayPayload(Replayer& replayer, Args& args)
+        {
+            const void* contents = replayer.Blob();
+            if (contents == NULL)
+                return;
+            real_glBindBuffer()(GL_COPY_WRITE_BUFFER, std::get<2>(args));
+            glBufferSubData(GL_COPY_WRITE_BUFFER, std::get<3>(args), replayer.LastBlobSize(), contents);
+            real_glBindBuffer()(GL_COPY_WRITE_BUFFER, 0);
+        }
+    };
+
+    template <typename Function, typename Args, size_t... I>
+    auto invoke(Function function, Args& args, std::index_sequence<I...>) -> decltype(function(std::get<I>(args)...))
+    {
+        return function(std::get<I>(args)...);
+    }
+
+    template <int Id, typename... A>
+    void replayCall(Replayer& replayer, void (APIENTRY* function)(A...))
+    {
+        std::tuple<A...> args{ replayer.Argument<A>()... }; // Braced initialization reads the arguments in order
+        Hooks<Id>::ReplayPayload(replayer, args);
+        invoke(function, args, std::index_sequence_for<A...>());
+        Hooks<Id>::ReplayOutputs(replayer, args);
+    }
+
+    template <int Id, typename R, typename... A>
+    void replayCall(Replayer& replayer, R (APIENTRY* function)(A...))
+    {
+        std::tuple<A...> args{ replayer.Argument<A>()... };
+        Hooks<Id>::ReplayPayload(replayer, args);
+        R actual = invoke(function, args, std::index_sequence_for<A...>());
+        Hooks<Id>::CheckResult(replayer, actual, replayer.Result(actual));
+        Hooks<Id>::ReplayOutputs(replayer, args);
+    }
+
+    typedef void (*ReplayFunction)(Replayer&);
+
+#define GLTRACE_REPLAY(name) inline void replay_##name(Replayer& replayer) { replayCall<CALL_##name>(replayer, real_##name()); }
+    GLTRACE_FUNCTIONS(GLTRACE_REPLAY)
+#undef GLTRACE_REPLAY
+
+    inline bool Replayer::ReplayFrame()
+    {
+#define GLTRACE_TABLE(name) &replay_##name,
+        static const ReplayFunction table[] = { GLTRACE_FUNCTIONS(GLTRACE_TABLE) };
+#undef GLTRACE_TABLE
+
+        for (;;)
+        {
+            uint16_t id = Get<uint16_t>();
+            if (!file)
+                return false;
+            if (id == FRAME_MARKER)
+                return true;
+            if (id >= CALL_COUNT)
+            {
+                std::cout << "ERROR::GL_REPLAY::UNKNOWN_CALL " << id << std::endl;
+                return false;
+            }
+            BeginCall();
+            table[id](*this);
+        }
+    }
+
+#ifdef ENABLE_GL_TRACE
+
+    // Call counts and times of the current frame and of the whole run
+    struct Statistics
+    {
+        uint64_t frameCalls[CALL_COUNT];
+        uint64_t frameNanoseconds[CALL_COUNT];
+        uint64_t totalCalls[CALL_COUNT];
+        uint64_t totalNanoseconds[CALL_COUNT];
+        uint32_t frames;
+        uint32_t slowestFrame;
+        uint64_t slowestFrameNanoseconds;
+        Writer capture;
+
+        Statistics() : frames(0), slowestFrame(0), slowestFrameNanoseconds(0)
+        {
+            memset(frameCalls, 0, sizeof(frameCalls));
+            memset(frameNanoseconds, 0, sizeof(frameNanoseconds));
+            memset(totalCalls, 0, sizeof(totalCalls));
+            memset(totalNanoseconds, 0, sizeof(totalNanoseconds));
+        }
+
+        static Statistics& Instance()
+        {
+            static Statistics instance;
+            return instance;
+        }
+    };
+
+    template <typename... A, size_t... I>
+    void putArguments(Writer& writer, const std::tuple<A...>& args, std::index_sequence<I...>)
+    {
+        int expand[] = { 0, (writer.Put(std::get<I>(args)), 0)... };
+        (void)expand;
+    }
+
+    // Stand-in for a GL entry point: counts and times the real call and records it while capturing
+    template <int Id, typename R, typename... A>
+    struct Traced
+    {
+        R (APIENTRY* function)(A...);
+
+        R operator()(A... values) const
+        {
+            Statistics& statistics = Statistics::Instance();
+            const bool capturing = statistics.capture.IsOpen();
+            const std::tuple<A...> args{ values... };
+            if (capturing)
+            {
+                statistics.capture.Put(static_cast<uint16_t>(Id));
+                putArguments(statistics.capture, args, std::index_sequence_for<A...>());
+                Hooks<Id>::RecordPayload(statistics.capture, args);
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            R result = function(values...);
+            statistics.frameNanoseconds[Id] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            ++statistics.frameCalls[Id];
+
+            if (capturing)
+            {
+                statistics.capture.Put(result);
+                Hooks<Id>::RecordResult(args, result);
+                Hooks<Id>::RecordOutputs(statistics.capture, args);
+            }
+            return result;
+        }
+    };
+
+    template <int Id, typename... A>
+    struct Traced<Id, void, A...>
+    {
+        void (APIENTRY* function)(A...);
+
+        void operator()(A... values) const
+        {
+            Statistics& statistics = Statistics::Instance();
+            const bool capturing = statistics.capture.IsOpen();
+            const std::tuple<A...> args{ values... };
+            if (capturing)
+            {
+                statistics.capture.Put(static_cast<uint16_t>(Id));
+                putArguments(statistics.capture, args, std::index_sequence_for<A...>());
+                Hooks<Id>::RecordPayload(statistics.capture, args);
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            function(values...);
+            statistics.frameNanoseconds[Id] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            ++statistics.frameCalls[Id];
+
+            if (capturing)
+                Hooks<Id>::RecordOutputs(statistics.capture, args);
+        }
+    };
+
+    template <int Id, typename R, typename... A>
+    Traced<Id, R, A...> traced(R (APIENTRY* function)(A...))
+    {
+        Traced<Id, R, A...> wrapper = { function };
+        return wrapper;
+    }
+
+    // Starts writing every traced call to path
+    inline bool StartCapture(const char* path)
+    {
+        if (!Statistics::Instance().capture.Open(path))
+        {
+            std::cout << "ERROR::GL_TRACE::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Closes the frame's statistics and marks the frame boundary in the capture
+    inline void EndFrame()
+    {
+        Statistics& statistics = Statistics::Instance();
+        uint64_t frameNanoseconds = 0;
+        for (int i = 0; i < CALL_COUNT; ++i)
+        {
+            statistics.totalCalls[i] += statistics.frameCalls[i];
+            statistics.totalNanoseconds[i] += statistics.frameNanoseconds[i];
+            frameNanoseconds += statistics.frameNanoseconds[i];
+            statistics.frameCalls[i] = 0;
+            statistics.frameNanoseconds[i] = 0;
+        }
+        if (frameNanoseconds > statistics.slowestFrameNanoseconds)
+        {
+            statistics.slowestFrameNanoseconds = frameNanoseconds;
+            statistics.slowestFrame = statistics.frames;
+        }
+        ++statistics.frames;
+
+        if (statistics.capture.IsOpen())
+            statistics.capture.Put(FRAME_MARKER);
+    }
+
+    // Closes the capture and prints calls per frame and time per call for every entry point, most expensive first
+    inline void Finish(std::ostream& out)
+    {
+        Statistics& statistics = Statistics::Instance();
+        if (statistics.capture.IsOpen())
+            statistics.capture.Close();
+
+        std::vector<int> order;
+        for (int i = 0; i < CALL_COUNT; ++i)
+        {
+            if (statistics.totalCalls[i] > 0)
+                order.push_back(i);
+        }
+        std::sort(order.begin(), order.end(), [&statistics](int a, int b) { return statistics.totalNanoseconds[a] > statistics.totalNanoseconds[b]; });
+
+        const double frames = statistics.frames > 0 ? statistics.frames : 1;
+        out << "GL TRACE: " << statistics.frames << " frames, slowest GL frame " << statistics.slowestFrame
+            << " (" << statistics.slowestFrameNanoseconds / 1.0e6 << " ms in GL calls)" << std::endl;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const int id = order[i];
+            out << "GL TRACE:   " << CallName(id)
+                << " calls/frame " << statistics.totalCalls[id] / frames
+                << " ns/call " << statistics.totalNanoseconds[id] / statistics.totalCalls[id]
+                << " ms/frame " << statistics.totalNanoseconds[id] / 1.0e6 / frames << std::endl;
+        }
+    }
+
+#define GLTRACE_ENABLED 1
+
+#else
+
+    inline bool StartCapture(const char*)
+    {
+        return false;
+    }
+
+    inline void EndFrame()
+    {
+    }
+
+    inline void Finish(std::ostream&)
+    {
+    }
+
+#define GLTRACE_ENABLED 0
+
+#endif
+}
+
+#ifdef ENABLE_GL_TRACE
+
+// Redirect the entry points for everything included after this header
+#define GLTRACE_CALL(name) gltrace::traced<gltrace::CALL_##name>(gltrace::real_##name())
+
+#undef glActiveTexture
+#define glActiveTexture GLTRACE_CALL(glActiveTexture)
+#undef glAttachShader
+#define glAttachShader GLTRACE_CALL(glAttachShader)
+#undef glBindBuffer
+#define glBindBuffer GLTRACE_CALL(glBindBuffer)
+#undef glBindBufferRange
+#define glBindBufferRange GLTRACE_CALL(glBindBufferRange)
+#undef glBindFramebuffer
+#define glBindFramebuffer GLTRACE_CALL(glBindFramebuffer)
+#undef glBindRenderbuffer
+#define glBindRenderbuffer GLTRACE_CALL(glBindRenderbuffer)
+#undef glBindSampler
+#define glBindSampler GLTRACE_CALL(glBindSampler)
+#undef glBindTexture
+#define glBindTexture GLTRACE_CALL(glBindTexture)
+#undef glBindVertexArray
+#define glBindVertexArray GLTRACE_CALL(glBindVertexArray)
+#undef glBufferData
+#define glBufferData GLTRACE_CALL(glBufferData)
+#undef glBufferStorage
+#define glBufferStorage GLTRACE_CALL(glBufferStorage)
+#undef glCheckFramebufferStatus
+#define glCheckFramebufferStatus GLTRACE_CALL(glCheckFramebufferStatus)
+#undef glClear
+#define glClear GLTRACE_CALL(glClear)
+#undef glClearColor
+#define glClearColor GLTRACE_CALL(glClearColor)
+#undef glClientWaitSync
+#define glClientWaitSync GLTRACE_CALL(glClientWaitSync)
+#undef glCompileShader
+#define glCompileShader GLTRACE_CALL(glCompileShader)
+#undef glCompressedTexImage2D
+#define glCompressedTexImage2D GLTRACE_CALL(glCompressedTexImage2D)
+#undef glCompressedTexSubImage2D
+#define glCompressedTexSubImage2D GLTRACE_CALL(glCompressedTexSubImage2D)
+#undef glCopyImageSubData
+#define glCopyImageSubData GLTRACE_CALL(glCopyImageSubData)
+#undef glCreateProgram
+#define glCreateProgram GLTRACE_CALL(glCreateProgram)
+#undef glCreateShader
+#define glCreateShader GLTRACE_CALL(glCreateShader)
+#undef glDeleteBuffers
+#define glDeleteBuffers GLTRACE_CALL(glDeleteBuffers)
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers GLTRACE_CALL(glDeleteFramebuffers)
+#undef glDeleteProgram
+#define glDeleteProgram GLTRACE_CALL(glDeleteProgram)
+#undef glDeleteQueries
+#define glDeleteQueries GLTRACE_CALL(glDeleteQueries)
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers GLTRACE_CALL(glDeleteRenderbuffers)
+#undef glDeleteSamplers
+#define glDeleteSamplers GLTRACE_CALL(glDeleteSamplers)
+#undef glDeleteShader
+#define glDeleteShader GLTRACE_CALL(glDeleteShader)
+#undef glDeleteSync
+#define glDeleteSync GLTRACE_CALL(glDeleteSync)
+#undef glDeleteTextures
+#define glDeleteTextures GLTRACE_CALL(glDeleteTextures)
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays GLTRACE_CALL(glDeleteVertexArrays)
+#undef glDetachShader
+#define glDetachShader GLTRACE_CALL(glDetachShader)
+#undef glDrawArrays
+#define glDrawArrays GLTRACE_CALL(glDrawArrays)
+#undef glEnable
+#define glEnable GLTRACE_CALL(glEnable)
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray GLTRACE_CALL(glEnableVertexAttribArray)
+#undef glFenceSync
+#define glFenceSync GLTRACE_CALL(glFenceSync)
+#undef glFinish
+#define glFinish GLTRACE_CALL(glFinish)
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer GLTRACE_CALL(glFramebufferRenderbuffer)
+#undef glGenBuffers
+#define glGenBuffers GLTRACE_CALL(glGenBuffers)
+#undef glGenerateMipmap
+#define glGenerateMipmap GLTRACE_CALL(glGenerateMipmap)
+#undef glGenFramebuffers
+#define glGenFramebuffers GLTRACE_CALL(glGenFramebuffers)
+#undef glGenQueries
+#define glGenQueries GLTRACE_CALL(glGenQueries)
+#undef glGenRenderbuffers
+#define glGenRenderbuffers GLTRACE_CALL(glGenRenderbuffers)
+#undef glGenSamplers
+#define glGenSamplers GLTRACE_CALL(glGenSamplers)
+#undef glGenTextures
+#define glGenTextures GLTRACE_CALL(glGenTextures)
+#undef glGenVertexArrays
+#define glGenVertexArrays GLTRACE_CALL(glGenVertexArrays)
+#undef glGetIntegerv
+#define glGetIntegerv GLTRACE_CALL(glGetIntegerv)
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog GLTRACE_CALL(glGetProgramInfoLog)
+#undef glGetProgramiv
+#define glGetProgramiv GLTRACE_CALL(glGetProgramiv)
+#undef glGetQueryObjectui64v
+#define glGetQueryObjectui64v GLTRACE_CALL(glGetQueryObjectui64v)
+#undef glGetQueryObjectuiv
+#define glGetQueryObjectuiv GLTRACE_CALL(glGetQueryObjectuiv)
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog GLTRACE_CALL(glGetShaderInfoLog)
+#undef glGetShaderiv
+#define glGetShaderiv GLTRACE_CALL(glGetShaderiv)
+#undef glGetString
+#define glGetString GLTRACE_CALL(glGetString)
+#undef glLinkProgram
+#define glLinkProgram GLTRACE_CALL(glLinkProgram)
+#undef glMapBufferRange
+#define glMapBufferRange GLTRACE_CALL(glMapBufferRange)
+#undef glProgramParameteri
+#define glProgramParameteri GLTRACE_CALL(glProgramParameteri)
+#undef glQueryCounter
+#define glQueryCounter GLTRACE_CALL(glQueryCounter)
+#undef glReadPixels
+#define glReadPixels GLTRACE_CALL(glReadPixels)
+#undef glRenderbufferStorage
+#define glRenderbufferStorage GLTRACE_CALL(glRenderbufferStorage)
+#undef glSamplerParameterf
+#define glSamplerParameterf GLTRACE_CALL(glSamplerParameterf)
+#undef glSamplerParameteri
+#define glSamplerParameteri GLTRACE_CALL(glSamplerParameteri)
+#undef glShaderSource
+#define glShaderSource GLTRACE_CALL(glShaderSource)
+#undef glTexImage2D
+#define glTexImage2D GLTRACE_CALL(glTexImage2D)
+#undef glTexParameteri
+#define glTexParameteri GLTRACE_CALL(glTexParameteri)
+#undef glTexStorage2D
+#define glTexStorage2D GLTRACE_CALL(glTexStorage2D)
+#undef glTexSubImage2D
+#define glTexSubImage2D GLTRACE_CALL(glTexSubImage2D)
+#undef glUnmapBuffer
+#define glUnmapBuffer GLTRACE_CALL(glUnmapBuffer)
+#undef glUseProgram
+#define glUseProgram GLTRACE_CALL(glUseProgram)
+#undef glVertexAttribPointer
+#define glVertexAttribPointer GLTRACE_CALL(glVertexAttribPointer)
+#undef glViewport
+#define glViewport GLTRACE_CALL(glViewport)
+
+#endif
+
+#endif
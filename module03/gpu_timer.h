@@ -0,0 +1,177 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <GL/glew.h>
+
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+// GPU time per render pass from GL_TIMESTAMP queries. Each frame records a timestamp at every Mark and one at
+// EndFrame; the pass time is the difference between consecutive marks. Results are read FRAME_LATENCY frames
+// later, when the GPU has long finished them, so reading never stalls the pipeline.
+class GpuTimerPool
+{
+public:
+    static const int FRAME_LATENCY = 4;     // Frames in flight before a query set is reused
+    static const int MAX_MARKS = 16;        // Passes per frame
+    static const int AVERAGE_WINDOW = 60;   // Frames in the rolling average
+
+    GpuTimerPool() : frame(0), droppedFrames(0)
+    {
+    }
+
+    void Create()
+    {
+        for (int i = 0; i < FRAME_LATENCY; ++i)
+        {
+            glGenQueries(MAX_MARKS + 1, frames[i].queries);
+            frames[i].count = 0;
+            frames[i].pending = false;
+        }
+        frameStats.name = "Frame";
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < FRAME_LATENCY; ++i)
+            glDeleteQueries(MAX_MARKS + 1, frames[i].queries);
+    }
+
+    // Collects the timestamps written FRAME_LATENCY frames ago and starts recording the current frame
+    void BeginFrame()
+    {
+        FrameQueries& current = frames[frame];
+        if (current.pending)
+        {
+            // Results arrive in submission order, so the last timestamp being ready means all of them are
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(current.queries[current.count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                collect(current);
+            else
+                ++droppedFrames;
+        }
+        current.count = 0;
+        current.pending = false;
+    }
+
+    // Starts a new pass; the previous pass of this frame ends here
+    void Mark(const char* name)
+    {
+        FrameQueries& current = frames[frame];
+        if (current.count >= MAX_MARKS)
+            return;
+        glQueryCounter(current.queries[current.count], GL_TIMESTAMP);
+        current.names[current.count] = name;
+        ++current.count;
+    }
+
+    // Ends the last pass and moves on to the next query set
+    void EndFrame()
+    {
+        FrameQueries& current = frames[frame];
+        if (current.count == 0)
+            return;
+        glQueryCounter(current.queries[current.count], GL_TIMESTAMP);
+        ++current.count;
+        current.pending = true;
+        frame = (frame + 1) % FRAME_LATENCY;
+    }
+
+    // Rolling average GPU time of a pass in milliseconds, 0 when the pass has not been measured yet
+    double AverageMilliseconds(const char* name) const
+    {
+        for (size_t i = 0; i < passStats.size(); ++i)
+        {
+            if (strcmp(passStats[i].name, name) == 0)
+                return passStats[i].Average();
+        }
+        return 0.0;
+    }
+
+    // Rolling average GPU time from the first mark to the end of the frame
+    double FrameMilliseconds() const
+    {
+        return frameStats.Average();
+    }
+
+    void Print(std::ostream& out) const
+    {
+        out << "GPU: frame ms avg " << frameStats.Average() << " (last " << AVERAGE_WINDOW << " frames";
+        if (droppedFrames > 0)
+            out << ", " << droppedFrames << " frames not ready in time";
+        out << ")" << std::endl;
+        for (size_t i = 0; i < passStats.size(); ++i)
+            out << "GPU:   " << passStats[i].name << " " << passStats[i].Average() << " ms" << std::endl;
+    }
+
+private:
+    struct FrameQueries
+    {
+        GLuint queries[MAX_MARKS + 1];
+        const char* names[MAX_MARKS];
+        int count;
+        bool pending;
+    };
+
+    struct Stats
+    {
+        const char* name;
+        double samples[AVERAGE_WINDOW];
+        double sum;
+        int next;
+        int count;
+
+        Stats() : name(NULL), sum(0.0), next(0), count(0)
+        {
+        }
+
+        void Add(double milliseconds)
+        {
+            if (count == AVERAGE_WINDOW)
+                sum -= samples[next];
+            else
+                ++count;
+            samples[next] = milliseconds;
+            sum += milliseconds;
+            next = (next + 1) % AVERAGE_WINDOW;
+        }
+
+        double Average() const
+        {
+            return count > 0 ? sum / count : 0.0;
+        }
+    };
+
+    FrameQueries frames[FRAME_LATENCY];
+    int frame;
+    int droppedFrames;
+    Stats frameStats;
+    std::vector<Stats> passStats;
+
+    void collect(const FrameQueries& queries)
+    {
+        GLuint64 timestamps[MAX_MARKS + 1];
+        for (int i = 0; i < queries.count; ++i)
+            glGetQueryObjectui64v(queries.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+        for (int i = 0; i + 1 < queries.count; ++i)
+            stats(queries.names[i]).Add((timestamps[i + 1] - timestamps[i]) / 1.0e6);
+        frameStats.Add((timestamps[queries.count - 1] - timestamps[0]) / 1.0e6);
+    }
+
+    Stats& stats(const char* name)
+    {
+        for (size_t i = 0; i < passStats.size(); ++i)
+        {
+            if (strcmp(passStats[i].name, name) == 0)
+                return passStats[i];
+        }
+        passStats.push_back(Stats());
+        passStats.back().name = name;
+        return passStats.back();
+    }
+};
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+
+// Build machines without a display get a surfaceless EGL context (Mesa llvmpipe works fine);
+// Windows has no desktop EGL so it falls back to a hidden GLFW window
+#ifndef _WIN32
+#define HEADLESS_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// GL 4.4 core context without a visible window that renders into an offscreen framebuffer of a fixed size
+class HeadlessContext
+{
+public:
+    HeadlessContext() :
+#ifdef HEADLESS_USE_EGL
+        display(EGL_NO_DISPLAY), config(NULL), context(EGL_NO_CONTEXT), loaderContext(EGL_NO_CONTEXT),
+#endif
+        window(NULL), loaderWindow(NULL), framebuffer(0), colorBuffer(0), depthBuffer(0), width(0), height(0)
+    {
+    }
+
+    // Creates the context, makes it current and binds a width x height framebuffer as the render target
+    bool Create(int framebufferWidth, int framebufferHeight)
+    {
+        width = framebufferWidth;
+        height = framebufferHeight;
+
+        if (!createContext())
+            return false;
+
+        // Color and depth attachments sized like the requested window; the color buffer is sRGB like the
+        // window's default framebuffer
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_SRGB8_ALPHA8, width, height);
+
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            return false;
+        }
+
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    // Second context sharing objects with the render context, for the resource loader thread
+    bool CreateLoaderContext()
+    {
+#ifdef HEADLESS_USE_EGL
+        loaderContext = eglCreateContext(display, config, context, contextAttributes());
+        if (loaderContext == EGL_NO_CONTEXT)
+        {
+            std::cout << "ERROR::HEADLESS::EGL_LOADER_CONTEXT_FAILED" << std::endl;
+            return false;
+        }
+#else
+        loaderWindow = glfwCreateWindow(1, 1, "loader", NULL, window);
+        if (loaderWindow == NULL)
+        {
+            std::cout << "Failed to create the hidden GLFW loader window" << std::endl;
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    // Makes the loader context current on the calling thread, or releases it
+    bool MakeLoaderContextCurrent(bool current)
+    {
+#ifdef HEADLESS_USE_EGL
+        return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, current ? loaderContext : EGL_NO_CONTEXT) == EGL_TRUE;
+#else
+        glfwMakeContextCurrent(current ? loaderWindow : NULL);
+        return true;
+#endif
+    }
+
+    void Destroy()
+    {
+        if (framebuffer)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+        }
+        framebuffer = colorBuffer = depthBuffer = 0;
+
+#ifdef HEADLESS_USE_EGL
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (loaderContext != EGL_NO_CONTEXT)
+                eglDestroyContext(display, loaderContext);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+        display = EGL_NO_DISPLAY;
+        context = loaderContext = EGL_NO_CONTEXT;
+#else
+        if (loaderWindow)
+            glfwDestroyWindow(loaderWindow);
+        loaderWindow = NULL;
+        if (window)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+        window = NULL;
+#endif
+    }
+
+    int Width() const
+    {
+        return width;
+    }
+
+    int Height() const
+    {
+        return height;
+    }
+
+private:
+#ifdef HEADLESS_USE_EGL
+    EGLDisplay display;
+    EGLConfig config;
+    EGLContext context;
+    EGLContext loaderContext;
+#endif
+    GLFWwindow* window;
+    GLFWwindow* loaderWindow;
+    GLuint framebuffer;
+    GLuint colorBuffer;
+    GLuint depthBuffer;
+    int width;
+    int height;
+
+#ifdef HEADLESS_USE_EGL
+    static const EGLint* contextAttributes()
+    {
+        static const EGLint attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 4,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        return attributes;
+    }
+
+    bool createContext()
+    {
+        // Prefer the surfaceless platform so no X or Wayland server is needed
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            std::cout << "ERROR::HEADLESS::EGL_INITIALIZE_FAILED" << std::endl;
+            return false;
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            std::cout << "ERROR::HEADLESS::EGL_OPENGL_API_UNAVAILABLE" << std::endl;
+            return false;
+        }
+
+        const EGLint configAttributes[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_SURFACE_TYPE, 0,
+            EGL_NONE
+        };
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        {
+            std::cout << "ERROR::HEADLESS::EGL_NO_CONFIG" << std::endl;
+            return false;
+        }
+
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes());
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            std::cout << "ERROR::HEADLESS::EGL_CONTEXT_FAILED" << std::endl;
+            return false;
+        }
+
+        // glewInit also loads the GLX/WGL entry points, which fails without a window system
+        glewExperimental = GL_TRUE;
+        GLenum glewResult = glewContextInit();
+        if (GLEW_OK != glewResult)
+        {
+            std::cerr << glewGetErrorString(glewResult) << std::endl;
+            return false;
+        }
+        return true;
+    }
+#else
+    bool createContext()
+    {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+        window = glfwCreateWindow(width, height, "headless", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create hidden GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+
+        glewExperimental = GL_TRUE;
+        GLenum glewResult = glewInit();
+        if (GLEW_OK != glewResult)
+        {
+            std::cerr << glewGetErrorString(glewResult) << std::endl;
+            return false;
+        }
+        return true;
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef IMAGE_KERNEL_BENCH_H
+#define IMAGE_KERNEL_BENCH_H
+
+#include <stb_image.h>
+
+#include "image_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Microbenchmark of the image kernels against the code they replaced, on one decoded image. Every
+// kernel runs several times and the fastest run is reported, together with the largest per-channel
+// difference to the reference output.
+namespace imagekernels
+{
+    namespace reference
+    {
+        // The per-byte flip the import path used before
+        inline void FlipRows(unsigned char* image, int width, int height, int channels)
+        {
+            for (int j = 0; j < height / 2; ++j)
+            {
+                int index1 = j * width * channels;
+                int index2 = (height - 1 - j) * width * channels;
+
+                for (int i = width * channels; i > 0; --i)
+                {
+                    unsigned char tmp = image[index1];
+                    image[index1] = image[index2];
+                    image[index2] = tmp;
+                    ++index1;
+                    ++index2;
+                }
+            }
+        }
+
+        inline void ExpandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixelCount)
+        {
+            for (size_t i = 0; i < pixelCount; ++i)
+            {
+                rgba[i * 4] = rgb[i * 3];
+                rgba[i * 4 + 1] = rgb[i * 3 + 1];
+                rgba[i * 4 + 2] = rgb[i * 3 + 2];
+                rgba[i * 4 + 3] = 255;
+            }
+        }
+
+        inline void PremultiplyAlpha(unsigned char* rgba, size_t pixelCount)
+        {
+            for (size_t i = 0; i < pixelCount; ++i)
+                for (int c = 0; c < 3; ++c)
+                    rgba[i * 4 + c] = static_cast<unsigned char>((rgba[i * 4 + c] * rgba[i * 4 + 3] + 127) / 255);
+        }
+
+        // sRGB decode and encode with pow per sample
+        inline void DownsampleSRGB(const unsigned char* source, int width, int height, unsigned char* destination)
+        {
+            const int destinationWidth = MipSize(width);
+            const int destinationHeight = MipSize(height);
+            for (int y = 0; y < destinationHeight; ++y)
+            {
+                for (int x = 0; x < destinationWidth; ++x)
+                {
+                    const int xs[2] = { 2 * x, 2 * x + 1 < width ? 2 * x + 1 : width - 1 };
+                    const int ys[2] = { 2 * y, 2 * y + 1 < height ? 2 * y + 1 : height - 1 };
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        float sum = 0.0f;
+                        for (int j = 0; j < 2; ++j)
+                        {
+                            for (int i = 0; i < 2; ++i)
+                            {
+                                const float value = source[(static_cast<size_t>(ys[j]) * width + xs[i]) * 4 + c] / 255.0f;
+                                sum += c == 3 ? value : (value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f));
+                            }
+                        }
+                        float value = sum / 4.0f;
+                        if (c != 3)
+                            value = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+                        destination[(static_cast<size_t>(y) * destinationWidth + x) * 4 + c] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+                    }
+                }
+            }
+        }
+    }
+
+    // Fastest of several runs of a kernel, in milliseconds; reset restores the input before each run
+    template <typename Reset, typename Kernel>
+    double bestTime(Reset reset, Kernel kernel)
+    {
+        double best = 1e30;
+        for (int run = 0; run < 10; ++run)
+        {
+            reset();
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            kernel();
+            const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (elapsed < best)
+                best = elapsed;
+        }
+        return best;
+    }
+
+    inline int maxDifference(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b)
+    {
+        int difference = 0;
+        for (size_t i = 0; i < a.size(); ++i)
+            difference = std::max(difference, std::abs(a[i] - b[i]));
+        return difference;
+    }
+
+    inline void printRow(std::ostream& out, const char* kernel, double referenceTime, double kernelTime, int difference)
+    {
+        const std::streamsize precision = out.precision();
+        out << "  " << std::left << std::setw(22) << kernel << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << referenceTime << std::setw(10) << kernelTime << std::setprecision(1)
+            << std::setw(8) << referenceTime / kernelTime << "x" << std::setw(8) << difference << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out.precision(precision);
+    }
+
+    // Runs every kernel on the image in the file, false if it cannot be decoded
+    inline bool RunBench(const char* filename, std::ostream& out)
+    {
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        unsigned char* decoded = stbi_load(filename, &width, &height, &channels, 3);
+        if (decoded == NULL)
+        {
+            out << "ERROR::IMAGE_KERNEL_BENCH::CANNOT_DECODE " << filename << std::endl;
+            return false;
+        }
+        const size_t pixelCount = static_cast<size_t>(width) * height;
+        const std::vector<unsigned char> rgb(decoded, decoded + pixelCount * 3);
+        stbi_image_free(decoded);
+
+        out << "INFO: Image kernels on " << filename << " (" << width << "x" << height << ")"
+#ifdef IMAGE_KERNELS_SSSE3
+            << ", SSSE3"
+#elif defined(IMAGE_KERNELS_SSE2)
+            << ", SSE2"
+#endif
+            << std::endl;
+        out << "  kernel                  ref ms    new ms  speedup  max diff" << std::endl;
+
+        // Row flip of the RGB image
+        std::vector<unsigned char> expected(rgb);
+        std::vector<unsigned char> actual(rgb);
+        const double flipReference = bestTime([&] { expected = rgb; }, [&] { reference::FlipRows(&expected[0], width, height, 3); });
+        const double flipKernel = bestTime([&] { actual = rgb; }, [&] { FlipRows(&actual[0], width, height, 3); });
+        printRow(out, "FlipRows", flipReference, flipKernel, maxDifference(expected, actual));
+
+        // RGB to RGBA
+        expected.assign(pixelCount * 4, 0);
+        actual.assign(pixelCount * 4, 0);
+        const double expandReference = bestTime([] {}, [&] { reference::ExpandRGBToRGBA(&rgb[0], &expected[0], pixelCount); });
+        const double expandKernel = bestTime([] {}, [&] { ExpandRGBToRGBA(&rgb[0], &actual[0], pixelCount); });
+        printRow(out, "ExpandRGBToRGBA", expandReference, expandKernel, maxDifference(expected, actual));
+
+        // Premultiplied alpha, on the RGBA image with a gradient in alpha so every alpha value occurs
+        std::vector<unsigned char> rgba(actual);
+        for (size_t i = 0; i < pixelCount; ++i)
+            rgba[i * 4 + 3] = static_cast<unsigned char>(i * 7);
+        const double premultiplyReference = bestTime([&] { expected = rgba; }, [&] { reference::PremultiplyAlpha(&expected[0], pixelCount); });
+        const double premultiplyKernel = bestTime([&] { actual = rgba; }, [&] { PremultiplyAlpha(&actual[0], pixelCount); });
+        printRow(out, "PremultiplyAlpha", premultiplyReference, premultiplyKernel, maxDifference(expected, actual));
+
+        // One sRGB 2x2 downsample of the opaque RGBA image
+        ExpandRGBToRGBA(&rgb[0], &rgba[0], pixelCount);
+        SRGBTables::Get();
+        const size_t halfBytes = static_cast<size_t>(MipSize(width)) * MipSize(height) * 4;
+        expected.assign(halfBytes, 0);
+        actual.assign(halfBytes, 0);
+        const double downsampleReference = bestTime([] {}, [&] { reference::DownsampleSRGB(&rgba[0], width, height, &expected[0]); });
+        const double downsampleKernel = bestTime([] {}, [&] { DownsampleSRGB(&rgba[0], width, height, &actual[0]); });
+        printRow(out, "DownsampleSRGB", downsampleReference, downsampleKernel, maxDifference(expected, actual));
+
+        // Whole import preparation: flip, RGBA expansion and the full mip chain
+        std::vector<unsigned char> source(rgb);
+        std::vector<unsigned char> chain(MipChainBytes(width, height));
+        const double prepareKernel = bestTime([&] { source = rgb; }, [&]
+        {
+            FlipRows(&source[0], width, height, 3);
+            ExpandRGBToRGBA(&source[0], &chain[0], pixelCount);
+            BuildMipChain(&chain[0], width, height);
+        });
+        out << "  Flip, expand and " << MipLevelCount(width, height) << " mip levels: " << prepareKernel << " ms" << std::endl;
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef IMAGE_KERNELS_H
+#define IMAGE_KERNELS_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// SSE2 is part of every x64 target; the RGB expansion uses SSSE3 byte shuffles when the compiler is
+// allowed to (-mssse3 or /arch:AVX), otherwise a word-at-a-time path
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_KERNELS_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#define IMAGE_KERNELS_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+// Pixel kernels of the texture import path, run on the decode workers. Images are tightly packed 8-bit
+// rows; the word-at-a-time paths assume a little-endian target.
+namespace imagekernels
+{
+    // Reverses the row order in place (OpenGL wants the bottom row first), swapping whole rows with memcpy
+    inline void FlipRows(unsigned char* pixels, int width, int height, int channels)
+    {
+        const size_t rowBytes = static_cast<size_t>(width) * channels;
+        unsigned char buffer[4096];
+        unsigned char* top = pixels;
+        unsigned char* bottom = pixels + (height - 1) * rowBytes;
+        for (; top < bottom; top += rowBytes, bottom -= rowBytes)
+        {
+            for (size_t offset = 0; offset < rowBytes; offset += sizeof(buffer))
+            {
+                const size_t count = rowBytes - offset < sizeof(buffer) ? rowBytes - offset : sizeof(buffer);
+                memcpy(buffer, top + offset, count);
+                memcpy(top + offset, bottom + offset, count);
+                memcpy(bottom + offset, buffer, count);
+            }
+        }
+    }
+
+    // RGB8 to RGBA8 with opaque alpha, so textures upload as 4-byte aligned rows the driver takes as is
+    inline void ExpandRGBToRGBA(const unsigned char* rgb, unsigned char* rgba, size_t pixelCount)
+    {
+        size_t i = 0;
+#ifdef IMAGE_KERNELS_SSSE3
+        // 4 pixels per 16-byte load; the load reads 4 bytes past the 12 it uses, so stop 2 pixels early
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        for (; i + 6 <= pixelCount; i += 4)
+        {
+            const __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgb + i * 3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_or_si128(_mm_shuffle_epi8(source, shuffle), alpha));
+        }
+#endif
+        // 4 pixels from three 32-bit words
+        for (; i + 4 <= pixelCount; i += 4)
+        {
+            uint32_t words[3];
+            memcpy(words, rgb + i * 3, sizeof(words));
+            const uint32_t expanded[4] =
+            {
+                words[0] | 0xFF000000u,
+                (words[0] >> 24) | (words[1] << 8) | 0xFF000000u,
+                (words[1] >> 16) | (words[2] << 16) | 0xFF000000u,
+                (words[2] >> 8) | 0xFF000000u
+            };
+            memcpy(rgba + i * 4, expanded, sizeof(expanded));
+        }
+        for (; i < pixelCount; ++i)
+        {
+            rgba[i * 4] = rgb[i * 3];
+            rgba[i * 4 + 1] = rgb[i * 3 + 1];
+            rgba[i * 4 + 2] = rgb[i * 3 + 2];
+            rgba[i * 4 + 3] = 255;
+        }
+    }
+
+    // Multiplies the colour channels of RGBA8 pixels by their alpha, rounded like x * a / 255
+    inline void PremultiplyAlpha(unsigned char* rgba, size_t pixelCount)
+    {
+        size_t i = 0;
+#ifdef IMAGE_KERNELS_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i colorMask = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+        const __m128i alphaOne = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+        const __m128i half = _mm_set1_epi16(128);
+        for (; i + 4 <= pixelCount; i += 4)
+        {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + i * 4));
+            __m128i halves[2] = { _mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero) };
+            for (int h = 0; h < 2; ++h)
+            {
+                // Alpha in the colour lanes, 255 in the alpha lane so alpha stays as it is
+                __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+                alpha = _mm_or_si128(_mm_and_si128(alpha, colorMask), alphaOne);
+                const __m128i product = _mm_add_epi16(_mm_mullo_epi16(halves[h], alpha), half);
+                halves[h] = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_packus_epi16(halves[0], halves[1]));
+        }
+#endif
+        for (; i < pixelCount; ++i)
+        {
+            const unsigned int alpha = rgba[i * 4 + 3];
+            for (int c = 0; c < 3; ++c)
+            {
+                const unsigned int product = rgba[i * 4 + c] * alpha + 128;
+                rgba[i * 4 + c] = static_cast<unsigned char>((product + (product >> 8)) >> 8);
+            }
+        }
+    }
+
+    // Lookup tables between 8-bit sRGB and 16-bit linear values, built on first use
+    struct SRGBTables
+    {
+        uint16_t toLinear[256];
+        unsigned char toSRGB[65536];
+
+        SRGBTables()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                const double value = i / 255.0;
+                const double linear = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+                toLinear[i] = static_cast<uint16_t>(linear * 65535.0 + 0.5);
+            }
+            for (int i = 0; i < 65536; ++i)
+            {
+                const double linear = i / 65535.0;
+                const double value = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+                toSRGB[i] = static_cast<unsigned char>(value * 255.0 + 0.5);
+            }
+        }
+
+        static const SRGBTables& Get()
+        {
+            static const SRGBTables tables;
+            return tables;
+        }
+    };
+
+    // Size of the level below one of this size
+    inline int MipSize(int size)
+    {
+        return size > 1 ? size / 2 : 1;
+    }
+
+    // Number of levels down to 1x1
+    inline int MipLevelCount(int width, int height)
+    {
+        int levels = 1;
+        while (width > 1 || height > 1)
+        {
+            width = MipSize(width);
+            height = MipSize(height);
+            ++levels;
+        }
+        return levels;
+    }
+
+    // Bytes of an RGBA8 image with all of its levels stored one after the other
+    inline size_t MipChainBytes(int width, int height)
+    {
+        size_t bytes = 0;
+        for (int level = MipLevelCount(width, height); level > 0; --level)
+        {
+            bytes += static_cast<size_t>(width) * height * 4;
+            width = MipSize(width);
+            height = MipSize(height);
+        }
+        return bytes;
+    }
+
+    // 2x2 box filter of an RGBA8 sRGB image: colour is averaged in linear light, alpha as stored. The last
+    // row or column of an odd size is repeated.
+    inline void DownsampleSRGB(const unsigned char* source, int width, int height, unsigned char* destination)
+    {
+        const SRGBTables& tables = SRGBTables::Get();
+        const int destinationWidth = MipSize(width);
+        const int destinationHeight = MipSize(height);
+        for (int y = 0; y < destinationHeight; ++y)
+        {
+            const unsigned char* row0 = source + static_cast<size_t>(2 * y) * width * 4;
+            const unsigned char* row1 = source + static_cast<size_t>(2 * y + 1 < height ? 2 * y + 1 : height - 1) * width * 4;
+            unsigned char* out = destination + static_cast<size_t>(y) * destinationWidth * 4;
+            for (int x = 0; x < destinationWidth; ++x)
+            {
+                const int x0 = 2 * x * 4;
+                const int x1 = (2 * x + 1 < width ? 2 * x + 1 : width - 1) * 4;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const unsigned int sum = tables.toLinear[row0[x0 + c]] + tables.toLinear[row0[x1 + c]]
+                        + tables.toLinear[row1[x0 + c]] + tables.toLinear[row1[x1 + c]];
+                    out[x * 4 + c] = tables.toSRGB[(sum + 2) >> 2];
+                }
+                out[x * 4 + 3] = static_cast<unsigned char>((row0[x0 + 3] + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+            }
+        }
+    }
+
+    // Fills levels 1.. of a chain laid out as by MipChainBytes, level 0 has to be in place
+    inline void BuildMipChain(unsigned char* chain, int width, int height)
+    {
+        for (int level = MipLevelCount(width, height); level > 1; --level)
+        {
+            unsigned char* next = chain + static_cast<size_t>(width) * height * 4;
+            DownsampleSRGB(chain, width, height, next);
+            chain = next;
+            width = MipSize(width);
+            height = MipSize(height);
+        }
+    }
+}
+
+#endif
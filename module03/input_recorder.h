@@ -0,0 +1,190 @@
+#ifndef INPUT_RECORDER_H
+#define INPUT_RECORDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// Mouse event captured between two frames
+struct InputEvent
+{
+    enum Type : uint8_t
+    {
+        CURSOR = 1,     // x, y: cursor position
+        SCROLL = 2      // y: scroll offset
+    };
+
+    uint8_t type;
+    double x;
+    double y;
+};
+
+// Everything the camera and scene toggles consumed during one frame
+struct InputFrame
+{
+    float deltaTime;
+    uint32_t keys;                  // One bit per key, the application defines the order
+    std::vector<InputEvent> events; // Delivered after the frame rendered, in arrival order
+};
+
+// Writes the input of each frame to a compact binary file and reads it back for a deterministic replay.
+//
+// File layout (little endian): "FPIR", uint32 version, uint32 frame count, then per frame
+// float deltaTime, uint32 keys, uint16 event count and per event uint8 type, double x, double y.
+class InputRecorder
+{
+public:
+    InputRecorder() : recording(false), replaying(false), frameCount(0), replayedFrames(0)
+    {
+        current.deltaTime = 0.0f;
+        current.keys = 0;
+    }
+
+    bool StartRecording(const char* path)
+    {
+        file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::INPUT_RECORDER::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        const uint32_t version = VERSION;
+        file.write("FPIR", 4);
+        write(version);
+        write<uint32_t>(0);     // Frame count, patched by Finish
+        recording = true;
+        return true;
+    }
+
+    bool StartReplay(const char* path)
+    {
+        file.open(path, std::ios::binary | std::ios::in);
+        char magic[4] = { 0, 0, 0, 0 };
+        uint32_t version = 0;
+        file.read(magic, 4);
+        read(version);
+        read(frameCount);
+        if (!file || memcmp(magic, "FPIR", 4) != 0 || version != VERSION)
+        {
+            std::cout << "ERROR::INPUT_RECORDER::INVALID_RECORDING " << path << std::endl;
+            return false;
+        }
+        replaying = true;
+        return true;
+    }
+
+    bool IsRecording() const
+    {
+        return recording;
+    }
+
+    bool IsReplaying() const
+    {
+        return replaying;
+    }
+
+    // Number of frames in the recording being replayed
+    uint32_t FrameCount() const
+    {
+        return frameCount;
+    }
+
+    // Recording: queues a mouse event for the current frame
+    void RecordEvent(uint8_t type, double x, double y)
+    {
+        if (!recording)
+            return;
+        InputEvent event = { type, x, y };
+        current.events.push_back(event);
+    }
+
+    // Recording: writes the current frame with its time step and pressed keys
+    void RecordFrame(float deltaTime, uint32_t keys)
+    {
+        if (!recording)
+            return;
+        write(deltaTime);
+        write(keys);
+        write(static_cast<uint16_t>(current.events.size()));
+        for (size_t i = 0; i < current.events.size(); ++i)
+        {
+            write(current.events[i].type);
+            write(current.events[i].x);
+            write(current.events[i].y);
+        }
+        current.events.clear();
+        ++frameCount;
+    }
+
+    // Replay: reads the next frame, false once the recording is exhausted
+    bool NextFrame()
+    {
+        if (!replaying || replayedFrames >= frameCount)
+            return false;
+
+        uint16_t eventCount = 0;
+        read(current.deltaTime);
+        read(current.keys);
+        read(eventCount);
+        current.events.resize(eventCount);
+        for (uint16_t i = 0; i < eventCount; ++i)
+        {
+            read(current.events[i].type);
+            read(current.events[i].x);
+            read(current.events[i].y);
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::INPUT_RECORDER::TRUNCATED_RECORDING" << std::endl;
+            return false;
+        }
+        ++replayedFrames;
+        return true;
+    }
+
+    // Replay: the frame returned by the last NextFrame
+    const InputFrame& Frame() const
+    {
+        return current;
+    }
+
+    // Closes the file, a recording gets its final frame count
+    void Finish()
+    {
+        if (recording)
+        {
+            file.seekp(8);
+            write(frameCount);
+            std::cout << "INFO: Recorded " << frameCount << " frames of input" << std::endl;
+        }
+        if (file.is_open())
+            file.close();
+        recording = replaying = false;
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+
+    std::fstream file;
+    bool recording;
+    bool replaying;
+    uint32_t frameCount;
+    uint32_t replayedFrames;
+    InputFrame current;
+
+    template <typename T>
+    void write(const T& value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void read(T& value)
+    {
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+};
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef LZ_IMAGE_H
+#define LZ_IMAGE_H
+
+#include <stb_image.h>
+
+#include "image_kernels.h"
+#include "image_kernel_bench.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Lossless image container for the textures the loader would otherwise decode from PNG. The rows are stored
+// already flipped for OpenGL, each as its difference to the row before (the PNG "up" filter), and compressed
+// in the LZ4 block format. Decoding is one pass of byte copies and one pass of byte additions, both 16 bytes
+// at a time with SSE2, instead of inflate and PNG's per-row filters; the files are larger than the PNGs.
+//
+// File layout (little-endian): "FPLZ", version, width, height, channels (3 or 4), compressed size, then the
+// compressed rows, bottom row first.
+namespace lzimage
+{
+    const char* const EXTENSION = ".lzi";
+    const uint32_t VERSION = 1;
+    const size_t HEADER_BYTES = 24;
+    const int MAX_SIZE = 16384;             // Per side, so width * height * channels stays below 2^30
+    const size_t MAX_EXPANSION = 256;       // An LZ4 length byte stands for at most 255 output bytes
+
+    const size_t MIN_MATCH = 4;
+    const size_t LAST_LITERALS = 5;         // LZ4: the block ends with at least 5 literals
+    const size_t MATCH_START_LIMIT = 12;    // LZ4: the last match starts at least 12 bytes before the end
+    const size_t MAX_OFFSET = 65535;
+    const int HASH_BITS = 16;
+
+    struct Image
+    {
+        int width;
+        int height;
+        int channels;
+    };
+
+    inline uint32_t read32(const unsigned char* bytes)
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    inline void put32(std::vector<unsigned char>& bytes, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            bytes.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+
+    inline void putLength(std::vector<unsigned char>& output, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            output.push_back(255);
+        output.push_back(static_cast<unsigned char>(length));
+    }
+
+    // One LZ4 sequence: literals followed by a match, or the final literals when matchLength is 0
+    inline void putSequence(std::vector<unsigned char>& output, const unsigned char* literals, size_t literalLength, size_t offset, size_t matchLength)
+    {
+        const size_t matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+        output.push_back(static_cast<unsigned char>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15)));
+        if (literalLength >= 15)
+            putLength(output, literalLength - 15);
+        output.insert(output.end(), literals, literals + literalLength);
+        if (matchLength == 0)
+            return;
+        output.push_back(static_cast<unsigned char>(offset));
+        output.push_back(static_cast<unsigned char>(offset >> 8));
+        if (matchCode >= 15)
+            putLength(output, matchCode - 15);
+    }
+
+    // LZ4 block of the input with greedy matches, found through a hash table of the 4 bytes at each position
+    inline void Compress(const unsigned char* input, size_t size, std::vector<unsigned char>& output)
+    {
+        output.clear();
+        output.reserve(size + size / 255 + 16);
+        std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+        size_t anchor = 0;
+        size_t position = 0;
+        while (size > MATCH_START_LIMIT && position <= size - MATCH_START_LIMIT)
+        {
+            const uint32_t sequence = read32(input + position);
+            const uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+            const size_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(position);
+            if (candidate >= position || position - candidate > MAX_OFFSET || read32(input + candidate) != sequence)
+            {
+                ++position;
+                continue;
+            }
+            size_t length = MIN_MATCH;
+            while (position + length < size - LAST_LITERALS && input[candidate + length] == input[position + length])
+                ++length;
+            putSequence(output, input + anchor, position - anchor, position - candidate, length);
+            position += length;
+            anchor = position;
+        }
+        putSequence(output, input + anchor, size - anchor, 0, 0);
+    }
+
+    inline bool readLength(const unsigned char*& input, const unsigned char* inputEnd, size_t& length)
+    {
+        unsigned char byte;
+        do
+        {
+            if (input >= inputEnd)
+                return false;
+            byte = *input++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    // Copies a match that may overlap what it writes: chunks of whole repeats of the offset, doubling as the
+    // copied part grows, so a run of one repeated byte takes a handful of memcpy calls
+    inline void copyMatch(unsigned char* output, size_t offset, size_t length, const unsigned char* outputEnd)
+    {
+#ifdef IMAGE_KERNELS_SSE2
+        // Chunks of 16 bytes only ever read bytes already written; the last one may write past the match, which
+        // the next sequence overwrites
+        if (offset >= 16 && static_cast<size_t>(outputEnd - output) >= ((length + 15) & ~size_t(15)))
+        {
+            const unsigned char* match = output - offset;
+            for (size_t i = 0; i < length; i += 16)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(match + i)));
+            return;
+        }
+#else
+        (void)outputEnd;
+#endif
+        for (size_t copied = 0, period = offset; copied < length; period *= 2)
+        {
+            const size_t chunk = std::min(period, length - copied);
+            memcpy(output + copied, output + copied - period, chunk);
+            copied += chunk;
+        }
+    }
+
+    // Decodes an LZ4 block into exactly size bytes; false when the block is malformed or does not fill them
+    inline bool Decompress(const unsigned char* input, size_t inputSize, unsigned char* output, size_t size)
+    {
+        const unsigned char* const inputEnd = input + inputSize;
+        unsigned char* const outputStart = output;
+        unsigned char* const outputEnd = output + size;
+        for (;;)
+        {
+            if (input >= inputEnd)
+                return false;
+            const unsigned int token = *input++;
+
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(input, inputEnd, literals))
+                return false;
+            if (literals > static_cast<size_t>(inputEnd - input) || literals > static_cast<size_t>(outputEnd - output))
+                return false;
+#ifdef IMAGE_KERNELS_SSE2
+            // Short literal runs are copied as one 16 byte block where both buffers have room for it
+            if (literals <= 16 && inputEnd - input >= 16 && outputEnd - output >= 16)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_loadu_si128(reinterpret_cast<const __m128i*>(input)));
+            else
+#endif
+                memcpy(output, input, literals);
+            input += literals;
+            output += literals;
+            if (input == inputEnd)
+                return output == outputEnd;
+
+            if (inputEnd - input < 2)
+                return false;
+            const size_t offset = input[0] | (input[1] << 8);
+            input += 2;
+            size_t length = (token & 15) + MIN_MATCH;
+            if ((token & 15) == 15 && !readLength(input, inputEnd, length))
+                return false;
+            if (offset == 0 || offset > static_cast<size_t>(output - outputStart) || length > static_cast<size_t>(outputEnd - output))
+                return false;
+            copyMatch(output, offset, length, outputEnd);
+            output += length;
+        }
+    }
+
+    // Replaces every row but the first by its difference to the row before
+    inline void FilterRows(unsigned char* pixels, size_t rowBytes, int height)
+    {
+        for (int y = height - 1; y > 0; --y)
+        {
+            unsigned char* row = pixels + static_cast<size_t>(y) * rowBytes;
+            const unsigned char* above = row - rowBytes;
+            for (size_t i = 0; i < rowBytes; ++i)
+                row[i] = static_cast<unsigned char>(row[i] - above[i]);
+        }
+    }
+
+    // Undoes FilterRows, top to bottom in memory order
+    inline void UnfilterRows(unsigned char* pixels, size_t rowBytes, int height)
+    {
+        for (int y = 1; y < height; ++y)
+        {
+            unsigned char* row = pixels + static_cast<size_t>(y) * rowBytes;
+            const unsigned char* above = row - rowBytes;
+            size_t i = 0;
+#ifdef IMAGE_KERNELS_SSE2
+            for (; i + 16 <= rowBytes; i += 16)
+            {
+                const __m128i sum = _mm_add_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), sum);
+            }
+#endif
+            for (; i < rowBytes; ++i)
+                row[i] = static_cast<unsigned char>(row[i] + above[i]);
+        }
+    }
+
+    // Container of an image as stb_image decodes it (top row first)
+    inline void Encode(const unsigned char* pixels, int width, int height, int channels, std::vector<unsigned char>& file)
+    {
+        std::vector<unsigned char> rows(pixels, pixels + static_cast<size_t>(width) * height * channels);
+        imagekernels::FlipRows(&rows[0], width, height, channels);
+        FilterRows(&rows[0], static_cast<size_t>(width) * channels, height);
+        std::vector<unsigned char> compressed;
+        Compress(&rows[0], rows.size(), compressed);
+
+        const char magic[4] = { 'F', 'P', 'L', 'Z' };
+        file.assign(magic, magic + 4);
+        put32(file, VERSION);
+        put32(file, width);
+        put32(file, height);
+        put32(file, channels);
+        put32(file, static_cast<uint32_t>(compressed.size()));
+        file.insert(file.end(), compressed.begin(), compressed.end());
+    }
+
+    // Size and channels of the image in a container, false when it is not one. The size is checked before the
+    // caller allocates anything for it: at most MAX_SIZE per side, and no more than the compressed rows can
+    // expand to, so a corrupt header cannot ask for more memory than its file could fill.
+    inline bool ReadHeader(const std::vector<unsigned char>& file, Image& image)
+    {
+        if (file.size() < HEADER_BYTES || memcmp(&file[0], "FPLZ", 4) != 0 || read32(&file[4]) != VERSION)
+            return false;
+        const uint32_t width = read32(&file[8]);
+        const uint32_t height = read32(&file[12]);
+        const uint32_t channels = read32(&file[16]);
+        const size_t compressedSize = file.size() - HEADER_BYTES;
+        if (width == 0 || height == 0 || width > static_cast<uint32_t>(MAX_SIZE) || height > static_cast<uint32_t>(MAX_SIZE)
+            || (channels != 3 && channels != 4) || read32(&file[20]) != compressedSize
+            || static_cast<uint64_t>(width) * height * channels > static_cast<uint64_t>(compressedSize + 1) * MAX_EXPANSION)
+            return false;
+        image.width = static_cast<int>(width);
+        image.height = static_cast<int>(height);
+        image.channels = static_cast<int>(channels);
+        return true;
+    }
+
+    // Decodes a container into width * height * channels bytes, bottom row first
+    inline bool Decode(const std::vector<unsigned char>& file, unsigned char* pixels)
+    {
+        Image image;
+        if (!ReadHeader(file, image))
+            return false;
+        const size_t rowBytes = static_cast<size_t>(image.width) * image.channels;
+        if (!Decompress(&file[HEADER_BYTES], file.size() - HEADER_BYTES, pixels, rowBytes * image.height))
+            return false;
+        UnfilterRows(pixels, rowBytes, image.height);
+        return true;
+    }
+
+    inline bool ReadFile(const char* path, std::vector<unsigned char>& bytes)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    inline bool IsContainerPath(const std::string& path)
+    {
+        const size_t length = strlen(EXTENSION);
+        return path.size() >= length && path.compare(path.size() - length, length, EXTENSION) == 0;
+    }
+
+    // stb_image decode of an image file as RGB8 or RGBA8 (grey images gain colour channels)
+    inline unsigned char* loadColor(const unsigned char* bytes, size_t size, int& width, int& height, int& channels)
+    {
+        if (!stbi_info_from_memory(bytes, static_cast<int>(size), &width, &height, &channels))
+            return NULL;
+        channels = channels == 2 || channels == 4 ? 4 : 3;
+        int fileChannels = 0;
+        return stbi_load_from_memory(bytes, static_cast<int>(size), &width, &height, &fileChannels, channels);
+    }
+
+    // Converts an image file into a container
+    inline bool Cook(const char* imagePath, const char* containerPath, std::ostream& out)
+    {
+        std::vector<unsigned char> bytes;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        unsigned char* decoded = ReadFile(imagePath, bytes) && !bytes.empty() ? loadColor(&bytes[0], bytes.size(), width, height, channels) : NULL;
+        if (decoded == NULL)
+        {
+            out << "ERROR::LZ_IMAGE::CANNOT_DECODE " << imagePath << std::endl;
+            return false;
+        }
+        if (width > MAX_SIZE || height > MAX_SIZE)
+        {
+            out << "ERROR::LZ_IMAGE::TOO_LARGE " << imagePath << " is " << width << "x" << height << ", at most " << MAX_SIZE << " texels per side" << std::endl;
+            stbi_image_free(decoded);
+            return false;
+        }
+        std::vector<unsigned char> file;
+        Encode(decoded, width, height, channels, file);
+        stbi_image_free(decoded);
+
+        std::ofstream output(containerPath, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(&file[0]), file.size());
+        if (!output)
+        {
+            out << "ERROR::LZ_IMAGE::CANNOT_WRITE " << containerPath << std::endl;
+            output.close();
+            std::remove(containerPath);
+            return false;
+        }
+        out << "INFO: " << imagePath << " (" << width << "x" << height << ", " << channels << " channels) " << bytes.size() / 1024 << " KB -> "
+            << containerPath << " " << file.size() / 1024 << " KB" << std::endl;
+        return true;
+    }
+
+    // Decode throughput of an image file through stb_image and of its container, both from memory, in MB of
+    // decoded pixels per second; the container's rows come out flipped, so stb_image's time includes the flip
+    // the loader does after it
+    inline bool RunBench(const char* imagePath, std::ostream& out)
+    {
+        std::vector<unsigned char> bytes;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        unsigned char* decoded = ReadFile(imagePath, bytes) && !bytes.empty() ? loadColor(&bytes[0], bytes.size(), width, height, channels) : NULL;
+        if (decoded == NULL)
+        {
+            out << "ERROR::LZ_IMAGE::CANNOT_DECODE " << imagePath << std::endl;
+            return false;
+        }
+        if (width > MAX_SIZE || height > MAX_SIZE)
+        {
+            out << "ERROR::LZ_IMAGE::TOO_LARGE " << imagePath << " is " << width << "x" << height << ", at most " << MAX_SIZE << " texels per side" << std::endl;
+            stbi_image_free(decoded);
+            return false;
+        }
+        std::vector<unsigned char> file;
+        Encode(decoded, width, height, channels, file);
+        stbi_image_free(decoded);
+
+        const size_t pixelBytes = static_cast<size_t>(width) * height * channels;
+        std::vector<unsigned char> expected;
+        const double stbTime = imagekernels::bestTime([] {}, [&]
+        {
+            int w;
+            int h;
+            int fileChannels;
+            unsigned char* pixels = stbi_load_from_memory(&bytes[0], static_cast<int>(bytes.size()), &w, &h, &fileChannels, channels);
+            imagekernels::FlipRows(pixels, w, h, channels);
+            expected.assign(pixels, pixels + pixelBytes);
+            stbi_image_free(pixels);
+        });
+        std::vector<unsigned char> actual(pixelBytes);
+        bool decodedAll = true;
+        const double containerTime = imagekernels::bestTime([] {}, [&] { decodedAll = Decode(file, &actual[0]) && decodedAll; });
+
+        const double MB = 1024.0 * 1024.0;
+        out << "INFO: Decode of " << imagePath << " (" << width << "x" << height << ", " << channels << " channels, "
+            << pixelBytes / MB << " MB of pixels)"
+#ifdef IMAGE_KERNELS_SSE2
+            << ", SSE2"
+#endif
+            << std::endl;
+        out << "  stb_image + flip  " << bytes.size() / 1024 << " KB file, " << stbTime << " ms, " << pixelBytes / MB / (stbTime / 1000.0) << " MB/s" << std::endl;
+        out << "  " << EXTENSION << " container    " << file.size() / 1024 << " KB file, " << containerTime << " ms, " << pixelBytes / MB / (containerTime / 1000.0)
+            << " MB/s, " << stbTime / containerTime << "x faster, " << (decodedAll && actual == expected ? "identical pixels" : "PIXELS DIFFER") << std::endl;
+        return decodedAll && actual == expected;
+    }
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Scoped CPU profiling zones, exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Build with ENABLE_PROFILER defined to record; otherwise every macro expands to nothing.
+//
+//   PROFILE_ZONE("URender");        // zone ends with the enclosing scope
+//
+//   PROFILE_SECTIONS();             // consecutive zones in one scope, each PROFILE_SECTION ends the previous one
+//   PROFILE_SECTION("Plane");
+//   PROFILE_SECTION("Cylinder");
+//
+// Zone names must be string literals (or otherwise outlive the profiler), only the pointer is stored.
+
+#ifdef ENABLE_PROFILER
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace profiler
+{
+    struct Event
+    {
+        const char* name;
+        int64_t start;      // Nanoseconds since the profiler epoch
+        int64_t duration;
+    };
+
+    // Events of one thread; only that thread appends to it so recording takes no lock
+    struct ThreadBuffer
+    {
+        std::vector<Event> events;
+        unsigned int threadId;
+    };
+
+    // Every thread buffer ever created, the mutex is only taken when a thread records its first zone and on export
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<ThreadBuffer*> buffers;
+        std::chrono::steady_clock::time_point epoch;
+
+        Registry() : epoch(std::chrono::steady_clock::now())
+        {
+        }
+    };
+
+    inline Registry& registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    inline ThreadBuffer& threadBuffer()
+    {
+        // Buffers are intentionally never freed so the export can still read threads that already exited
+        thread_local ThreadBuffer* buffer = NULL;
+        if (buffer == NULL)
+        {
+            buffer = new ThreadBuffer();
+            buffer->events.reserve(1 << 16);
+
+            Registry& shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            buffer->threadId = static_cast<unsigned int>(shared.buffers.size()) + 1;
+            shared.buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    inline int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+    }
+
+    class Zone
+    {
+    public:
+        explicit Zone(const char* zoneName) : name(zoneName), start(now())
+        {
+        }
+
+        ~Zone()
+        {
+            Event event = { name, start, now() - start };
+            threadBuffer().events.push_back(event);
+        }
+
+    private:
+        const char* name;
+        int64_t start;
+
+        Zone(const Zone&);
+        Zone& operator=(const Zone&);
+    };
+
+    // Sequence of back to back zones, used for the blocks of a long function that share local variables
+    class Sections
+    {
+    public:
+        Sections() : name(NULL), start(0)
+        {
+        }
+
+        ~Sections()
+        {
+            close();
+        }
+
+        void Next(const char* sectionName)
+        {
+            close();
+            name = sectionName;
+            start = now();
+        }
+
+    private:
+        const char* name;
+        int64_t start;
+
+        void close()
+        {
+            if (name == NULL)
+                return;
+            Event event = { name, start, now() - start };
+            threadBuffer().events.push_back(event);
+            name = NULL;
+        }
+
+        Sections(const Sections&);
+        Sections& operator=(const Sections&);
+    };
+
+    // Writes all recorded zones as complete ("X") events; call once the other threads stopped recording
+    inline bool WriteChromeTrace(const char* path)
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+
+        Registry& shared = registry();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for (size_t b = 0; b < shared.buffers.size(); ++b)
+        {
+            const ThreadBuffer& buffer = *shared.buffers[b];
+            for (size_t i = 0; i < buffer.events.size(); ++i)
+            {
+                const Event& event = buffer.events[i];
+                file << (first ? "\n" : ",\n")
+                    << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.threadId
+                    << ",\"ts\":" << event.start / 1000 << "." << (event.start % 1000) / 100
+                    << ",\"dur\":" << event.duration / 1000 << "." << (event.duration % 1000) / 100 << "}";
+                first = false;
+            }
+        }
+        file << "\n]}\n";
+        return file.good();
+    }
+}
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#define PROFILE_ZONE(name) profiler::Zone PROFILER_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_SECTIONS() profiler::Sections profileSections
+#define PROFILE_SECTION(name) profileSections.Next(name)
+#define PROFILER_ENABLED 1
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_SECTIONS() ((void)0)
+#define PROFILE_SECTION(name) ((void)0)
+#define PROFILER_ENABLED 0
+
+namespace profiler
+{
+    inline bool WriteChromeTrace(const char*)
+    {
+        return false;
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef PROGRAM_BINARY_CACHE_H
+#define PROGRAM_BINARY_CACHE_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Linked program binaries on disk, one file per program. The file name is built from the hash of the
+// program sources (defines included) and of the driver vendor, renderer and version, so a driver update
+// simply misses the old files. A blob the driver rejects is reported as a miss and the caller compiles
+// from source.
+//
+// File layout: "FPPB", uint32 version, uint64 source hash, uint32 driver string length, driver string,
+// uint32 binary format, uint32 binary length, binary.
+class ProgramBinaryCache
+{
+public:
+    ProgramBinaryCache() : enabled(false), driverHash(0), hits(0), misses(0), rejected(0)
+    {
+    }
+
+    // Needs a current context; the cache stays disabled when the driver offers no binary format
+    bool Open(const char* directoryPath)
+    {
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+        {
+            std::cout << "INFO: Program binary cache disabled, the driver has no binary formats" << std::endl;
+            return false;
+        }
+
+        driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+        driverHash = hash(FNV_OFFSET_BASIS, driver);
+        directory = directoryPath;
+#ifdef _WIN32
+        _mkdir(directoryPath);
+#else
+        mkdir(directoryPath, 0755);
+#endif
+        enabled = true;
+        return true;
+    }
+
+    bool IsEnabled() const
+    {
+        return enabled;
+    }
+
+    // Creates programId from the cached binary of the sources, false when there is none or the driver rejects it
+    bool Load(uint64_t sourceHash, GLuint& programId)
+    {
+        if (!enabled)
+            return false;
+
+        std::ifstream file(path(sourceHash).c_str(), std::ios::binary);
+        if (!file)
+        {
+            ++misses;
+            return false;
+        }
+        file.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0, std::ios::beg);
+
+        // The lengths are checked against the rest of the file before anything is allocated for them, a corrupt
+        // entry is only rejected and the program compiled from source
+        char magic[4] = { 0, 0, 0, 0 };
+        uint32_t version = 0;
+        uint64_t storedSourceHash = 0;
+        uint32_t driverLength = 0;
+        file.read(magic, 4);
+        read(file, version);
+        read(file, storedSourceHash);
+        read(file, driverLength);
+        const bool driverFits = file && driverLength <= bytesLeft(file, fileSize);
+        std::string storedDriver(driverFits ? driverLength : 0, '\0');
+        if (!storedDriver.empty())
+            file.read(&storedDriver[0], driverLength);
+        uint32_t format = 0;
+        uint32_t length = 0;
+        read(file, format);
+        read(file, length);
+        const bool binaryFits = file && length <= bytesLeft(file, fileSize);
+        std::vector<char> binary(binaryFits ? length : 0);
+        if (!binary.empty())
+            file.read(&binary[0], length);
+
+        if (!driverFits || !binaryFits || !file || memcmp(magic, "FPPB", 4) != 0 || version != VERSION || storedSourceHash != sourceHash
+            || storedDriver != driver || binary.empty())
+        {
+            ++rejected;
+            return false;
+        }
+
+        programId = glCreateProgram();
+        glProgramBinary(programId, format, &binary[0], length);
+        GLint success = GL_FALSE;
+        glGetProgramiv(programId, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(programId);
+            programId = 0;
+            ++rejected;
+            return false;
+        }
+        ++hits;
+        return true;
+    }
+
+    // Writes the binary of a freshly linked program (link it with GL_PROGRAM_BINARY_RETRIEVABLE_HINT)
+    void Store(uint64_t sourceHash, GLuint programId)
+    {
+        if (!enabled)
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(programId, length, &length, &format, &binary[0]);
+
+        const std::string filePath = path(sourceHash);
+        std::ofstream file(filePath.c_str(), std::ios::binary | std::ios::trunc);
+        const uint32_t version = VERSION;
+        const uint32_t driverLength = static_cast<uint32_t>(driver.size());
+        const uint32_t binaryFormat = format;
+        const uint32_t binaryLength = static_cast<uint32_t>(length);
+        file.write("FPPB", 4);
+        write(file, version);
+        write(file, sourceHash);
+        write(file, driverLength);
+        file.write(driver.data(), driver.size());
+        write(file, binaryFormat);
+        write(file, binaryLength);
+        file.write(&binary[0], length);
+        if (!file)
+        {
+            std::cout << "ERROR::PROGRAM_BINARY_CACHE::CANNOT_WRITE " << filePath << std::endl;
+            file.close();
+            remove(filePath.c_str());
+        }
+    }
+
+    void Print(std::ostream& out) const
+    {
+        if (!enabled)
+            return;
+        out << "INFO: Program binary cache: " << hits << " loaded, " << misses << " not cached, "
+            << rejected << " rejected" << std::endl;
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+    static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    static const uint64_t FNV_PRIME = 1099511628211ull;
+
+    bool enabled;
+    std::string directory;
+    std::string driver;
+    uint64_t driverHash;
+    int hits;
+    int misses;
+    int rejected;
+
+    std::string path(uint64_t sourceHash) const
+    {
+        char name[40];
+        snprintf(name, sizeof(name), "/%016llx.bin", static_cast<unsigned long long>(sourceHash ^ driverHash));
+        return directory + name;
+    }
+
+    static std::string glString(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+
+    static uint64_t hash(uint64_t value, const std::string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            value ^= static_cast<unsigned char>(text[i]);
+            value *= FNV_PRIME;
+        }
+        return value;
+    }
+
+    // Bytes between the read position and the end of a file of fileSize bytes
+    static uint64_t bytesLeft(std::ifstream& file, uint64_t fileSize)
+    {
+        const uint64_t position = static_cast<uint64_t>(file.tellg());
+        return position <= fileSize ? fileSize - position : 0;
+    }
+
+    template <typename T>
+    static void write(std::ofstream& file, const T& value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static void read(std::ifstream& file, T& value)
+    {
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+};
+
+#endif
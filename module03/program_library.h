@@ -0,0 +1,241 @@
+#ifndef PROGRAM_LIBRARY_H
+#define PROGRAM_LIBRARY_H
+
+#include <GL/glew.h>
+
+#include "program_binary_cache.h"
+#include "shader_compiler.h"
+#include "shader_preprocessor.h"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Shares linked shader programs between everything that asks for the same stage sources and defines.
+// Sources go through the library's ShaderPreprocessor first (#include and define injection), requests
+// are keyed by a 64-bit FNV-1a hash of the resulting code; an identical request gets the same program
+// and bumps its reference count, the program is deleted when the last user releases it. With a binary
+// cache attached, a program not linked in this run is first looked up on disk.
+//
+// Compilation does not block: Request submits the program to the driver right away and returns, Poll
+// picks up the programs the driver has finished, and Finish waits for the rest and reports every
+// compile and link error of the batch at once.
+class ProgramLibrary
+{
+public:
+    ProgramLibrary() : binaryCache(NULL), requests(0), links(0)
+    {
+    }
+
+    // Register includes and include directories here before requesting programs that use them
+    ShaderPreprocessor& Preprocessor()
+    {
+        return preprocessor;
+    }
+
+    // Programs are loaded from and stored to this cache from now on, NULL to compile everything from source
+    void SetBinaryCache(ProgramBinaryCache* cache)
+    {
+        binaryCache = cache;
+    }
+
+    // Asks for a program for the stage sources, compiling it only on the first request. programId is
+    // written once the program is ready (right away when it is shared or cached, otherwise by Poll or
+    // Finish) and has to stay valid until then; it stays 0 if the program fails to build. Defines are
+    // "#define NAME VALUE" lines inserted after the #version line of both stages. The name only labels errors.
+    void Request(const std::string& name, const char* vertexSource, const char* fragmentSource, GLuint& programId, const std::string& defines = "")
+    {
+        ++requests;
+        programId = 0;
+        std::string vertex;
+        std::string fragment;
+        std::string log;
+        if (!preprocessor.Process(vertexSource, defines, vertex, log) || !preprocessor.Process(fragmentSource, defines, fragment, log))
+        {
+            errors += "ERROR::PROGRAM_LIBRARY::" + name + "\n" + log;
+            return;
+        }
+
+        uint64_t key = hash(FNV_OFFSET_BASIS, "VERTEX");
+        key = hash(key, vertex);
+        key = hash(key, "FRAGMENT");
+        key = hash(key, fragment);
+
+        std::map<uint64_t, Entry>::iterator it = programs.find(key);
+        if (it != programs.end())
+        {
+            // Compare the sources too, a hash collision must not hand out the wrong program
+            if (it->second.vertexSource == vertex && it->second.fragmentSource == fragment)
+            {
+                ++it->second.references;
+                if (it->second.programId != 0)
+                    programId = it->second.programId;
+                else
+                    pendingJob(key).outputs.push_back(&programId);
+                return;
+            }
+            std::cout << "ERROR::PROGRAM_LIBRARY::HASH_COLLISION " << name << std::endl;
+            submit(name, key, false, vertex, fragment, programId);
+            return;
+        }
+
+        Entry& entry = programs[key];
+        entry.programId = 0;
+        entry.references = 1;
+        entry.vertexSource = vertex;
+        entry.fragmentSource = fragment;
+
+        if (binaryCache != NULL && binaryCache->Load(key, entry.programId))
+            programId = entry.programId;
+        else
+            submit(name, key, true, vertex, fragment, programId);
+    }
+
+    // Collects the programs the driver has finished without waiting for the others, true when none is pending
+    bool Poll()
+    {
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (compiler.IsComplete(pending[i].job))
+            {
+                collect(pending[i]);
+                pending.erase(pending.begin() + i);
+            }
+            else
+                ++i;
+        }
+        return pending.empty();
+    }
+
+    // Waits for every pending program and prints all errors in one report, false if any program failed
+    bool Finish()
+    {
+        Poll();
+        for (size_t i = 0; i < pending.size(); ++i)
+            collect(pending[i]);
+        pending.clear();
+
+        if (errors.empty())
+            return true;
+        std::cout << errors << std::flush;
+        errors.clear();
+        return false;
+    }
+
+    // Drops one reference, the program is deleted with the last one. Release every requested program
+    // only after Finish.
+    void Release(GLuint programId)
+    {
+        if (programId == 0)
+            return;
+        for (std::map<uint64_t, Entry>::iterator it = programs.begin(); it != programs.end(); ++it)
+        {
+            if (it->second.programId != programId)
+                continue;
+            if (--it->second.references == 0)
+            {
+                glDeleteProgram(programId);
+                programs.erase(it);
+            }
+            return;
+        }
+        // Not shared (collision fallback), owned by the caller alone
+        glDeleteProgram(programId);
+    }
+
+    void Print(std::ostream& out) const
+    {
+        out << "INFO: " << requests << " shader program requests, " << links << " programs linked"
+            << (compiler.IsParallel() ? " (parallel compile)" : "") << std::endl;
+        if (binaryCache != NULL)
+            binaryCache->Print(out);
+    }
+
+private:
+    static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    static const uint64_t FNV_PRIME = 1099511628211ull;
+
+    struct Entry
+    {
+        GLuint programId;       // 0 while compiling or after a failure
+        int references;
+        std::string vertexSource;
+        std::string fragmentSource;
+    };
+
+    // A program the driver is still working on
+    struct Pending
+    {
+        std::string name;
+        uint64_t key;
+        bool shared;            // False for the collision fallback, which is not in programs
+        ShaderCompiler::Job job;
+        std::vector<GLuint*> outputs;
+    };
+
+    ShaderPreprocessor preprocessor;
+    ShaderCompiler compiler;
+    ProgramBinaryCache* binaryCache;
+    std::map<uint64_t, Entry> programs;
+    std::vector<Pending> pending;
+    std::string errors;
+    int requests;
+    int links;
+
+    void submit(const std::string& name, uint64_t key, bool shared, const std::string& vertex, const std::string& fragment, GLuint& programId)
+    {
+        Pending job;
+        job.name = name;
+        job.key = key;
+        job.shared = shared;
+        job.job = compiler.Submit(vertex.c_str(), fragment.c_str());
+        job.outputs.push_back(&programId);
+        pending.push_back(job);
+    }
+
+    // Shared entries without a program always have a job in flight, failed ones are removed
+    Pending& pendingJob(uint64_t key)
+    {
+        size_t i = 0;
+        while (!(pending[i].shared && pending[i].key == key))
+            ++i;
+        return pending[i];
+    }
+
+    void collect(Pending& program)
+    {
+        std::string log;
+        if (!compiler.Collect(program.job, log))
+        {
+            errors += "ERROR::PROGRAM_LIBRARY::" + program.name + "\n" + log;
+            if (program.shared)
+                programs.erase(program.key);
+            return;
+        }
+        ++links;
+        for (size_t i = 0; i < program.outputs.size(); ++i)
+            *program.outputs[i] = program.job.program;
+        if (!program.shared)
+            return;
+        programs[program.key].programId = program.job.program;
+        if (binaryCache != NULL)
+            binaryCache->Store(program.key, program.job.program);
+    }
+
+    static uint64_t hash(uint64_t value, const std::string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            value ^= static_cast<unsigned char>(text[i]);
+            value *= FNV_PRIME;
+        }
+        // Terminator so that ("ab", "c") and ("a", "bc") hash differently
+        value ^= 0xFF;
+        value *= FNV_PRIME;
+        return value;
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PROGRAM_VARIANTS_H
+#define PROGRAM_VARIANTS_H
+
+#include <GL/glew.h>
+
+#include "program_library.h"
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// Specialized programs of one shader pair, one per define set. A variant is named by its defines as
+// "NAME=VALUE NAME=VALUE" (a bare NAME means 1) and is compiled the first time it is asked for, then
+// kept; shaders select features with #if on the defines instead of branching on uniforms. Prepare
+// starts compiling variants that are known to be needed without waiting for them.
+class ProgramVariants
+{
+public:
+    ProgramVariants(ProgramLibrary& programLibrary, const char* programName, const char* vertex, const char* fragment)
+        : library(programLibrary), name(programName), vertexSource(vertex), fragmentSource(fragment)
+    {
+    }
+
+    // Submits a variant to the driver, the library's Poll or Finish collects it
+    void Prepare(const std::string& defines)
+    {
+        if (programs.count(defines))
+            return;
+        library.Request(name + " [" + defines + "]", vertexSource, fragmentSource, programs[defines], defineLines(defines));
+    }
+
+    // The program of a variant, compiled on first use (which waits for the driver); 0 if it failed to build
+    GLuint Get(const std::string& defines)
+    {
+        std::map<std::string, GLuint>::iterator it = programs.find(defines);
+        if (it != programs.end() && it->second != 0)
+            return it->second;
+
+        if (it == programs.end())
+        {
+            std::cout << "INFO: Compiling " << name << " variant [" << defines << "] on demand" << std::endl;
+            Prepare(defines);
+        }
+        library.Finish();
+        return programs[defines];
+    }
+
+    // Number of variants requested so far
+    size_t Count() const
+    {
+        return programs.size();
+    }
+
+    // Releases every variant
+    void Release()
+    {
+        for (std::map<std::string, GLuint>::iterator it = programs.begin(); it != programs.end(); ++it)
+            library.Release(it->second);
+        programs.clear();
+    }
+
+private:
+    ProgramLibrary& library;
+    std::string name;
+    const char* vertexSource;
+    const char* fragmentSource;
+    std::map<std::string, GLuint> programs;     // Node addresses are stable, the library writes the ids in place
+
+    // "A=1 B" to "#define A 1\n#define B 1\n"
+    static std::string defineLines(const std::string& defines)
+    {
+        std::istringstream words(defines);
+        std::string word;
+        std::string lines;
+        while (words >> word)
+        {
+            const size_t equals = word.find('=');
+            if (equals == std::string::npos)
+                lines += "#define " + word + " 1\n";
+            else
+                lines += "#define " + word.substr(0, equals) + " " + word.substr(equals + 1) + "\n";
+        }
+        return lines;
+    }
+
+    ProgramVariants(const ProgramVariants&);
+    ProgramVariants& operator=(const ProgramVariants&);
+};
+
+#endif
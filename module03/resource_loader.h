@@ -0,0 +1,223 @@
+#ifndef RESOURCE_LOADER_H
+#define RESOURCE_LOADER_H
+
+#include <GL/glew.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+// Creates GL resources on a loader thread whose context shares objects with the render context. Each job
+// runs on the loader thread and is followed by a fence; the render thread polls the fences once per frame
+// and runs a job's completion only when its fence has signalled, so it never uses a buffer or texture the
+// GPU has not finished filling. Vertex arrays and other container objects are not shared between
+// contexts, completions create those on the render thread.
+//
+// Started without a context binder (no shared context, or a traced build whose call counters are not
+// thread-safe) the loader runs every job synchronously in Submit; completions still go through Poll.
+class ResourceLoader
+{
+public:
+    // Makes the loader context current on the calling thread (true) or releases it (false)
+    typedef std::function<bool(bool)> ContextBinder;
+    // Runs on the loader thread, false when the resource could not be created
+    typedef std::function<bool()> Job;
+    // Runs on the render thread once the job's GL commands have completed, with the job's result
+    typedef std::function<void(bool)> Completion;
+
+    ResourceLoader() : running(false), busy(false), stopping(false), contextBound(false), contextFailed(false)
+    {
+    }
+
+    ~ResourceLoader()
+    {
+        Stop();
+    }
+
+    bool Start(const ContextBinder& contextBinder)
+    {
+        if (!contextBinder)
+            return true;
+        binder = contextBinder;
+        running = true;
+        worker = std::thread(&ResourceLoader::work, this);
+
+        // Report a context that cannot be made current here rather than through every job
+        std::unique_lock<std::mutex> lock(mutex);
+        started.wait(lock, [this] { return contextBound || contextFailed; });
+        if (contextFailed)
+        {
+            lock.unlock();
+            worker.join();
+            running = false;
+            std::cout << "ERROR::RESOURCE_LOADER::CONTEXT_UNAVAILABLE, loading on the render thread" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool IsThreaded() const
+    {
+        return running;
+    }
+
+    void Submit(const Job& job, const Completion& completion)
+    {
+        Entry entry;
+        entry.job = job;
+        entry.completion = completion;
+        entry.result = false;
+        entry.fence = 0;
+        if (!running)
+        {
+            run(entry);
+            std::lock_guard<std::mutex> lock(mutex);
+            done.push_back(entry);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(entry);
+        }
+        workAvailable.notify_one();
+    }
+
+    // Render thread: runs the completions of the finished jobs in submission order, returns the number of
+    // jobs not completed yet
+    size_t Poll()
+    {
+        for (;;)
+        {
+            Entry entry;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (done.empty())
+                    return queued.size() + (busy ? 1 : 0);
+                const GLenum status = glClientWaitSync(done.front().fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                    return done.size() + queued.size() + (busy ? 1 : 0);
+                entry = done.front();
+                done.pop_front();
+            }
+            glDeleteSync(entry.fence);
+            entry.completion(entry.result);
+        }
+    }
+
+    // Render thread: blocks until every job submitted so far, and every job their completions submit, has run
+    // and completed
+    void Finish()
+    {
+        while (Poll() > 0)
+        {
+            // Wait for the worker while it has nothing finished to hand over. Only the render thread removes
+            // entries from done, so the fence stays valid after the lock is released for the wait.
+            GLsync fence = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                idle.wait(lock, [this] { return !done.empty() || (queued.empty() && !busy); });
+                if (done.empty())
+                    continue;
+                fence = done.front().fence;
+            }
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+        }
+    }
+
+    // Finishes the job in progress, drops the queued ones and the fences of the completions not run yet, and
+    // releases the loader context
+    void Stop()
+    {
+        if (running)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            workAvailable.notify_all();
+            worker.join();
+            running = false;
+        }
+        queued.clear();
+        for (size_t i = 0; i < done.size(); ++i)
+            glDeleteSync(done[i].fence);
+        done.clear();
+    }
+
+private:
+    struct Entry
+    {
+        Job job;
+        Completion completion;
+        bool result;
+        GLsync fence;
+    };
+
+    ContextBinder binder;
+    std::thread worker;
+    std::deque<Entry> queued;
+    std::deque<Entry> done;             // Fenced, waiting for the render thread
+    bool running;
+    bool busy;                          // The worker is running a job
+    bool stopping;
+    bool contextBound;
+    bool contextFailed;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable started;
+    std::condition_variable idle;
+
+    // The fence goes into the command stream after the job's uploads; the flush makes sure it reaches the
+    // GPU, a fence the render context waits for is not flushed by that context
+    static void run(Entry& entry)
+    {
+        entry.result = entry.job();
+        entry.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+    }
+
+    void work()
+    {
+        const bool bound = binder(true);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            contextBound = bound;
+            contextFailed = !bound;
+        }
+        started.notify_all();
+        if (!bound)
+            return;
+
+        for (;;)
+        {
+            Entry entry;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this] { return stopping || !queued.empty(); });
+                if (stopping)
+                    break;
+                entry = queued.front();
+                queued.pop_front();
+                busy = true;
+            }
+
+            run(entry);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back(entry);
+                busy = false;
+            }
+            idle.notify_all();
+        }
+        binder(false);
+    }
+
+    ResourceLoader(const ResourceLoader&);
+    ResourceLoader& operator=(const ResourceLoader&);
+};
+
+#endif
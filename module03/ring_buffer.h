@@ -0,0 +1,171 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <GL/glew.h>
+
+#include <cstring>
+#include <iostream>
+
+// Persistently mapped buffer split into one region per frame in flight. The CPU writes the dynamic data of
+// frame N into region N % REGION_COUNT with plain memcpy while the GPU still reads the older regions; a fence
+// per region makes sure a region is only reused once the GPU is done with it.
+class PersistentRingBuffer
+{
+public:
+    static const int REGION_COUNT = 3;
+
+    // A block of memory handed out for the current frame
+    struct Allocation
+    {
+        void* data;         // CPU pointer into the mapped buffer
+        GLintptr offset;    // Offset to pass to glBindBufferRange
+        GLsizeiptr size;
+
+        // False when the region had no room left, nothing may be written or bound then
+        bool Valid() const
+        {
+            return data != NULL;
+        }
+    };
+
+    PersistentRingBuffer() : buffer(0), mapped(NULL), regionSize(0), region(0), head(0),
+        uniformAlignment(256), storageAlignment(256), overflowReported(false)
+    {
+        for (int i = 0; i < REGION_COUNT; ++i)
+            fences[i] = 0;
+    }
+
+    // Allocates REGION_COUNT regions of regionBytes each and maps them for the lifetime of the buffer
+    bool Create(GLsizeiptr regionBytes)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+
+        regionSize = alignUp(regionBytes, uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment);
+
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferStorage(GL_UNIFORM_BUFFER, regionSize * REGION_COUNT, NULL, flags);
+        mapped = static_cast<unsigned char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, regionSize * REGION_COUNT, flags));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        if (mapped == NULL)
+        {
+            std::cout << "ERROR::RING_BUFFER::MAP_FAILED" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < REGION_COUNT; ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+
+        if (buffer)
+        {
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glUnmapBuffer(GL_UNIFORM_BUFFER);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            glDeleteBuffers(1, &buffer);
+        }
+        buffer = 0;
+        mapped = NULL;
+    }
+
+    // Waits until the GPU has finished reading the region about to be overwritten and starts writing into it
+    void BeginFrame()
+    {
+        if (fences[region])
+        {
+            GLenum result = glClientWaitSync(fences[region], 0, 0);
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+
+            glDeleteSync(fences[region]);
+            fences[region] = 0;
+        }
+        head = 0;
+    }
+
+    // Fences the commands that read the current region and moves on to the next one
+    void EndFrame()
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % REGION_COUNT;
+    }
+
+    // Reserves size bytes in the current region; the returned memory can be written until EndFrame. When the
+    // region is full the allocation is invalid: the ranges already handed out are still waiting for the GPU,
+    // so the caller has to skip the work that needed the memory.
+    Allocation Allocate(GLsizeiptr size, GLint alignment)
+    {
+        Allocation allocation;
+        allocation.data = NULL;
+        allocation.offset = 0;
+        allocation.size = 0;
+
+        const GLintptr start = alignUp(head, alignment);
+        if (size > regionSize || start > regionSize - size)
+        {
+            if (!overflowReported)
+                std::cout << "ERROR::RING_BUFFER::REGION_OVERFLOW " << size << " bytes requested (" << regionSize << " bytes per frame)" << std::endl;
+            overflowReported = true;
+            return allocation;
+        }
+        head = start + size;
+
+        allocation.offset = region * regionSize + start;
+        allocation.data = mapped + allocation.offset;
+        allocation.size = size;
+        return allocation;
+    }
+
+    // Copies a uniform block into the current region
+    Allocation PushUniforms(const void* data, GLsizeiptr size)
+    {
+        Allocation allocation = Allocate(size, uniformAlignment);
+        if (allocation.Valid())
+            memcpy(allocation.data, data, size);
+        return allocation;
+    }
+
+    // Reserves room for shader storage data that the caller writes in place
+    Allocation AllocateStorage(GLsizeiptr size)
+    {
+        return Allocate(size, storageAlignment);
+    }
+
+    void BindRange(GLenum target, GLuint index, const Allocation& allocation) const
+    {
+        glBindBufferRange(target, index, buffer, allocation.offset, allocation.size);
+    }
+
+    GLuint Buffer() const
+    {
+        return buffer;
+    }
+
+private:
+    GLuint buffer;
+    unsigned char* mapped;
+    GLsizeiptr regionSize;
+    int region;
+    GLintptr head;
+    GLsync fences[REGION_COUNT];
+    GLint uniformAlignment;
+    GLint storageAlignment;
+    bool overflowReported;
+
+    static GLintptr alignUp(GLintptr value, GLint alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+};
+
+#endif
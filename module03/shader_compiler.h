@@ -0,0 +1,146 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <GL/glew.h>
+
+#include <string>
+
+// Non-blocking program compilation. Submit hands both stages and the link to the driver without asking
+// for any result, so the driver can compile several programs at once while the application goes on with
+// other work. With GL_KHR_parallel_shader_compile (or the ARB version) IsComplete polls
+// GL_COMPLETION_STATUS without blocking; without it a job counts as complete and Collect waits for it.
+class ShaderCompiler
+{
+public:
+    // Shader and program objects of one submitted program
+    struct Job
+    {
+        GLuint program;
+        GLuint vertexShader;
+        GLuint fragmentShader;
+    };
+
+    ShaderCompiler() : initialized(false), parallel(false)
+    {
+    }
+
+    // True once the driver compiles in background threads (known after the first Submit)
+    bool IsParallel() const
+    {
+        return parallel;
+    }
+
+    Job Submit(const char* vertexSource, const char* fragmentSource)
+    {
+        initialize();
+
+        Job job;
+        job.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(job.vertexShader, 1, &vertexSource, NULL);
+        glCompileShader(job.vertexShader);
+
+        job.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(job.fragmentShader, 1, &fragmentSource, NULL);
+        glCompileShader(job.fragmentShader);
+
+        job.program = glCreateProgram();
+        glAttachShader(job.program, job.vertexShader);
+        glAttachShader(job.program, job.fragmentShader);
+
+        // Lets the program binary cache read the linked binary back
+        glProgramParameteri(job.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(job.program);
+        return job;
+    }
+
+    // Never blocks: false while the driver is still compiling or linking
+    bool IsComplete(const Job& job) const
+    {
+        if (!parallel)
+            return true;
+        GLint complete = GL_FALSE;
+        glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &complete);
+        return complete == GL_TRUE;
+    }
+
+    // Checks both stages and the link (blocking if the job is not complete yet) and frees the shader
+    // objects. On failure the program is deleted and the logs are appended to errors.
+    bool Collect(Job& job, std::string& errors)
+    {
+        bool success = checkShader(job.vertexShader, "VERTEX", errors);
+        success = checkShader(job.fragmentShader, "FRAGMENT", errors) && success;
+        if (success)
+        {
+            GLint linked = GL_FALSE;
+            glGetProgramiv(job.program, GL_LINK_STATUS, &linked);
+            if (!linked)
+            {
+                errors += "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" + programLog(job.program);
+                success = false;
+            }
+        }
+
+        // The linked program keeps its own copy of the code
+        glDetachShader(job.program, job.vertexShader);
+        glDetachShader(job.program, job.fragmentShader);
+        glDeleteShader(job.vertexShader);
+        glDeleteShader(job.fragmentShader);
+        job.vertexShader = job.fragmentShader = 0;
+
+        if (!success)
+        {
+            glDeleteProgram(job.program);
+            job.program = 0;
+        }
+        return success;
+    }
+
+private:
+    bool initialized;
+    bool parallel;
+
+    void initialize()
+    {
+        if (initialized)
+            return;
+        initialized = true;
+
+        // Let the driver pick the number of compiler threads
+        if (GLEW_KHR_parallel_shader_compile)
+        {
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            parallel = true;
+        }
+        else if (GLEW_ARB_parallel_shader_compile)
+        {
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+            parallel = true;
+        }
+    }
+
+    static bool checkShader(GLuint shader, const char* stage, std::string& errors)
+    {
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (compiled)
+            return true;
+
+        GLint length = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        std::string log(length > 0 ? length : 1, '\0');
+        glGetShaderInfoLog(shader, static_cast<GLsizei>(log.size()), NULL, &log[0]);
+        errors += std::string("ERROR::SHADER::") + stage + "::COMPILATION_FAILED\n" + log.c_str() + "\n";
+        return false;
+    }
+
+    static std::string programLog(GLuint program)
+    {
+        GLint length = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        std::string log(length > 0 ? length : 1, '\0');
+        glGetProgramInfoLog(program, static_cast<GLsizei>(log.size()), NULL, &log[0]);
+        return std::string(log.c_str()) + "\n";
+    }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Source-level GLSL preprocessing done before the driver sees the code:
+//
+//   #include "name"     replaced by the named chunk (registered with AddInclude, else read from the include
+//                       directories); every chunk is expanded once per program, later includes are skipped
+//   defines             "#define NAME VALUE" lines inserted right after #version, so shaders can select
+//                       features with #if and the driver compiles one specialized variant per define set
+//
+// Each included chunk gets a "#line" directive with its own source string number, so compiler messages
+// point at the chunk (0 is the main source, 1.. the includes in the order they were expanded).
+class ShaderPreprocessor
+{
+public:
+    // Makes text available as #include "name"
+    void AddInclude(const std::string& name, const std::string& text)
+    {
+        includes[name] = text;
+    }
+
+    // Directory searched for includes that were not registered with AddInclude
+    void AddIncludeDirectory(const std::string& directory)
+    {
+        directories.push_back(directory);
+    }
+
+    // Expands the includes of source and inserts the defines, false (with a message in errors) when an
+    // include cannot be found
+    bool Process(const std::string& source, const std::string& defines, std::string& output, std::string& errors)
+    {
+        std::set<std::string> expanded;
+        int sourceCount = 1;
+        output.clear();
+        return expand(source, "", 0, defines, expanded, sourceCount, output, errors);
+    }
+
+private:
+    std::map<std::string, std::string> includes;
+    std::vector<std::string> directories;
+
+    bool expand(const std::string& text, const std::string& name, int sourceNumber, const std::string& defines,
+        std::set<std::string>& expanded, int& sourceCount, std::string& output, std::string& errors)
+    {
+        std::istringstream lines(text);
+        std::string line;
+        int lineNumber = 0;
+        bool versionFound = false;
+        while (std::getline(lines, line))
+        {
+            ++lineNumber;
+            const size_t first = line.find_first_not_of(" \t");
+            const bool directive = first != std::string::npos && line[first] == '#';
+
+            if (directive && line.compare(first, 8, "#version") == 0 && sourceNumber == 0)
+            {
+                output += line + "\n" + defineBlock(defines, lineNumber + 1);
+                versionFound = true;
+                continue;
+            }
+
+            size_t nameStart = std::string::npos;
+            if (directive)
+            {
+                const size_t keyword = line.find_first_not_of(" \t", first + 1);
+                if (keyword != std::string::npos && line.compare(keyword, 7, "include") == 0)
+                    nameStart = line.find_first_of("\"<", keyword + 7);
+            }
+            if (nameStart == std::string::npos)
+            {
+                output += line + "\n";
+                continue;
+            }
+
+            const size_t nameEnd = line.find_first_of("\">", nameStart + 1);
+            const std::string includeName = line.substr(nameStart + 1, nameEnd == std::string::npos ? std::string::npos : nameEnd - nameStart - 1);
+            if (expanded.count(includeName))
+            {
+                output += "\n";     // Keeps the line numbering of the including source
+                continue;
+            }
+
+            std::string includeText;
+            if (!load(includeName, includeText))
+            {
+                errors += "ERROR::SHADER_PREPROCESSOR::INCLUDE_NOT_FOUND " + includeName;
+                if (!name.empty())
+                    errors += " (included from " + name + ")";
+                errors += "\n";
+                return false;
+            }
+            expanded.insert(includeName);
+
+            const int includeNumber = sourceCount++;
+            output += "#line 1 " + toString(includeNumber) + "\n";
+            if (!expand(includeText, includeName, includeNumber, "", expanded, sourceCount, output, errors))
+                return false;
+            output += "#line " + toString(lineNumber + 1) + " " + toString(sourceNumber) + "\n";
+        }
+
+        // Without #version the defines go first
+        if (sourceNumber == 0 && !versionFound)
+            output = defineBlock(defines, 1) + output;
+        return true;
+    }
+
+    // The defines followed by a #line that restores the numbering of the main source
+    static std::string defineBlock(const std::string& defines, int nextLine)
+    {
+        if (defines.empty())
+            return "";
+        std::string block = defines;
+        if (block[block.size() - 1] != '\n')
+            block += "\n";
+        return block + "#line " + toString(nextLine) + " 0\n";
+    }
+
+    bool load(const std::string& name, std::string& text) const
+    {
+        std::map<std::string, std::string>::const_iterator it = includes.find(name);
+        if (it != includes.end())
+        {
+            text = it->second;
+            return true;
+        }
+        for (size_t i = 0; i < directories.size(); ++i)
+        {
+            std::ifstream file((directories[i] + "/" + name).c_str());
+            if (!file)
+                continue;
+            std::stringstream stream;
+            stream << file.rdbuf();
+            text = stream.str();
+            return true;
+        }
+        return false;
+    }
+
+    static std::string toString(int value)
+    {
+        std::ostringstream stream;
+        stream << value;
+        return stream.str();
+    }
+};
+
+#endif
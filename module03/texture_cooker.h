@@ -0,0 +1,362 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include <stb_image.h>
+
+#include "block_compression.h"
+#include "image_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include <sys/stat.h>
+
+// A texture block-compressed with its whole mip chain, level 0 first
+struct CompressedTexture
+{
+    bc::Format format;
+    int width;
+    int height;
+    std::vector<std::vector<unsigned char> > levels;
+};
+
+// Offline texture cooking: decodes an image, flips it for OpenGL, builds the sRGB-correct mip chain of the
+// import path and block-compresses every level (BC1 for opaque images, BC3 with alpha, or BC7 for both).
+// Cooked textures are written in the KTX2 layout: identifier, header, level index and a basic data
+// format descriptor, without supercompression or key/value data. The sRGB formats are recorded since
+// the mips were filtered in linear light; level data is stored smallest level first as KTX2 requires.
+namespace texturecooker
+{
+    // Vulkan format numbers of the KTX2 header
+    const uint32_t VK_FORMAT_BC1_RGB_SRGB_BLOCK = 132;
+    const uint32_t VK_FORMAT_BC3_SRGB_BLOCK = 138;
+    const uint32_t VK_FORMAT_BC7_SRGB_BLOCK = 146;
+
+    const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const uint32_t KTX2_HEADER_BYTES = 80;          // Identifier, header and index
+    const uint32_t KTX2_LEVEL_INDEX_BYTES = 24;     // byteOffset, byteLength, uncompressedByteLength
+
+    inline uint32_t vkFormatOf(bc::Format format)
+    {
+        return format == bc::FORMAT_BC1 ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : format == bc::FORMAT_BC3 ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+
+    inline void put32(std::vector<unsigned char>& bytes, size_t offset, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            bytes[offset + i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    inline void put64(std::vector<unsigned char>& bytes, size_t offset, uint64_t value)
+    {
+        put32(bytes, offset, static_cast<uint32_t>(value));
+        put32(bytes, offset + 4, static_cast<uint32_t>(value >> 32));
+    }
+
+    inline uint32_t get32(const unsigned char* bytes)
+    {
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    inline uint64_t get64(const unsigned char* bytes)
+    {
+        return get32(bytes) | (static_cast<uint64_t>(get32(bytes + 4)) << 32);
+    }
+
+    // Basic data format descriptor of a 4x4 block format: one sample covering the block, BC3 has its alpha
+    // and colour halves as two samples
+    inline std::vector<unsigned char> dataFormatDescriptor(bc::Format format)
+    {
+        const uint32_t sampleCount = format == bc::FORMAT_BC3 ? 2 : 1;
+        const uint32_t blockSize = 24 + 16 * sampleCount;
+        std::vector<unsigned char> dfd(4 + blockSize, 0);
+        const unsigned char colorModel = format == bc::FORMAT_BC1 ? 128 : format == bc::FORMAT_BC3 ? 130 : 134;
+        put32(dfd, 0, static_cast<uint32_t>(dfd.size()));
+        put32(dfd, 4, 0);                           // Khronos vendor, basic descriptor type
+        put32(dfd, 8, 2 | (blockSize << 16));       // Version 2
+        dfd[12] = colorModel;
+        dfd[13] = 1;                                // BT.709 primaries
+        dfd[14] = 2;                                // sRGB transfer function
+        dfd[16] = 3;                                // 4x4 texel blocks
+        dfd[17] = 3;
+        dfd[20] = static_cast<unsigned char>(bc::BlockBytes(format));
+        for (uint32_t i = 0; i < sampleCount; ++i)
+        {
+            const size_t sample = 28 + 16 * i;
+            const uint32_t bitOffset = format == bc::FORMAT_BC3 && i == 1 ? 64 : 0;
+            const uint32_t bitLength = (format == bc::FORMAT_BC7 ? 128 : 64) - 1;
+            const uint32_t channel = format == bc::FORMAT_BC3 && i == 0 ? 15 : 0;   // BC3 alpha, colour
+            put32(dfd, sample, bitOffset | (bitLength << 16) | (channel << 24));
+            put32(dfd, sample + 12, 0xFFFFFFFFu);
+        }
+        return dfd;
+    }
+
+    inline bool WriteKTX2(const char* path, const CompressedTexture& texture)
+    {
+        const uint32_t levelCount = static_cast<uint32_t>(texture.levels.size());
+        const std::vector<unsigned char> dfd = dataFormatDescriptor(texture.format);
+        const uint32_t dfdOffset = KTX2_HEADER_BYTES + KTX2_LEVEL_INDEX_BYTES * levelCount;
+
+        std::vector<unsigned char> header(dfdOffset, 0);
+        memcpy(&header[0], KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+        put32(header, 12, vkFormatOf(texture.format));
+        put32(header, 16, 1);                       // typeSize of block formats
+        put32(header, 20, texture.width);
+        put32(header, 24, texture.height);
+        put32(header, 36, 1);                       // faceCount
+        put32(header, 40, levelCount);
+        put32(header, 48, dfdOffset);
+        put32(header, 52, static_cast<uint32_t>(dfd.size()));
+
+        // Smallest level first, each aligned to the block size
+        const size_t alignment = bc::BlockBytes(texture.format);
+        size_t offset = dfdOffset + dfd.size();
+        std::vector<size_t> offsets(levelCount);
+        for (uint32_t level = levelCount; level-- > 0;)
+        {
+            offset = (offset + alignment - 1) / alignment * alignment;
+            offsets[level] = offset;
+            offset += texture.levels[level].size();
+        }
+        for (uint32_t level = 0; level < levelCount; ++level)
+        {
+            const size_t entry = KTX2_HEADER_BYTES + KTX2_LEVEL_INDEX_BYTES * level;
+            put64(header, entry, offsets[level]);
+            put64(header, entry + 8, texture.levels[level].size());
+            put64(header, entry + 16, texture.levels[level].size());
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header[0]), header.size());
+        file.write(reinterpret_cast<const char*>(&dfd[0]), dfd.size());
+        size_t written = header.size() + dfd.size();
+        for (uint32_t level = levelCount; level-- > 0;)
+        {
+            const char padding[16] = {};
+            file.write(padding, offsets[level] - written);
+            file.write(reinterpret_cast<const char*>(&texture.levels[level][0]), texture.levels[level].size());
+            written = offsets[level] + texture.levels[level].size();
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::CANNOT_WRITE " << path << std::endl;
+            file.close();
+            remove(path);
+            return false;
+        }
+        return true;
+    }
+
+    const uint32_t ALL_LEVELS = 0xFFFFFFFFu;
+
+    // Reads the header, the level index and the wanted levels of a KTX2 file: every level, only onlyLevel, or
+    // with maxLevelSize set only the levels no wider or taller than it. The other levels are left empty and
+    // are not read from the file.
+    inline bool readKTX2(const char* path, CompressedTexture& texture, uint32_t onlyLevel, int maxLevelSize)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        file.seekg(0, std::ios::end);
+        const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        file.seekg(0, std::ios::beg);
+
+        std::vector<unsigned char> header(KTX2_HEADER_BYTES);
+        if (!file.read(reinterpret_cast<char*>(&header[0]), header.size()) || memcmp(&header[0], KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::NOT_KTX2 " << path << std::endl;
+            return false;
+        }
+
+        const uint32_t vkFormat = get32(&header[12]);
+        if (vkFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK)
+            texture.format = bc::FORMAT_BC1;
+        else if (vkFormat == VK_FORMAT_BC3_SRGB_BLOCK)
+            texture.format = bc::FORMAT_BC3;
+        else if (vkFormat == VK_FORMAT_BC7_SRGB_BLOCK)
+            texture.format = bc::FORMAT_BC7;
+        else
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::UNSUPPORTED_FORMAT " << vkFormat << " in " << path << std::endl;
+            return false;
+        }
+        texture.width = static_cast<int>(get32(&header[20]));
+        texture.height = static_cast<int>(get32(&header[24]));
+        const uint32_t levelCount = get32(&header[40]);
+        if (texture.width <= 0 || texture.height <= 0 || get32(&header[28]) != 0 || get32(&header[32]) != 0 || get32(&header[36]) != 1
+            || get32(&header[44]) != 0 || levelCount == 0 || levelCount > 32)
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::UNSUPPORTED_LAYOUT " << path << std::endl;
+            return false;
+        }
+
+        // The level index follows the header
+        std::vector<unsigned char> index(KTX2_LEVEL_INDEX_BYTES * static_cast<size_t>(levelCount));
+        if (!file.read(reinterpret_cast<char*>(&index[0]), index.size()))
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::UNSUPPORTED_LAYOUT " << path << std::endl;
+            return false;
+        }
+
+        texture.levels.assign(levelCount, std::vector<unsigned char>());
+        int width = texture.width;
+        int height = texture.height;
+        for (uint32_t level = 0; level < levelCount; ++level, width = imagekernels::MipSize(width), height = imagekernels::MipSize(height))
+        {
+            const unsigned char* entry = &index[KTX2_LEVEL_INDEX_BYTES * level];
+            const uint64_t offset = get64(entry);
+            const uint64_t length = get64(entry + 8);
+            if (length != bc::LevelBytes(texture.format, width, height) || offset > fileSize || length > fileSize - offset)
+            {
+                std::cout << "ERROR::TEXTURE_COOKER::BAD_LEVEL " << level << " in " << path << std::endl;
+                return false;
+            }
+            if ((onlyLevel != ALL_LEVELS && level != onlyLevel) || (maxLevelSize > 0 && std::max(width, height) > maxLevelSize))
+                continue;
+
+            texture.levels[level].resize(static_cast<size_t>(length));
+            file.seekg(static_cast<std::streamoff>(offset));
+            if (!file.read(reinterpret_cast<char*>(&texture.levels[level][0]), static_cast<std::streamsize>(length)))
+            {
+                std::cout << "ERROR::TEXTURE_COOKER::BAD_LEVEL " << level << " in " << path << std::endl;
+                return false;
+            }
+        }
+        return onlyLevel == ALL_LEVELS || onlyLevel < levelCount;
+    }
+
+    // Reads a file written by WriteKTX2 (any KTX2 file with one of the three formats, a single 2D image
+    // and no supercompression), false when there is none or it does not check out. With maxLevelSize
+    // set the levels wider or taller than it are left empty, ReadKTX2Level streams them in later.
+    inline bool ReadKTX2(const char* path, CompressedTexture& texture, int maxLevelSize = 0)
+    {
+        return readKTX2(path, texture, ALL_LEVELS, maxLevelSize);
+    }
+
+    // Reads a single level of a KTX2 file, the others are left empty
+    inline bool ReadKTX2Level(const char* path, uint32_t level, CompressedTexture& texture)
+    {
+        return readKTX2(path, texture, level, 0);
+    }
+
+    // First level ReadKTX2 has read, the number of levels when there is none
+    inline size_t FirstLevel(const CompressedTexture& texture)
+    {
+        size_t level = 0;
+        while (level < texture.levels.size() && texture.levels[level].empty())
+            ++level;
+        return level;
+    }
+
+    // True when the cooked file exists and is not older than the image it was cooked from
+    inline bool IsUpToDate(const char* imagePath, const char* cookedPath)
+    {
+        struct stat image;
+        struct stat cooked;
+        if (stat(cookedPath, &cooked) != 0)
+            return false;
+        return stat(imagePath, &image) != 0 || cooked.st_mtime >= image.st_mtime;
+    }
+
+    inline void MakeDirectory(const char* path)
+    {
+#ifdef _WIN32
+        _mkdir(path);
+#else
+        mkdir(path, 0755);
+#endif
+    }
+
+    // Peak signal-to-noise ratio of the colour channels, in dB
+    inline double colorPSNR(const unsigned char* a, const unsigned char* b, size_t pixelCount)
+    {
+        double squared = 0.0;
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                const double difference = a[i * 4 + c] - b[i * 4 + c];
+                squared += difference * difference;
+            }
+        }
+        if (squared == 0.0)
+            return 99.0;
+        return 10.0 * std::log10(255.0 * 255.0 / (squared / (pixelCount * 3)));
+    }
+
+    // Cooks one image, BC7 instead of BC1/BC3 when useBC7; reports sizes, level 0 PSNR and time on out
+    inline bool Cook(const char* imagePath, const char* cookedPath, bool useBC7, std::ostream& out)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        unsigned char* decoded = stbi_load(imagePath, &width, &height, &channels, 4);
+        if (decoded == NULL)
+        {
+            out << "ERROR::TEXTURE_COOKER::CANNOT_DECODE " << imagePath << std::endl;
+            return false;
+        }
+        const size_t pixelCount = static_cast<size_t>(width) * height;
+        std::vector<unsigned char> chain(imagekernels::MipChainBytes(width, height));
+        imagekernels::FlipRows(decoded, width, height, 4);
+        memcpy(&chain[0], decoded, pixelCount * 4);
+        stbi_image_free(decoded);
+        imagekernels::BuildMipChain(&chain[0], width, height);
+
+        bool hasAlpha = false;
+        for (size_t i = 0; channels == 4 && !hasAlpha && i < pixelCount; ++i)
+            hasAlpha = chain[i * 4 + 3] != 255;
+
+        CompressedTexture texture;
+        texture.format = useBC7 ? bc::FORMAT_BC7 : hasAlpha ? bc::FORMAT_BC3 : bc::FORMAT_BC1;
+        texture.width = width;
+        texture.height = height;
+        texture.levels.resize(imagekernels::MipLevelCount(width, height));
+        const unsigned char* level = &chain[0];
+        int levelWidth = width;
+        int levelHeight = height;
+        for (size_t i = 0; i < texture.levels.size(); ++i)
+        {
+            texture.levels[i].resize(bc::LevelBytes(texture.format, levelWidth, levelHeight));
+            bc::CompressLevel(texture.format, level, levelWidth, levelHeight, &texture.levels[i][0]);
+            level += static_cast<size_t>(levelWidth) * levelHeight * 4;
+            levelWidth = imagekernels::MipSize(levelWidth);
+            levelHeight = imagekernels::MipSize(levelHeight);
+        }
+        if (!WriteKTX2(cookedPath, texture))
+            return false;
+        const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        size_t compressedBytes = 0;
+        for (size_t i = 0; i < texture.levels.size(); ++i)
+            compressedBytes += texture.levels[i].size();
+        std::vector<unsigned char> decompressed(pixelCount * 4);
+        bc::DecompressLevel(texture.format, &texture.levels[0][0], width, height, &decompressed[0]);
+
+        const std::streamsize precision = out.precision();
+        out << "INFO: Cooked " << imagePath << " (" << width << "x" << height << ", " << texture.levels.size() << " levels) as "
+            << bc::FormatName(texture.format) << std::fixed << std::setprecision(2) << ": " << chain.size() / (1024.0 * 1024.0)
+            << " MB RGBA8 -> " << compressedBytes / (1024.0 * 1024.0) << " MB, " << std::setprecision(1)
+            << colorPSNR(&chain[0], &decompressed[0], pixelCount) << " dB, " << elapsed << " ms" << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out.precision(precision);
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef TEXTURE_DECODER_H
+#define TEXTURE_DECODER_H
+
+#include <stb_image.h>
+
+#include "decode_buffer_pool.h"
+#include "image_kernels.h"
+#include "lz_image.h"
+#include "profiler.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Decodes image files on a pool of worker threads so that only the texture uploads are left for the GL
+// thread. Images are decoded in submission order (with stb_image, or lzimage for the lossless containers,
+// whose rows are stored flipped already) and prepared for upload on the worker: flipped for OpenGL's
+// bottom-up rows, expanded to RGBA8 and given a full sRGB-correct mip chain. Wait hands out an
+// image as soon as it is done, so the caller can upload the first textures while the workers are still
+// decoding the others.
+class TextureDecoder
+{
+public:
+    struct Image
+    {
+        std::string filename;
+        int width;
+        int height;
+        int channels;               // Of the file; only 3 and 4 are converted
+        int levels;
+        unsigned char* pixels;      // RGBA8 levels one after the other (imagekernels::MipChainBytes), NULL on failure
+        bool done;
+    };
+
+    // One worker per hardware thread when threadCount is 0
+    explicit TextureDecoder(unsigned int threadCount = 0) : next(0), stopping(false)
+    {
+        if (threadCount == 0)
+            threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0)
+            threadCount = 2;
+        for (unsigned int i = 0; i < threadCount; ++i)
+            workers.push_back(std::thread(&TextureDecoder::work, this));
+    }
+
+    // Workers finish the image they are decoding and stop, images not released yet are freed
+    ~TextureDecoder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        for (size_t i = 0; i < images.size(); ++i)
+            DecodeBufferPool::Shared().Free(images[i].pixels);
+    }
+
+    unsigned int ThreadCount() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+    // Queues a file for decoding, returns the index to Wait for
+    size_t Submit(const char* filename)
+    {
+        Image image;
+        image.filename = filename;
+        image.width = image.height = image.channels = image.levels = 0;
+        image.pixels = NULL;
+        image.done = false;
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            index = images.size();
+            images.push_back(image);
+        }
+        workAvailable.notify_one();
+        return index;
+    }
+
+    // Blocks until the image is decoded; the reference stays valid until the decoder is destroyed
+    const Image& Wait(size_t index)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        imageDone.wait(lock, [this, index] { return images[index].done; });
+        return images[index];
+    }
+
+    // Gives the pixels back once they are uploaded
+    void Release(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        DecodeBufferPool::Shared().Free(images[index].pixels);
+        images[index].pixels = NULL;
+    }
+
+    // Decodes and prepares one image on the calling thread, for callers that are off the render thread already;
+    // the pixels go back to DecodeBufferPool::Shared() once uploaded
+    static Image Decode(const char* filename)
+    {
+        Image image;
+        image.filename = filename;
+        image.width = image.height = image.channels = image.levels = 0;
+        image.pixels = decode(image.filename, image.width, image.height, image.channels, image.levels);
+        image.done = true;
+        return image;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<Image> images;           // Elements never move, workers fill them in place
+    size_t next;                        // First image no worker has taken yet
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable imageDone;
+
+    void work()
+    {
+        for (;;)
+        {
+            size_t index;
+            std::string filename;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                workAvailable.wait(lock, [this] { return stopping || next < images.size(); });
+                if (stopping)
+                    return;
+                index = next++;
+                filename = images[index].filename;
+            }
+
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            int levels = 0;
+            unsigned char* pixels = decode(filename, width, height, channels, levels);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Image& image = images[index];
+                image.width = width;
+                image.height = height;
+                image.channels = channels;
+                image.levels = levels;
+                image.pixels = pixels;
+                image.done = true;
+            }
+            imageDone.notify_all();
+        }
+    }
+
+    // RGBA8 mip chain of an image file, NULL when it cannot be decoded or converted
+    static unsigned char* decode(const std::string& filename, int& width, int& height, int& channels, int& levels)
+    {
+        PROFILE_ZONE("DecodeTexture");
+        if (lzimage::IsContainerPath(filename))
+            return decodeContainer(filename, width, height, channels, levels);
+
+        unsigned char* pixels = NULL;
+        unsigned char* decoded = stbi_load(filename.c_str(), &width, &height, &channels, 0);
+        if (decoded != NULL && (channels == 3 || channels == 4))
+        {
+            imagekernels::FlipRows(decoded, width, height, channels);
+            pixels = prepare(decoded, width, height, channels, levels);
+        }
+        stbi_image_free(decoded);
+        return pixels;
+    }
+
+    // RGBA8 mip chain of a flipped RGB8 or RGBA8 image
+    static unsigned char* prepare(const unsigned char* decoded, int width, int height, int channels, int& levels)
+    {
+        unsigned char* chain = static_cast<unsigned char*>(DecodeBufferPool::Shared().Allocate(imagekernels::MipChainBytes(width, height)));
+        if (chain == NULL)
+            return NULL;
+        const size_t pixelCount = static_cast<size_t>(width) * height;
+        if (channels == 3)
+            imagekernels::ExpandRGBToRGBA(decoded, chain, pixelCount);
+        else
+            memcpy(chain, decoded, pixelCount * 4);
+        imagekernels::BuildMipChain(chain, width, height);
+        levels = imagekernels::MipLevelCount(width, height);
+        return chain;
+    }
+
+    // RGBA8 mip chain of a lossless container; an RGBA image is decoded straight into the chain's first level
+    static unsigned char* decodeContainer(const std::string& filename, int& width, int& height, int& channels, int& levels)
+    {
+        std::vector<unsigned char> file;
+        lzimage::Image image;
+        if (!lzimage::ReadFile(filename.c_str(), file) || !lzimage::ReadHeader(file, image))
+            return NULL;
+        width = image.width;
+        height = image.height;
+        channels = image.channels;
+        if (channels == 4)
+        {
+            unsigned char* chain = static_cast<unsigned char*>(DecodeBufferPool::Shared().Allocate(imagekernels::MipChainBytes(width, height)));
+            if (chain == NULL || !lzimage::Decode(file, chain))
+            {
+                DecodeBufferPool::Shared().Free(chain);
+                return NULL;
+            }
+            imagekernels::BuildMipChain(chain, width, height);
+            levels = imagekernels::MipLevelCount(width, height);
+            return chain;
+        }
+
+        unsigned char* decoded = static_cast<unsigned char*>(DecodeBufferPool::Shared().Allocate(static_cast<size_t>(width) * height * channels));
+        unsigned char* pixels = decoded != NULL && lzimage::Decode(file, decoded) ? prepare(decoded, width, height, channels, levels) : NULL;
+        DecodeBufferPool::Shared().Free(decoded);
+        return pixels;
+    }
+
+    TextureDecoder(const TextureDecoder&);
+    TextureDecoder& operator=(const TextureDecoder&);
+};
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <vector>
+
+// Registry of the loaded textures and the bytes of each of their mip levels, held to a texture memory
+// budget. Textures are registered under the slot that holds their name (a material's texture) and touched
+// whenever they are bound. When the resident bytes exceed the budget, Enforce drops the top levels of the
+// least recently used textures: their remaining levels are copied into smaller immutable storage and the
+// slot gets the new name. A reduced texture that is touched again is reloaded in full once the budget has
+// room for it.
+//
+// Textures registered with a streamer are instead kept at the resolution their draws need. Every draw
+// requests the level its screen coverage samples; Stream gives the texture storage down to the finest
+// requested level and streams the missing levels in one at a time, coarsest first. GL_TEXTURE_BASE_LEVEL
+// clamps sampling to the levels that have arrived. Levels more than one finer than needed are dropped.
+//
+// Stream, Enforce, Add and AddLevel create, bind and delete textures; the caller invalidates its shadow GL
+// state afterwards.
+class TextureResidency
+{
+public:
+    // Starts loading the full texture again; the load registers the result with Add
+    typedef std::function<void()> Reloader;
+
+    // Starts loading one level of the texture from its mip chain file; the load hands it to AddLevel
+    typedef std::function<void(int level)> Streamer;
+
+    // Levels no larger than this are never dropped
+    static const int MIN_RESIDENT_SIZE = 64;
+
+    TextureResidency() : budget(0), residentBytes(0), touches(0), droppedLevels(0), reloads(0), streamedLevels(0)
+    {
+    }
+
+    // Bytes the resident levels may take, 0 for no limit
+    void SetBudget(size_t bytes)
+    {
+        budget = bytes;
+    }
+
+    // Registers the texture and stores its name in the slot. Its storage holds the levels of the full chain
+    // from baseLevel down. A texture already registered under the slot (a reload) is deleted.
+    void Add(GLuint* slot, GLuint id, GLenum internalFormat, int width, int height, const std::vector<size_t>& levelBytes, int baseLevel,
+        const Reloader& reload, const Streamer& stream)
+    {
+        std::map<const GLuint*, Entry>::iterator it = entries.find(slot);
+        if (it != entries.end())
+        {
+            residentBytes -= it->second.ResidentBytes();
+            glDeleteTextures(1, slot);
+        }
+
+        Entry& entry = entries[slot];
+        entry.slot = slot;
+        entry.internalFormat = internalFormat;
+        entry.width = width;
+        entry.height = height;
+        entry.levelBytes = levelBytes;
+        entry.storageLevel = baseLevel;
+        entry.baseLevel = baseLevel;
+        entry.wantedLevel = entry.LevelCount();
+        entry.streamingLevel = NOT_STREAMING;
+        entry.lastUsed = ++touches;
+        entry.reloading = false;
+        entry.reload = reload;
+        entry.stream = stream;
+        *slot = id;
+        residentBytes += entry.ResidentBytes();
+    }
+
+    // Marks the texture in the slot as used; a reduced one is reloaded when its full size fits the budget.
+    // Returns true when a reload was started.
+    bool Touch(const GLuint* slot)
+    {
+        std::map<const GLuint*, Entry>::iterator it = entries.find(slot);
+        if (it == entries.end())
+            return false;
+        Entry& entry = it->second;
+        entry.lastUsed = ++touches;
+        if (entry.storageLevel == 0 || entry.reloading || !entry.reload || entry.stream)
+            return false;
+        if (budget != 0 && residentBytes - entry.ResidentBytes() + entry.FullBytes() > budget)
+            return false;
+        // A failed reload leaves the flag set, the reduced texture stays
+        entry.reloading = true;
+        ++reloads;
+        entry.reload();
+        return true;
+    }
+
+    // Requests the level a draw of the texture in the slot samples, from the texture coordinate units one
+    // screen pixel covers; the finest request of each frame is streamed in by the next Stream
+    void Request(const GLuint* slot, float coordinatesPerPixel)
+    {
+        std::map<const GLuint*, Entry>::iterator it = entries.find(slot);
+        if (it == entries.end() || !it->second.stream)
+            return;
+        Entry& entry = it->second;
+
+        // Level whose texels are as large as a pixel; rounded down, trilinear filtering blends it with the
+        // next coarser one
+        const float texelsPerPixel = coordinatesPerPixel * std::max(entry.width, entry.height);
+        const int level = texelsPerPixel > 1.0f ? static_cast<int>(std::floor(std::log2(texelsPerPixel))) : 0;
+        entry.wantedLevel = std::min(entry.wantedLevel, std::min(level, entry.LevelCount() - 1));
+    }
+
+    // Applies the requests made since the last call: streams in the next missing level of the textures that
+    // need finer ones (growing their storage first while the budget has room) and drops the levels more than
+    // one finer than needed. Textures not drawn since the last call are left to Enforce. Returns the number of
+    // textures moved to new storage.
+    size_t Stream()
+    {
+        size_t moved = 0;
+        for (std::map<const GLuint*, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            Entry& entry = it->second;
+            const int wanted = entry.wantedLevel;
+            entry.wantedLevel = entry.LevelCount();
+            if (!entry.stream || wanted >= entry.LevelCount() || entry.streamingLevel != NOT_STREAMING)
+                continue;
+
+            if (wanted < entry.baseLevel)
+            {
+                int storageLevel = entry.storageLevel;
+                while (storageLevel > wanted && (budget == 0 || residentBytes + entry.levelBytes[storageLevel - 1] <= budget))
+                    residentBytes += entry.levelBytes[--storageLevel];
+                if (storageLevel != entry.storageLevel)
+                {
+                    move(entry, storageLevel);
+                    ++moved;
+                }
+                if (entry.baseLevel > entry.storageLevel)
+                {
+                    // A failed load leaves the level set, the texture keeps the levels it has
+                    entry.streamingLevel = entry.baseLevel - 1;
+                    entry.stream(entry.streamingLevel);
+                }
+            }
+            else if (wanted > entry.baseLevel + 1)
+            {
+                int storageLevel = entry.storageLevel;
+                while (storageLevel < wanted - 1 && canDrop(entry, storageLevel))
+                    residentBytes -= entry.levelBytes[storageLevel++];
+                if (storageLevel != entry.storageLevel)
+                {
+                    droppedLevels += storageLevel - entry.storageLevel;
+                    move(entry, storageLevel);
+                    ++moved;
+                }
+            }
+        }
+        return moved;
+    }
+
+    // Uploads a level streamed in for the texture in the slot (block-compressed data of its format) and lowers
+    // the texture's base level to it. Returns false when the texture no longer waits for it: its storage was
+    // reduced meanwhile, or the data does not match the level.
+    bool AddLevel(const GLuint* slot, int level, const std::vector<unsigned char>& data)
+    {
+        std::map<const GLuint*, Entry>::iterator it = entries.find(slot);
+        if (it == entries.end() || it->second.streamingLevel != level)
+            return false;
+        Entry& entry = it->second;
+        entry.streamingLevel = NOT_STREAMING;
+        if (level != entry.baseLevel - 1 || level < entry.storageLevel || data.size() != entry.levelBytes[level])
+            return false;
+
+        glBindTexture(GL_TEXTURE_2D, *slot);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level - entry.storageLevel, 0, 0, levelSize(entry.width, level), levelSize(entry.height, level),
+            entry.internalFormat, static_cast<GLsizei>(data.size()), &data[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - entry.storageLevel);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        entry.baseLevel = level;
+        ++streamedLevels;
+        return true;
+    }
+
+    // Drops top levels of the least recently used textures until the resident bytes fit the budget,
+    // returns the number of textures moved to smaller storage
+    size_t Enforce()
+    {
+        if (budget == 0 || residentBytes <= budget)
+            return 0;
+
+        std::vector<Entry*> order;
+        for (std::map<const GLuint*, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+            order.push_back(&it->second);
+        std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) { return a->lastUsed < b->lastUsed; });
+
+        size_t reduced = 0;
+        for (size_t i = 0; i < order.size() && residentBytes > budget; ++i)
+        {
+            Entry& entry = *order[i];
+            int storageLevel = entry.storageLevel;
+            size_t bytes = entry.ResidentBytes();
+            while (residentBytes - entry.ResidentBytes() + bytes > budget && canDrop(entry, storageLevel))
+                bytes -= entry.levelBytes[storageLevel++];
+            if (storageLevel == entry.storageLevel)
+                continue;
+            residentBytes -= entry.ResidentBytes();
+            droppedLevels += storageLevel - entry.storageLevel;
+            move(entry, storageLevel);
+            residentBytes += entry.ResidentBytes();
+            ++reduced;
+        }
+        return reduced;
+    }
+
+    // Deletes every registered texture
+    void Clear()
+    {
+        for (std::map<const GLuint*, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+            glDeleteTextures(1, it->second.slot);
+        entries.clear();
+        residentBytes = 0;
+    }
+
+    size_t ResidentBytes() const
+    {
+        return residentBytes;
+    }
+
+    void Print(std::ostream& out) const
+    {
+        size_t fullBytes = 0;
+        size_t reducedCount = 0;
+        size_t streamingCount = 0;
+        for (std::map<const GLuint*, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            fullBytes += it->second.FullBytes();
+            reducedCount += it->second.storageLevel > 0 ? 1 : 0;
+            streamingCount += it->second.stream ? 1 : 0;
+        }
+
+        const double MB = 1024.0 * 1024.0;
+        out << "TEXTURES: " << entries.size() << " textures, " << residentBytes / MB << " MB resident of " << fullBytes / MB << " MB";
+        if (budget != 0)
+            out << " (budget " << budget / MB << " MB)";
+        out << ", " << reducedCount << " reduced, " << droppedLevels << " levels dropped, " << reloads << " reloads, "
+            << streamingCount << " streaming, " << streamedLevels << " levels streamed" << std::endl;
+    }
+
+private:
+    static const int NOT_STREAMING = -1;
+
+    struct Entry
+    {
+        GLuint* slot;
+        GLenum internalFormat;
+        int width;                          // Of level 0
+        int height;
+        std::vector<size_t> levelBytes;     // Every level of the full chain
+        int storageLevel;                   // First level of the full chain the texture's storage holds
+        int baseLevel;                      // First level that has its texels, the others are clamped away
+        int wantedLevel;                    // Finest level requested since the last Stream, LevelCount() for none
+        int streamingLevel;                 // Level being loaded by the streamer
+        unsigned long long lastUsed;
+        bool reloading;
+        Reloader reload;
+        Streamer stream;
+
+        int LevelCount() const
+        {
+            return static_cast<int>(levelBytes.size());
+        }
+
+        size_t ResidentBytes() const
+        {
+            size_t bytes = 0;
+            for (size_t level = storageLevel; level < levelBytes.size(); ++level)
+                bytes += levelBytes[level];
+            return bytes;
+        }
+
+        size_t FullBytes() const
+        {
+            size_t bytes = 0;
+            for (size_t level = 0; level < levelBytes.size(); ++level)
+                bytes += levelBytes[level];
+            return bytes;
+        }
+    };
+
+    std::map<const GLuint*, Entry> entries;
+    size_t budget;
+    size_t residentBytes;
+    unsigned long long touches;         // Touch counter, orders the entries by last use
+    unsigned long long droppedLevels;
+    unsigned long long reloads;
+    unsigned long long streamedLevels;
+
+    static int levelSize(int size, int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    static bool canDrop(const Entry& entry, int storageLevel)
+    {
+        return storageLevel + 1 < entry.LevelCount()
+            && std::max(levelSize(entry.width, storageLevel), levelSize(entry.height, storageLevel)) > MIN_RESIDENT_SIZE;
+    }
+
+    // Moves the texture into new storage holding the levels from storageLevel down, the old texture is
+    // deleted. The levels both storages hold are copied; levels the new storage adds stay clamped away by
+    // the base level until they are streamed in.
+    static void move(Entry& entry, int storageLevel)
+    {
+        const GLsizei levels = entry.LevelCount() - storageLevel;
+        const int baseLevel = std::max(entry.baseLevel, storageLevel);
+        GLuint id = 0;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexStorage2D(GL_TEXTURE_2D, levels, entry.internalFormat, levelSize(entry.width, storageLevel), levelSize(entry.height, storageLevel));
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel - storageLevel);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // Whole levels of the same format, compressed blocks are copied as they are
+        for (int level = baseLevel; level < entry.LevelCount(); ++level)
+        {
+            glCopyImageSubData(*entry.slot, GL_TEXTURE_2D, level - entry.storageLevel, 0, 0, 0, id, GL_TEXTURE_2D, level - storageLevel, 0, 0, 0,
+                levelSize(entry.width, level), levelSize(entry.height, level), 1);
+        }
+
+        glDeleteTextures(1, entry.slot);
+        *entry.slot = id;
+        entry.storageLevel = storageLevel;
+        entry.baseLevel = baseLevel;
+    }
+
+    TextureResidency(const TextureResidency&);
+    TextureResidency& operator=(const TextureResidency&);
+};
+
+#endif
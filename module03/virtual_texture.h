@@ -0,0 +1,690 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <GL/glew.h>
+#include <stb_image.h>
+
+#include "block_compression.h"
+#include "image_kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Software virtual texture: an image of any size (up to MAX_IMAGE_BYTES as RGBA8) cut into pages of PAGE_SIZE texels on
+// every mip level, of which only the pages the frames sample are kept in GPU memory, in a fixed atlas of
+// ATLAS_SLOTS x ATLAS_SLOTS slots. Memory stays the same whatever the size of the image.
+//
+// - The page file (written by Cook) has a header followed by every page of every level, level 0 first and
+//   the pages of a level in rows from the bottom. A page is stored as BC1 blocks of SLOT_SIZE texels square:
+//   the page and a border of PAGE_BORDER texels repeating its neighbours (wrapping around the image edges),
+//   so bilinear filtering inside a slot never reads the next one.
+// - The page table is an RGBA8UI texture with a level per virtual texture level and a texel per page. Each
+//   texel holds the atlas slot and the level of the finest resident page covering it, so a missing page falls
+//   back to a coarser one. The single page of the coarsest level is loaded by Open and never evicted.
+// - Between BeginFeedback and EndFeedback the caller draws the surfaces into a framebuffer of 1/FEEDBACK_DIVISOR
+//   of the viewport, writing the page each fragment needs as (x, y, level, 255) / 255 over a cleared (zero)
+//   target. The pixels are read back into a pixel buffer that Update maps once its fence has signalled.
+// - Update marks the requested pages (and their resident ancestors) as used and starts loading the missing
+//   ones, coarsest first, through the caller's loader. AddPage uploads a loaded page into a free slot or the
+//   least recently used one.
+//
+// Open, Update and AddPage bind textures, the caller invalidates its shadow GL state afterwards. The feedback calls
+// only change the framebuffer, renderbuffer, pixel pack buffer and viewport bindings.
+class VirtualTexture
+{
+public:
+    // Starts loading a page; the load reads it with ReadPage and hands it to AddPage
+    typedef std::function<void(int level, int x, int y)> PageLoader;
+
+    static const int PAGE_SIZE = 128;
+    static const int PAGE_BORDER = 4;
+    static const int SLOT_SIZE = PAGE_SIZE + 2 * PAGE_BORDER;
+    static const int ATLAS_SLOTS = 16;          // Per side
+    static const int MAX_TABLE_SIZE = 256;      // Pages per side on level 0; the feedback stores page numbers in 8 bits
+    // stb_image returns at most INT_MAX bytes, about 23170 x 23170 texels as RGBA8. A PNG is limited further to
+    // 1 GB in its own channel count (16384 x 16384 for RGBA), which stbi_info already reports as too large.
+    static const int64_t MAX_IMAGE_BYTES = INT_MAX;
+    static const int FEEDBACK_DIVISOR = 8;
+    static const int MAX_PENDING_PAGES = 16;    // Page loads in flight
+
+    VirtualTexture() : width(0), height(0), levelCount(0), tableWidth(0), tableHeight(0), atlasFormat(0), pageTable(0), atlas(0),
+        feedbackFramebuffer(0), feedbackColor(0), feedbackWidth(0), feedbackHeight(0), feedbackNext(0), previousFramebuffer(0),
+        viewportWidth(0), viewportHeight(0), frame(0), pending(0), tableDirty(false), loadedPages(0), evictedPages(0), readbacks(0)
+    {
+        for (int i = 0; i < READBACK_BUFFERS; ++i)
+        {
+            readbackBuffers[i] = 0;
+            readbackFences[i] = NULL;
+            readbackFrames[i] = 0;
+        }
+    }
+
+    // Reads the page file's header and creates the page table and the atlas (of the block-compressed sRGB
+    // format of BC1, which the caller has checked the driver supports), then loads the coarsest page. False
+    // when the file is missing or does not check out.
+    bool Open(const char* pagePath, GLenum compressedFormat)
+    {
+        std::ifstream file(pagePath, std::ios::binary);
+        if (!file)
+            return false;
+        unsigned char header[HEADER_BYTES];
+        if (!file.read(reinterpret_cast<char*>(header), HEADER_BYTES) || memcmp(header, "FPVT", 4) != 0 || get32(header + 4) != VERSION)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::NOT_A_PAGE_FILE " << pagePath << std::endl;
+            return false;
+        }
+        width = static_cast<int>(get32(header + 8));
+        height = static_cast<int>(get32(header + 12));
+        if (width <= 0 || height <= 0 || get32(header + 16) != PAGE_SIZE || get32(header + 20) != PAGE_BORDER
+            || !layout(width, height, levelCount, tableWidth, tableHeight) || get32(header + 24) != static_cast<uint32_t>(levelCount))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::UNSUPPORTED_LAYOUT " << pagePath << std::endl;
+            return false;
+        }
+        file.seekg(0, std::ios::end);
+        if (static_cast<uint64_t>(file.tellg()) < pageOffset(levelCount - 1, 0, 0) + PAGE_BYTES)
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::TRUNCATED " << pagePath << std::endl;
+            return false;
+        }
+        path = pagePath;
+        atlasFormat = compressedFormat;
+
+        // Page numbers: texels of the page table; entries are only valid for the pages of the image
+        glGenTextures(1, &pageTable);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_RGBA8UI, tableWidth, tableHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // One level, the shader picks the page of the level it needs
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glTexStorage2D(GL_TEXTURE_2D, 1, atlasFormat, ATLAS_SLOTS * SLOT_SIZE, ATLAS_SLOTS * SLOT_SIZE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        slots.assign(ATLAS_SLOTS * ATLAS_SLOTS, Slot());
+
+        // Slot 0 holds the coarsest page for good, every lookup falls back to it
+        std::vector<unsigned char> root;
+        Page& page = pages[key(levelCount - 1, 0, 0)];
+        page.loading = true;
+        ++pending;
+        if (!ReadPage(levelCount - 1, 0, 0, root) || !AddPage(levelCount - 1, 0, 0, root))
+        {
+            std::cout << "ERROR::VIRTUAL_TEXTURE::CANNOT_READ_PAGE " << pagePath << std::endl;
+            Destroy();
+            return false;
+        }
+        slots[0].pinned = true;
+        uploadPageTable();
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+        return pageTable != 0;
+    }
+
+    // Any thread: reads the blocks of a page from the page file
+    bool ReadPage(int level, int x, int y, std::vector<unsigned char>& data) const
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+        data.resize(PAGE_BYTES);
+        file.seekg(static_cast<std::streamoff>(pageOffset(level, x, y)));
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&data[0]), PAGE_BYTES));
+    }
+
+    // Reads the oldest feedback whose fence has signalled, marks the pages it requests as used, starts loading the
+    // missing ones and uploads the page table when a page came or went. Returns true when it bound a texture.
+    bool Update(const PageLoader& load)
+    {
+        ++frame;
+        bool bound = false;
+        for (int i = 0; i < READBACK_BUFFERS; ++i)
+        {
+            const int buffer = (feedbackNext + i) % READBACK_BUFFERS;
+            if (readbackFences[buffer] == NULL)
+                continue;
+            const GLenum status = glClientWaitSync(readbackFences[buffer], 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(readbackFences[buffer]);
+            readbackFences[buffer] = NULL;
+            requestPages(buffer, load);
+        }
+
+        if (tableDirty)
+        {
+            uploadPageTable();
+            bound = true;
+        }
+        return bound;
+    }
+
+    // Render thread: uploads a loaded page into a free slot, or the least recently used one not requested by
+    // the latest feedback. Empty data marks a page that could not be read, it is not requested again. Returns
+    // true when it bound the atlas.
+    bool AddPage(int level, int x, int y, const std::vector<unsigned char>& data)
+    {
+        Page& page = pages[key(level, x, y)];
+        if (page.loading)
+            --pending;
+        page.loading = false;
+        if (data.size() != PAGE_BYTES)
+        {
+            page.failed = true;
+            return false;
+        }
+
+        int slot = -1;
+        for (int i = 0; i < static_cast<int>(slots.size()); ++i)
+        {
+            if (slots[i].pinned || (slots[i].page != NO_PAGE && slots[i].lastUsed >= frame))
+                continue;
+            if (slot < 0 || slots[i].page == NO_PAGE || (slots[slot].page != NO_PAGE && slots[i].lastUsed < slots[slot].lastUsed))
+                slot = i;
+            if (slots[slot].page == NO_PAGE)
+                break;
+        }
+        // Every slot holds a page the frame needs; the page is loaded again when it is still requested later
+        if (slot < 0)
+        {
+            pages.erase(key(level, x, y));
+            return false;
+        }
+        if (slots[slot].page != NO_PAGE)
+        {
+            pages.erase(slots[slot].page);
+            ++evictedPages;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, (slot % ATLAS_SLOTS) * SLOT_SIZE, (slot / ATLAS_SLOTS) * SLOT_SIZE, SLOT_SIZE, SLOT_SIZE,
+            atlasFormat, static_cast<GLsizei>(data.size()), &data[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        slots[slot].page = key(level, x, y);
+        slots[slot].lastUsed = frame;
+        page.slot = slot;
+        tableDirty = true;
+        ++loadedPages;
+        return true;
+    }
+
+    // Binds the feedback framebuffer (created or resized for the viewport) and sets its viewport; the caller
+    // clears it to zero and draws the virtually textured surfaces with the feedback shader
+    void BeginFeedback(int viewportWidthNow, int viewportHeightNow)
+    {
+        viewportWidth = viewportWidthNow;
+        viewportHeight = viewportHeightNow;
+        const int targetWidth = std::max(1, viewportWidth / FEEDBACK_DIVISOR);
+        const int targetHeight = std::max(1, viewportHeight / FEEDBACK_DIVISOR);
+        if (targetWidth != feedbackWidth || targetHeight != feedbackHeight)
+            createFeedback(targetWidth, targetHeight);
+
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glViewport(0, 0, feedbackWidth, feedbackHeight);
+    }
+
+    // Starts reading the feedback back into the next pixel buffer and restores the framebuffer and viewport; a
+    // readback Update has not consumed yet is dropped
+    void EndFeedback()
+    {
+        const int buffer = feedbackNext;
+        feedbackNext = (feedbackNext + 1) % READBACK_BUFFERS;
+        if (readbackFences[buffer] != NULL)
+            glDeleteSync(readbackFences[buffer]);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[buffer]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackFences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readbackFrames[buffer] = frame;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+    }
+
+    GLuint PageTable() const
+    {
+        return pageTable;
+    }
+
+    GLuint Atlas() const
+    {
+        return atlas;
+    }
+
+    int Width() const
+    {
+        return width;
+    }
+
+    int Height() const
+    {
+        return height;
+    }
+
+    int LevelCount() const
+    {
+        return levelCount;
+    }
+
+    // Added to the level the feedback shader computes from its screen derivatives, which are FEEDBACK_DIVISOR
+    // times those of the full resolution frame
+    static float FeedbackLevelBias()
+    {
+        return -std::log2(static_cast<float>(FEEDBACK_DIVISOR));
+    }
+
+    void Print(std::ostream& out) const
+    {
+        size_t resident = 0;
+        for (size_t i = 0; i < slots.size(); ++i)
+            resident += slots[i].page != NO_PAGE ? 1 : 0;
+        const double MB = 1024.0 * 1024.0;
+        out << "VIRTUAL TEXTURE: " << width << "x" << height << " in " << levelCount << " levels, " << resident << " of " << slots.size()
+            << " slots resident (" << static_cast<double>(ATLAS_SLOTS * SLOT_SIZE) * (ATLAS_SLOTS * SLOT_SIZE) / 2.0 / MB << " MB atlas), "
+            << loadedPages << " pages loaded, " << evictedPages << " evicted, " << readbacks << " feedback readbacks" << std::endl;
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < READBACK_BUFFERS; ++i)
+        {
+            if (readbackFences[i] != NULL)
+                glDeleteSync(readbackFences[i]);
+            readbackFences[i] = NULL;
+        }
+        if (readbackBuffers[0] != 0)
+            glDeleteBuffers(READBACK_BUFFERS, readbackBuffers);
+        if (feedbackFramebuffer != 0)
+        {
+            glDeleteFramebuffers(1, &feedbackFramebuffer);
+            glDeleteRenderbuffers(1, &feedbackColor);
+        }
+        if (pageTable != 0)
+        {
+            glDeleteTextures(1, &pageTable);
+            glDeleteTextures(1, &atlas);
+        }
+        for (int i = 0; i < READBACK_BUFFERS; ++i)
+            readbackBuffers[i] = 0;
+        feedbackFramebuffer = feedbackColor = pageTable = atlas = 0;
+        feedbackWidth = feedbackHeight = 0;
+        pages.clear();
+        slots.clear();
+        pending = 0;
+    }
+
+    // Cooks an image into a page file: decoded, flipped for OpenGL, given the sRGB-correct mip chain of the
+    // import path and cut into bordered BC1 pages. The whole chain is built in memory, only the renderer is
+    // bounded by the atlas.
+    static bool Cook(const char* imagePath, const char* pagePath, std::ostream& out)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int imageWidth = 0;
+        int imageHeight = 0;
+        int channels = 0;
+        if (!stbi_info(imagePath, &imageWidth, &imageHeight, &channels))
+        {
+            out << "ERROR::VIRTUAL_TEXTURE::CANNOT_DECODE " << imagePath << " is not an image stb_image reads, or larger than it decodes (1 GB for a PNG)" << std::endl;
+            return false;
+        }
+
+        // Checked from the header so an image too large to decode is reported as such
+        int levels = 0;
+        int tableWidthOut = 0;
+        int tableHeightOut = 0;
+        if (!layout(imageWidth, imageHeight, levels, tableWidthOut, tableHeightOut))
+        {
+            out << "ERROR::VIRTUAL_TEXTURE::TOO_LARGE " << imagePath << " is " << imageWidth << "x" << imageHeight << ", at most "
+                << MAX_TABLE_SIZE * PAGE_SIZE << " texels per side and " << MAX_IMAGE_BYTES / 4 << " texels in total" << std::endl;
+            return false;
+        }
+
+        unsigned char* decoded = stbi_load(imagePath, &imageWidth, &imageHeight, &channels, 4);
+        if (decoded == NULL)
+        {
+            out << "ERROR::VIRTUAL_TEXTURE::CANNOT_DECODE " << imagePath << std::endl;
+            return false;
+        }
+
+        std::vector<unsigned char> chain(imagekernels::MipChainBytes(imageWidth, imageHeight));
+        imagekernels::FlipRows(decoded, imageWidth, imageHeight, 4);
+        memcpy(&chain[0], decoded, static_cast<size_t>(imageWidth) * imageHeight * 4);
+        stbi_image_free(decoded);
+        imagekernels::BuildMipChain(&chain[0], imageWidth, imageHeight);
+
+        std::ofstream file(pagePath, std::ios::binary | std::ios::trunc);
+        unsigned char header[HEADER_BYTES] = {};
+        memcpy(header, "FPVT", 4);
+        put32(header + 4, VERSION);
+        put32(header + 8, imageWidth);
+        put32(header + 12, imageHeight);
+        put32(header + 16, PAGE_SIZE);
+        put32(header + 20, PAGE_BORDER);
+        put32(header + 24, levels);
+        file.write(reinterpret_cast<const char*>(header), HEADER_BYTES);
+
+        std::vector<unsigned char> page(static_cast<size_t>(SLOT_SIZE) * SLOT_SIZE * 4);
+        std::vector<unsigned char> blocks(PAGE_BYTES);
+        const unsigned char* level = &chain[0];
+        int levelWidth = imageWidth;
+        int levelHeight = imageHeight;
+        size_t pageCount = 0;
+        for (int l = 0; l < levels; ++l)
+        {
+            for (int pageY = 0; pageY < pageCountOf(levelHeight); ++pageY)
+            {
+                for (int pageX = 0; pageX < pageCountOf(levelWidth); ++pageX)
+                {
+                    // Texels of the page and its border, wrapping around the edges of the level
+                    for (int y = 0; y < SLOT_SIZE; ++y)
+                    {
+                        const int sourceY = wrap(pageY * PAGE_SIZE - PAGE_BORDER + y, levelHeight);
+                        for (int x = 0; x < SLOT_SIZE; ++x)
+                        {
+                            const int sourceX = wrap(pageX * PAGE_SIZE - PAGE_BORDER + x, levelWidth);
+                            memcpy(&page[(static_cast<size_t>(y) * SLOT_SIZE + x) * 4], level + (static_cast<size_t>(sourceY) * levelWidth + sourceX) * 4, 4);
+                        }
+                    }
+                    bc::CompressLevel(bc::FORMAT_BC1, &page[0], SLOT_SIZE, SLOT_SIZE, &blocks[0]);
+                    file.write(reinterpret_cast<const char*>(&blocks[0]), blocks.size());
+                    ++pageCount;
+                }
+            }
+            level += static_cast<size_t>(levelWidth) * levelHeight * 4;
+            levelWidth = imagekernels::MipSize(levelWidth);
+            levelHeight = imagekernels::MipSize(levelHeight);
+        }
+
+        if (!file)
+        {
+            out << "ERROR::VIRTUAL_TEXTURE::CANNOT_WRITE " << pagePath << std::endl;
+            file.close();
+            std::remove(pagePath);
+            return false;
+        }
+        const double MB = 1024.0 * 1024.0;
+        out << "INFO: " << imagePath << " (" << imageWidth << "x" << imageHeight << ") cooked into " << pageCount << " pages in " << levels
+            << " levels, " << (HEADER_BYTES + pageCount * PAGE_BYTES) / MB << " MB, in "
+            << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+        return true;
+    }
+
+private:
+    static const int HEADER_BYTES = 32;
+    static const uint32_t VERSION = 1;
+    static const size_t PAGE_BYTES = (SLOT_SIZE / 4) * (SLOT_SIZE / 4) * 8;     // BC1, SLOT_SIZE is a multiple of the block size
+    static const uint32_t NO_PAGE = 0xFFFFFFFFu;
+    static const int READBACK_BUFFERS = 2;
+
+    struct Page
+    {
+        Page() : slot(-1), loading(false), failed(false)
+        {
+        }
+
+        int slot;                       // Atlas slot, -1 while not resident
+        bool loading;
+        bool failed;
+    };
+
+    struct Slot
+    {
+        Slot() : page(NO_PAGE), lastUsed(0), pinned(false)
+        {
+        }
+
+        uint32_t page;                  // Key of the page it holds
+        unsigned long long lastUsed;    // Update count when a feedback last requested the page
+        bool pinned;
+    };
+
+    std::string path;
+    int width;
+    int height;
+    int levelCount;
+    int tableWidth;                     // Level 0 of the page table, a power of two
+    int tableHeight;
+    GLenum atlasFormat;
+    GLuint pageTable;
+    GLuint atlas;
+    std::map<uint32_t, Page> pages;     // Resident, loading and failed pages
+    std::vector<Slot> slots;
+
+    GLuint feedbackFramebuffer;
+    GLuint feedbackColor;
+    int feedbackWidth;
+    int feedbackHeight;
+    int feedbackNext;                   // Pixel buffer the next EndFeedback reads into
+    GLint previousFramebuffer;
+    int viewportWidth;
+    int viewportHeight;
+    GLuint readbackBuffers[READBACK_BUFFERS];
+    GLsync readbackFences[READBACK_BUFFERS];
+    unsigned long long readbackFrames[READBACK_BUFFERS];
+
+    unsigned long long frame;           // Update count
+    int pending;
+    bool tableDirty;
+    unsigned long long loadedPages;
+    unsigned long long evictedPages;
+    unsigned long long readbacks;
+
+    static uint32_t key(int level, int x, int y)
+    {
+        return (static_cast<uint32_t>(level) << 16) | (static_cast<uint32_t>(y) << 8) | static_cast<uint32_t>(x);
+    }
+
+    static int pageCountOf(int levelSize)
+    {
+        return (levelSize + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
+
+    static int wrap(int value, int size)
+    {
+        return ((value % size) + size) % size;
+    }
+
+    // Page table size (pages on level 0 rounded up to a power of two) and level count: the levels go down to
+    // the one that fits in a single page. False when the image needs more pages than the feedback can name or
+    // more than MAX_IMAGE_BYTES as RGBA8.
+    static bool layout(int imageWidth, int imageHeight, int& levels, int& pagesWide, int& pagesHigh)
+    {
+        pagesWide = 1;
+        pagesHigh = 1;
+        while (pagesWide < pageCountOf(imageWidth))
+            pagesWide *= 2;
+        while (pagesHigh < pageCountOf(imageHeight))
+            pagesHigh *= 2;
+        levels = 1;
+        while ((1 << (levels - 1)) < std::max(pagesWide, pagesHigh))
+            ++levels;
+        return pagesWide <= MAX_TABLE_SIZE && pagesHigh <= MAX_TABLE_SIZE && static_cast<int64_t>(imageWidth) * imageHeight * 4 <= MAX_IMAGE_BYTES;
+    }
+
+    static int levelSize(int size, int level)
+    {
+        return std::max(1, size >> level);
+    }
+
+    uint64_t pageOffset(int level, int x, int y) const
+    {
+        uint64_t index = 0;
+        for (int l = 0; l < level; ++l)
+            index += static_cast<uint64_t>(pageCountOf(levelSize(width, l))) * pageCountOf(levelSize(height, l));
+        index += static_cast<uint64_t>(y) * pageCountOf(levelSize(width, level)) + x;
+        return HEADER_BYTES + index * PAGE_BYTES;
+    }
+
+    static void put32(unsigned char* bytes, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    static uint32_t get32(const unsigned char* bytes)
+    {
+        return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    void createFeedback(int targetWidth, int targetHeight)
+    {
+        feedbackWidth = targetWidth;
+        feedbackHeight = targetHeight;
+        if (feedbackFramebuffer == 0)
+        {
+            glGenFramebuffers(1, &feedbackFramebuffer);
+            glGenRenderbuffers(1, &feedbackColor);
+            glGenBuffers(READBACK_BUFFERS, readbackBuffers);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, feedbackWidth, feedbackHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        GLint previous = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+
+        // Readbacks of the old size are dropped
+        for (int i = 0; i < READBACK_BUFFERS; ++i)
+        {
+            if (readbackFences[i] != NULL)
+                glDeleteSync(readbackFences[i]);
+            readbackFences[i] = NULL;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(feedbackWidth) * feedbackHeight * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // Marks the pages of a readback and the resident pages standing in for them as used, then starts loading
+    // the missing ones with the coarsest first (the later, finer ones refine what those show)
+    void requestPages(int buffer, const PageLoader& load)
+    {
+        const size_t size = static_cast<size_t>(feedbackWidth) * feedbackHeight * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[buffer]);
+        const unsigned char* pixels = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+        std::vector<uint32_t> requested;
+        if (pixels)
+        {
+            uint32_t last = NO_PAGE;
+            for (size_t i = 0; i < size; i += 4)
+            {
+                if (pixels[i + 3] != 255)
+                    continue;
+                const uint32_t page = key(pixels[i + 2], pixels[i], pixels[i + 1]);
+                if (page != last)
+                    requested.push_back(page);
+                last = page;
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        ++readbacks;
+
+        std::sort(requested.begin(), requested.end());
+        requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+        std::vector<uint32_t> missing;
+        for (size_t i = 0; i < requested.size(); ++i)
+        {
+            int level = static_cast<int>(requested[i] >> 16);
+            int y = static_cast<int>((requested[i] >> 8) & 0xFF);
+            int x = static_cast<int>(requested[i] & 0xFF);
+            if (level >= levelCount || x >= pageCountOf(levelSize(width, level)) || y >= pageCountOf(levelSize(height, level)))
+                continue;
+            for (; level < levelCount; ++level, x /= 2, y /= 2)
+            {
+                std::map<uint32_t, Page>::const_iterator it = pages.find(key(level, x, y));
+                if (it == pages.end())
+                    missing.push_back(key(level, x, y));
+                else if (it->second.slot >= 0)
+                    slots[it->second.slot].lastUsed = frame;
+            }
+        }
+
+        // No more loads than there are slots the frame does not need: when the requested pages do not fit in the
+        // atlas the finest ones keep showing their ancestors instead of being read again every frame
+        int freeSlots = -pending;
+        for (size_t i = 0; i < slots.size(); ++i)
+            freeSlots += slots[i].page == NO_PAGE || (!slots[i].pinned && slots[i].lastUsed < frame) ? 1 : 0;
+
+        std::sort(missing.begin(), missing.end());
+        missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+        for (size_t i = missing.size(); i-- > 0 && pending < MAX_PENDING_PAGES && freeSlots-- > 0;)
+        {
+            pages[missing[i]].loading = true;
+            ++pending;
+            load(static_cast<int>(missing[i] >> 16), static_cast<int>(missing[i] & 0xFF), static_cast<int>((missing[i] >> 8) & 0xFF));
+        }
+    }
+
+    // Points every page table texel at the finest resident page covering it, coarsest level first so each
+    // level falls back to the one above
+    void uploadPageTable()
+    {
+        std::vector<unsigned char> above;
+        std::vector<unsigned char> entries;
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        for (int level = levelCount - 1; level >= 0; --level)
+        {
+            const int levelWidth = levelSize(tableWidth, level);
+            const int levelHeight = levelSize(tableHeight, level);
+            const int aboveWidth = levelSize(tableWidth, level + 1);
+            entries.assign(static_cast<size_t>(levelWidth) * levelHeight * 4, 0);
+            for (int y = 0; y < levelHeight; ++y)
+            {
+                for (int x = 0; x < levelWidth; ++x)
+                {
+                    unsigned char* entry = &entries[(static_cast<size_t>(y) * levelWidth + x) * 4];
+                    std::map<uint32_t, Page>::const_iterator it = pages.find(key(level, x, y));
+                    if (it != pages.end() && it->second.slot >= 0)
+                    {
+                        entry[0] = static_cast<unsigned char>(it->second.slot % ATLAS_SLOTS);
+                        entry[1] = static_cast<unsigned char>(it->second.slot / ATLAS_SLOTS);
+                        entry[2] = static_cast<unsigned char>(level);
+                        entry[3] = 255;
+                    }
+                    else if (!above.empty())
+                        memcpy(entry, &above[(static_cast<size_t>(std::min(y / 2, levelSize(tableHeight, level + 1) - 1)) * aboveWidth
+                            + std::min(x / 2, aboveWidth - 1)) * 4], 4);
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, &entries[0]);
+            above.swap(entries);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        tableDirty = false;
+    }
+
+    VirtualTexture(const VirtualTexture&);
+    VirtualTexture& operator=(const VirtualTexture&);
+};
+
+#endif